@@ -0,0 +1,414 @@
+#include "../src/stdafx.hpp"
+
+#include "../src/util/string.hpp"
+
+#ifdef _WIN32
+	#include <process.h>
+#else
+	#include <fcntl.h>
+	#include <sys/resource.h>
+	#include <sys/wait.h>
+	#include <unistd.h>
+#endif
+
+
+
+//Benchmark suite: renders every built-in scene with the renderer built in every rendering mode, at
+//	fixed settings, several times each, and reports the throughput with confidence intervals.  The
+//	results (CSV) can be given back as a baseline, to flag regressions.
+
+
+
+//Rendering modes, by the renderer executable built for each (see "CMakeLists.txt")
+static std::vector<std::pair<std::string,std::string>> const _modes = {
+	{ "ours", "simple-spectral"      },
+	{ "meng", "simple-spectral-meng" },
+	{ "jh",   "simple-spectral-jh"   },
+	{ "rgb",  "simple-spectral-rgb"  }
+};
+static std::vector<std::string> const _scenes = { "cornell", "cornell-srgb", "plane-srgb" };
+
+//Fixed render settings, so that runs are comparable
+static size_t const _width  = 160;
+static size_t const _height = 120;
+static size_t const _spp    =  16;
+static size_t const _seed   =   0;
+
+//Result of one case (scene and mode), over its repetitions
+class _Result final { public:
+	std::string scene;
+	std::string mode;
+	size_t threads;
+	size_t repetitions;
+
+	//Mean, and half-width of the 95% confidence interval
+	double wall_time[2];     //s
+	double samples_per_s[2];
+	double mrays_per_s[2];
+
+	double peak_rss; //MiB (largest of any repetition)
+
+	//Hash of the image (which must be the same every repetition)
+	uint64_t image_hash;
+};
+
+//Mean of `values`, and half-width of its 95% confidence interval (by Student's t-distribution)
+static void _get_mean_ci(std::vector<double> const& values, double result[2]) {
+	size_t n = values.size();
+	double mean = 0.0;
+	for (double value : values) mean+=value;
+	mean /= static_cast<double>(n);
+	result[0] = mean;
+	result[1] = 0.0;
+	if (n>1); else return;
+
+	double var = 0.0;
+	for (double value : values) var+=(value-mean)*(value-mean);
+	var /= static_cast<double>(n-1);
+
+	//	Two-sided 97.5% quantiles of the t-distribution, for 1 to 30 degrees of freedom
+	static double const t_quantiles[30] = {
+		12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+		 2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+		 2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+	};
+	double t = n-1<=30 ? t_quantiles[n-2] : 1.960;
+	result[1] = t * std::sqrt( var / static_cast<double>(n) );
+}
+
+//Number after `"<key>": ` in the JSON `text`
+static double _get_json_number(std::string const& text, std::string const& key) {
+	size_t loc = text.find("\""+key+"\": ");
+	if (loc!=std::string::npos); else throw -1;
+	return std::stod(text.substr( loc + key.size() + 4 ));
+}
+
+//FNV-1a hash of the file at `path`
+static uint64_t _hash_file(std::string const& path) {
+	std::ifstream file(path,std::ios::binary);
+	uint64_t hash = 14695981039346656037ull;
+	char c;
+	while (file.get(c)) {
+		hash ^= static_cast<uint8_t>(c);
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+//Run the program at `path` with arguments `args` (its output discarded), and wait for it.  Returns
+//	whether it succeeded, with its peak resident set size (MiB; zero if unknown).
+static bool _run(std::string const& path, std::vector<std::string> const& args, double* peak_rss) {
+	std::vector<char const*> argv = { path.c_str() };
+	for (std::string const& arg : args) argv.push_back(arg.c_str());
+	argv.push_back(nullptr);
+	*peak_rss = 0.0;
+
+	#ifdef _WIN32
+		return _spawnv( _P_WAIT, path.c_str(), argv.data() ) == 0;
+	#else
+		pid_t pid = fork();
+		if (pid==0) {
+			int null = open("/dev/null",O_WRONLY);
+			dup2(null,STDOUT_FILENO);
+			dup2(null,STDERR_FILENO);
+			execv( path.c_str(), const_cast<char*const*>(argv.data()) );
+			_exit(127);
+		}
+		if (pid>0); else return false;
+
+		int status;
+		struct rusage usage;
+		if (wait4(pid,&status,0,&usage)==pid); else return false;
+		#ifdef __APPLE__
+			*peak_rss = static_cast<double>(usage.ru_maxrss) / (1024.0*1024.0); //Bytes
+		#else
+			*peak_rss = static_cast<double>(usage.ru_maxrss) / 1024.0; //KiB
+		#endif
+		return WIFEXITED(status) && WEXITSTATUS(status)==0;
+	#endif
+}
+
+//Run one case.  Returns whether every repetition succeeded (and rendered the same image).
+static bool _run_case(
+	std::string const& renderer_path, std::string const& scene, size_t threads, size_t repetitions,
+	std::string const& tmp_path, _Result* result
+) {
+	std::string image_path = tmp_path + ".pfm";
+	std::string stats_path = tmp_path + ".json";
+	std::vector<std::string> args = {
+		"--scene="+scene, "-w="+std::to_string(_width), "-h="+std::to_string(_height),
+		"-spp="+std::to_string(_spp), "--seed="+std::to_string(_seed),
+		"--threads="+std::to_string(threads), "--checkpoint-interval=0",
+		"--output="+image_path, "--stats="+stats_path
+	};
+
+	std::vector<double> wall_times, samples_per_s, mrays_per_s;
+	result->peak_rss = 0.0;
+	for (size_t k=0;k<repetitions;++k) {
+		std::chrono::steady_clock::time_point time_begin = std::chrono::steady_clock::now();
+		double peak_rss = 0.0;
+		bool success = _run( renderer_path, args, &peak_rss );
+		double wall_time = static_cast<double>(
+			std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now()-time_begin).count()
+		) * 1.0e-9;
+		if (success); else return false;
+
+		std::ifstream file(stats_path);
+		std::string stats( (std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>() );
+		file.close();
+		double render_time, samples, rays;
+		try {
+			render_time = _get_json_number(stats,"render_time");
+			samples     = _get_json_number(stats,"samples"    );
+			rays        = _get_json_number(stats,"camera") + _get_json_number(stats,"indirect") + _get_json_number(stats,"shadow");
+		} catch (...) {
+			return false;
+		}
+
+		uint64_t image_hash = _hash_file(image_path);
+		if (k==0) result->image_hash=image_hash;
+		else if (image_hash!=result->image_hash) {
+			fprintf(stderr,"Render of \"%s\" is not reproducible (image differs between repetitions)!\n",scene.c_str());
+			return false;
+		}
+
+		wall_times.push_back(wall_time);
+		samples_per_s.push_back( samples/render_time );
+		mrays_per_s.push_back( rays/render_time*1.0e-6 );
+		result->peak_rss = std::max( result->peak_rss, peak_rss );
+	}
+	remove(image_path.c_str());
+	remove(stats_path.c_str());
+
+	result->scene       = scene;
+	result->threads     = threads;
+	result->repetitions = repetitions;
+	_get_mean_ci( wall_times,    result->wall_time     );
+	_get_mean_ci( samples_per_s, result->samples_per_s );
+	_get_mean_ci( mrays_per_s,   result->mrays_per_s   );
+	return true;
+}
+
+static char const* _csv_header =
+	"scene,mode,width,height,spp,threads,repetitions,"
+	"wall_time_s,wall_time_ci95,samples_per_s,samples_per_s_ci95,mrays_per_s,mrays_per_s_ci95,"
+	"peak_rss_mib,image_hash\n"
+;
+
+static void _save(std::string const& path, std::vector<_Result> const& results) {
+	FILE* file = fopen(path.c_str(),"wb");
+	if (file!=nullptr); else {
+		fprintf(stderr,"Could not open \"%s\" for writing!\n",path.c_str());
+		throw -1;
+	}
+	if (Str::endswith(path,".json")) {
+		fprintf(file,"[\n");
+		for (size_t k=0;k<results.size();++k) {
+			_Result const& r = results[k];
+			fprintf(file,
+				"\t{ \"scene\": \"%s\", \"mode\": \"%s\", \"width\": %zu, \"height\": %zu, \"spp\": %zu, "
+				"\"threads\": %zu, \"repetitions\": %zu, "
+				"\"wall_time_s\": [%.6f, %.6f], \"samples_per_s\": [%.1f, %.1f], \"mrays_per_s\": [%.4f, %.4f], "
+				"\"peak_rss_mib\": %.1f, \"image_hash\": \"%016llx\" }%s\n",
+				Str::json_escape(r.scene).c_str(), Str::json_escape(r.mode).c_str(), _width,_height,_spp, r.threads, r.repetitions,
+				r.wall_time[0],r.wall_time[1], r.samples_per_s[0],r.samples_per_s[1], r.mrays_per_s[0],r.mrays_per_s[1],
+				r.peak_rss, static_cast<unsigned long long>(r.image_hash), k+1<results.size()?",":""
+			);
+		}
+		fprintf(file,"]\n");
+	} else {
+		fputs(_csv_header,file);
+		for (_Result const& r : results) {
+			fprintf(file,
+				"%s,%s,%zu,%zu,%zu,%zu,%zu,%.6f,%.6f,%.1f,%.1f,%.4f,%.4f,%.1f,%016llx\n",
+				r.scene.c_str(), r.mode.c_str(), _width,_height,_spp, r.threads, r.repetitions,
+				r.wall_time[0],r.wall_time[1], r.samples_per_s[0],r.samples_per_s[1], r.mrays_per_s[0],r.mrays_per_s[1],
+				r.peak_rss, static_cast<unsigned long long>(r.image_hash)
+			);
+		}
+	}
+	fclose(file);
+}
+
+//Load results saved (as CSV) by an earlier run
+static std::vector<_Result> _load(std::string const& path) {
+	std::ifstream file(path);
+	if (file.is_open()); else {
+		fprintf(stderr,"Could not open baseline \"%s\"!\n",path.c_str());
+		throw -1;
+	}
+	std::vector<_Result> results;
+	std::string line;
+	std::getline(file,line); //Header
+	while (std::getline(file,line)) {
+		if (!line.empty() && line.back()=='\r') line.pop_back();
+		std::vector<std::string> fields = Str::split(line,",");
+		if (fields.size()==15); else continue;
+		//	Only results for the same settings are comparable.
+		if (
+			fields[2]==std::to_string(_width) && fields[3]==std::to_string(_height) &&
+			fields[4]==std::to_string(_spp)
+		); else continue;
+
+		_Result r;
+		r.scene            = fields[0];
+		r.mode             = fields[1];
+		r.threads          = std::stoul(fields[ 5]);
+		r.repetitions      = std::stoul(fields[ 6]);
+		r.wall_time[0]     = std::stod (fields[ 7]);
+		r.wall_time[1]     = std::stod (fields[ 8]);
+		r.samples_per_s[0] = std::stod (fields[ 9]);
+		r.samples_per_s[1] = std::stod (fields[10]);
+		r.mrays_per_s[0]   = std::stod (fields[11]);
+		r.mrays_per_s[1]   = std::stod (fields[12]);
+		r.peak_rss         = std::stod (fields[13]);
+		r.image_hash       = std::stoull(fields[14],nullptr,16);
+		results.push_back(r);
+	}
+	return results;
+}
+
+//Compare `results` against `baseline`, printing the differences.  Returns the number of regressions:
+//	cases whose throughput's confidence interval lies entirely below the baseline's, and cases of
+//	the baseline that have no result (e.g. because they failed).
+static size_t _compare(std::vector<_Result> const& results, std::vector<_Result> const& baseline) {
+	size_t num_regressions = 0;
+	printf("\nComparison with baseline (samples/s):\n");
+	for (_Result const& r : results) {
+		_Result const* b = nullptr;
+		for (_Result const& candidate : baseline) {
+			if (candidate.scene==r.scene && candidate.mode==r.mode && candidate.threads==r.threads) b=&candidate;
+		}
+		if (b!=nullptr); else {
+			printf("  %-12s %-4s  (not in baseline)\n",r.scene.c_str(),r.mode.c_str());
+			continue;
+		}
+
+		double change = ( r.samples_per_s[0]/b->samples_per_s[0] - 1.0 ) * 100.0;
+		char const* verdict = "";
+		if      (r.samples_per_s[0]+r.samples_per_s[1] < b->samples_per_s[0]-b->samples_per_s[1]) {
+			verdict = "REGRESSION";
+			++num_regressions;
+		} else if (r.samples_per_s[0]-r.samples_per_s[1] > b->samples_per_s[0]+b->samples_per_s[1]) {
+			verdict = "improvement";
+		}
+		printf(
+			"  %-12s %-4s  %12.1f -> %12.1f  (%+6.1f%%)  %s%s\n",
+			r.scene.c_str(), r.mode.c_str(), b->samples_per_s[0], r.samples_per_s[0], change, verdict,
+			r.image_hash!=b->image_hash ? "  (image changed)" : ""
+		);
+	}
+	for (_Result const& b : baseline) {
+		bool found = false;
+		for (_Result const& r : results) {
+			if (r.scene==b.scene && r.mode==b.mode && r.threads==b.threads) found=true;
+		}
+		if (found) continue;
+		printf("  %-12s %-4s  MISSING (in baseline, but no result)\n",b.scene.c_str(),b.mode.c_str());
+		++num_regressions;
+	}
+	return num_regressions;
+}
+
+inline static void _print_usage() {
+	printf(
+		"Simple Spectral benchmark: renders every built-in scene in every rendering mode, at %zux%zu\n"
+		"with %zu samples per pixel, and reports the throughput.  Run it from the repository root (the\n"
+		"scenes' data is found relative to it).\n"
+		"  Optional arguments:\n"
+		"    `--repetitions=<count>`/`-r=<count>`\n"
+		"          Set the number of times each case is rendered (default 5).\n"
+		"    `--threads=<count>`/`-t=<count>`\n"
+		"          Set the number of render threads (default: one per hardware thread).\n"
+		"    `--renderers=<directory>`\n"
+		"          Set where the renderers are (default: the benchmark's own directory).\n"
+		"    `--output=<path>`/`-o=<path>`\n"
+		"          Set where the results are saved, as CSV, or as JSON if the path ends with\n"
+		"          \".json\" (default \"bench.csv\").\n"
+		"    `--baseline=<path>`\n"
+		"          Compare with the results (CSV) of an earlier run.  Exits with failure if any\n"
+		"          case regressed or is missing.  (It also does if any case failed, e.g.\n"
+		"          because its image differed between repetitions.)\n",
+		_width,_height, _spp
+	);
+}
+
+int main(int argc, char* argv[]) {
+	//Parse arguments
+	size_t repetitions = 5;
+	size_t threads = std::max( std::thread::hardware_concurrency(), 1u );
+	std::string renderers_dir;
+	std::string output_path = "bench.csv";
+	std::string baseline_path;
+	{
+		std::string self = argv[0];
+		size_t loc = self.find_last_of("/\\");
+		renderers_dir = loc!=std::string::npos ? self.substr(0,loc) : ".";
+	}
+	try {
+		for (int k=1;k<argc;++k) {
+			std::vector<std::string> components = Str::split(argv[k],"=",1);
+			if (components.size()==2); else throw -1;
+			std::string const& name  = components[0];
+			std::string const& value = components[1];
+			if      (name=="--repetitions"||name=="-r") repetitions  =Str::to_pos(value);
+			else if (name=="--threads"    ||name=="-t") threads      =Str::to_pos(value);
+			else if (name=="--renderers"              ) renderers_dir=value;
+			else if (name=="--output"     ||name=="-o") output_path  =value;
+			else if (name=="--baseline"               ) baseline_path=value;
+			else throw -1;
+		}
+	} catch (...) {
+		_print_usage();
+		return -1;
+	}
+
+	std::vector<_Result> baseline;
+	if (!baseline_path.empty()) {
+		try {
+			baseline = _load(baseline_path);
+		} catch (int) {
+			return -1;
+		}
+	}
+
+	//Run every case
+	std::vector<_Result> results;
+	size_t num_failed = 0;
+	for (auto const& mode : _modes) {
+		#ifdef _WIN32
+		std::string renderer_path = renderers_dir + "/" + mode.second + ".exe";
+		#else
+		std::string renderer_path = renderers_dir + "/" + mode.second;
+		#endif
+		for (std::string const& scene : _scenes) {
+			printf("%-12s %-4s ",scene.c_str(),mode.first.c_str());
+			fflush(stdout);
+
+			_Result result;
+			if (_run_case( renderer_path, scene, threads, repetitions, output_path+".tmp", &result )) {
+				result.mode = mode.first;
+				printf(
+					"%10.1f ± %8.1f samples/s  %8.3f ± %6.3f Mrays/s  %7.3f s  %7.1f MiB\n",
+					result.samples_per_s[0],result.samples_per_s[1], result.mrays_per_s[0],result.mrays_per_s[1],
+					result.wall_time[0], result.peak_rss
+				);
+				results.push_back(result);
+			} else {
+				printf("failed (running \"%s\")\n",renderer_path.c_str());
+				++num_failed;
+			}
+		}
+	}
+
+	try {
+		_save(output_path,results);
+	} catch (int) {
+		return -1;
+	}
+	printf("Results saved to \"%s\".\n",output_path.c_str());
+	if (num_failed>0) printf("%zu case(s) failed.\n",num_failed);
+
+	if (!baseline.empty() && _compare(results,baseline)>0) return 1;
+	return num_failed>0 ? 1 : 0;
+}
@@ -0,0 +1,203 @@
+#include "../src/stdafx.hpp"
+
+#include "../src/util/color.hpp"
+#include "../src/util/random.hpp"
+#include "../src/util/spherical-tri.hpp"
+
+#include "../src/geometry.hpp"
+#include "../src/material.hpp"
+
+
+
+//Microbenchmarks of the renderer's hot kernels, each timed in isolation on randomized inputs.  The
+//	inputs are generated up front (few enough to stay in cache) and run through once to warm up;
+//	then the kernel is timed over them repeatedly, and the median time per call is reported.  Only
+//	the color conversion of the rendering mode built in is available, so the benchmark is built once
+//	per spectral mode (see "CMakeLists.txt").
+
+
+
+//Number of distinct inputs for each kernel, and how many calls are timed together (cycling through
+//	them) in each trial
+#define MICROBENCH_INPUTS 4096_zu
+#define MICROBENCH_CALLS  (256_zu*MICROBENCH_INPUTS)
+#define MICROBENCH_TRIALS 15_zu
+
+//Results are accumulated here, so the kernels can't be optimized away
+static float volatile _sink;
+
+//Time `kernel` (called with an input index in [0,`MICROBENCH_INPUTS`), and returning a value that
+//	depends on the result), and print its time per call.
+template <typename TypeKernel>
+static void _run(char const* name, TypeKernel const& kernel) {
+	float sum = 0.0f;
+
+	//	Warm up: touch every input, and let the clock speed settle.
+	for (size_t k=0;k<4*MICROBENCH_INPUTS;++k) sum+=kernel(k%MICROBENCH_INPUTS);
+
+	std::vector<double> ns_per_call;
+	for (size_t trial=0;trial<MICROBENCH_TRIALS;++trial) {
+		std::chrono::steady_clock::time_point time_begin = std::chrono::steady_clock::now();
+		for (size_t k=0;k<MICROBENCH_CALLS;++k) sum+=kernel(k%MICROBENCH_INPUTS);
+		std::chrono::steady_clock::time_point time_end = std::chrono::steady_clock::now();
+		ns_per_call.push_back(
+			static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(time_end-time_begin).count()) /
+			static_cast<double>(MICROBENCH_CALLS)
+		);
+	}
+	_sink = sum;
+
+	std::sort(ns_per_call.begin(),ns_per_call.end());
+	printf(
+		"  %-44s %9.2f ns/op  (min %9.2f, max %9.2f)\n",
+		name, ns_per_call[MICROBENCH_TRIALS/2], ns_per_call.front(), ns_per_call.back()
+	);
+}
+
+int main(int /*argc*/, char* /*argv*/[]) {
+	#ifdef RENDER_MODE_SPECTRAL
+	Color::init();
+	#endif
+
+	Math::RNG rng;
+	auto rand_1f = [&]() -> float { return Math::rand_1f(rng); };
+	auto rand_dir = [&]() -> Dir { float pdf; return Math::rand_sphere( glm::vec2(rand_1f(),rand_1f()), &pdf ); };
+	#ifdef RENDER_MODE_SPECTRAL
+	auto rand_lambda_0 = [&]() -> nm { return LAMBDA_MIN + rand_1f()*LAMBDA_STEP; };
+	#endif
+
+	#if   defined RENDER_MODE_SPECTRAL_OURS
+	printf("Kernel microbenchmarks (spectral, ours):\n");
+	#elif defined RENDER_MODE_SPECTRAL_MENG
+	printf("Kernel microbenchmarks (spectral, Meng et al. 2015):\n");
+	#elif defined RENDER_MODE_SPECTRAL_JH
+	printf("Kernel microbenchmarks (spectral, Jakob and Hanika 2019):\n");
+	#else
+	printf("Kernel microbenchmarks (RGB):\n");
+	#endif
+
+	//Ray-triangle intersection
+	{
+		//	Random triangles, each with a ray from a random origin toward a point inside it (a hit),
+		//		or outside it (a miss).  Degenerate triangles have collinear vertices.
+		std::vector<PrimTri> tris(MICROBENCH_INPUTS), tris_degen(MICROBENCH_INPUTS);
+		std::vector<Ray> rays_hit(MICROBENCH_INPUTS), rays_miss(MICROBENCH_INPUTS);
+		for (size_t k=0;k<MICROBENCH_INPUTS;++k) {
+			Pos A=rand_dir(), B=rand_dir(), C=rand_dir();
+			tris[k].verts[0].pos=A; tris[k].verts[1].pos=B; tris[k].verts[2].pos=C;
+			tris[k].normal = glm::normalize(glm::cross( B-A, C-A ));
+
+			Pos orig = 4.0f * rand_dir();
+			float u=rand_1f(), v=rand_1f();
+			if (u+v>1.0f) { u=1.0f-u; v=1.0f-v; }
+			rays_hit [k] = { orig, glm::normalize( A + u*(B-A) + v*(C-A) - orig ) };
+			rays_miss[k] = { orig, glm::normalize( A - (0.1f+u)*(B-A) - (0.1f+v)*(C-A) - orig ) };
+
+			float t = rand_1f();
+			tris_degen[k].verts[0].pos=A; tris_degen[k].verts[1].pos=B; tris_degen[k].verts[2].pos=A+t*(B-A);
+			tris_degen[k].normal = tris[k].normal;
+		}
+		auto intersect = [&](std::vector<PrimTri> const& prims, std::vector<Ray> const& rays, size_t k) -> float {
+			HitRecord hitrec;
+			hitrec.dist = INF;
+			return prims[k].intersect(rays[k],&hitrec) ? hitrec.dist : 1.0f;
+		};
+		_run( "PrimTri::intersect (hit)",        [&](size_t k) -> float { return intersect(tris,      rays_hit, k); } );
+		_run( "PrimTri::intersect (miss)",       [&](size_t k) -> float { return intersect(tris,      rays_miss,k); } );
+		_run( "PrimTri::intersect (degenerate)", [&](size_t k) -> float { return intersect(tris_degen,rays_hit, k); } );
+	}
+
+	//Spherical triangles: construction, and sampling directions toward them
+	{
+		std::vector<std::array<Pos,3>> verts(MICROBENCH_INPUTS);
+		std::vector<Math::SphericalTriangle> sphtris;
+		std::vector<glm::vec2> us(MICROBENCH_INPUTS);
+		for (size_t k=0;k<MICROBENCH_INPUTS;++k) {
+			//	Small triangles, as lights seen from a distance are.
+			Dir center = rand_dir();
+			for (Pos& vert : verts[k]) vert=glm::normalize( center + 0.2f*rand_dir() );
+			sphtris.emplace_back( verts[k][0], verts[k][1], verts[k][2] );
+			us[k] = glm::vec2(rand_1f(),rand_1f());
+		}
+		_run( "SphericalTriangle::SphericalTriangle", [&](size_t k) -> float {
+			return Math::SphericalTriangle( verts[k][0], verts[k][1], verts[k][2] ).solid_angle;
+		} );
+		_run( "Math::rand_toward_sphericaltri", [&](size_t k) -> float {
+			return Math::rand_toward_sphericaltri( us[k], sphtris[k] ).x;
+		} );
+	}
+
+	#ifdef RENDER_MODE_SPECTRAL
+	//Spectra and color conversion
+	{
+		std::vector<nm> lambda_0s(MICROBENCH_INPUTS);
+		std::vector<lRGB_F32> lrgbs(MICROBENCH_INPUTS);
+		std::vector<SpectralRadiantFlux::HeroSample> fluxes(MICROBENCH_INPUTS);
+		std::vector<float> pdfs(MICROBENCH_INPUTS);
+		for (size_t k=0;k<MICROBENCH_INPUTS;++k) {
+			lambda_0s[k] = rand_lambda_0();
+			lrgbs[k] = lRGB_F32( rand_1f(), rand_1f(), rand_1f() );
+			for (size_t l=0;l<SAMPLE_WAVELENGTHS;++l) fluxes[k][static_cast<int>(l)]=rand_1f();
+			pdfs[k] = 0.5f + rand_1f();
+		}
+
+		_run( "_Spectrum::operator[]", [&](size_t k) -> float {
+			return Color::data->std_obs_ybar[lambda_0s[k]][0];
+		} );
+
+		#ifdef RENDER_MODE_SPECTRAL_JH
+		if (Color::data->model_jh2019==nullptr) {
+			printf("  %-44s (skipped: coefficient data not found)\n","Color::lrgb_to_specrefl");
+		} else
+		#endif
+		{
+			_run( "Color::lrgb_to_specrefl", [&](size_t k) -> float {
+				return Color::lrgb_to_specrefl( lrgbs[k], lambda_0s[k] )[0];
+			} );
+		}
+
+		_run( "Color::specradflux_to_ciexyz (hero sample)", [&](size_t k) -> float {
+			return Color::specradflux_to_ciexyz( fluxes[k], lambda_0s[k],pdfs[k] ).y;
+		} );
+	}
+	#endif
+
+	//Texture lookup
+	try {
+		sRGB_ReflectanceTexture texture("data/scenes/test-img.png");
+		std::vector<ST> sts(MICROBENCH_INPUTS);
+		#ifdef RENDER_MODE_SPECTRAL
+		std::vector<nm> lambda_0s(MICROBENCH_INPUTS);
+		#endif
+		for (size_t k=0;k<MICROBENCH_INPUTS;++k) {
+			sts[k] = ST( rand_1f(), rand_1f() );
+			#ifdef RENDER_MODE_SPECTRAL
+			lambda_0s[k] = rand_lambda_0();
+			#endif
+		}
+		#ifdef RENDER_MODE_SPECTRAL
+		#ifdef RENDER_MODE_SPECTRAL_JH
+		if (Color::data->model_jh2019==nullptr) {
+			printf("  %-44s (skipped: coefficient data not found)\n","sRGB_ReflectanceTexture::sample");
+		} else
+		#endif
+		{
+			_run( "sRGB_ReflectanceTexture::sample", [&](size_t k) -> float {
+				return texture.sample( sts[k], lambda_0s[k] )[0];
+			} );
+		}
+		#else
+		_run( "sRGB_ReflectanceTexture::sample", [&](size_t k) -> float {
+			return texture.sample( sts[k] )[0];
+		} );
+		#endif
+	} catch (int) {
+		printf("  %-44s (skipped: run from the repository root, so the texture can be found)\n","sRGB_ReflectanceTexture::sample");
+	}
+
+	#ifdef RENDER_MODE_SPECTRAL
+	Color::deinit();
+	#endif
+
+	return 0;
+}
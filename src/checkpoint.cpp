@@ -0,0 +1,382 @@
+#include "checkpoint.hpp"
+
+#include "framebuffer.hpp"
+#include "util/thread-pool.hpp"
+
+
+
+namespace Checkpoint {
+
+
+
+/*
+File format (all values in the machine's native byte order; `float`s in the header are stored as
+their bits):
+	Magic number "SSCHKPNT"
+	Header: `uint32_t` count, then that many `uint32_t` values (see `_fields`)
+	Scene name: `uint32_t` length, then that many characters
+	Sample counts: `uint32_t` for each pixel of the crop region
+	Sample sums: four `double`s for each pixel of the crop region
+Pixels are in the framebuffer's order.
+*/
+
+static char const _magic[8] = { 'S','S','C','H','K','P','N','T' };
+
+//Header values.  They determine the image (`IMAGE`), which pixels are stored (`REGION`), or only
+//	the noise (`NOISE`).  Partial images can be merged if their `IMAGE` values agree.
+enum class _KIND { VERSION, IMAGE, REGION, NOISE };
+static std::pair<char const*,_KIND> const _fields[] = {
+	{ "format version",      _KIND::VERSION },
+	{ "render mode",         _KIND::IMAGE   },
+	{ "observer",            _KIND::IMAGE   },
+	{ "width",               _KIND::IMAGE   },
+	{ "height",              _KIND::IMAGE   },
+	{ "crop x",              _KIND::REGION  },
+	{ "crop y",              _KIND::REGION  },
+	{ "crop width",          _KIND::REGION  },
+	{ "crop height",         _KIND::REGION  },
+	{ "samples",             _KIND::NOISE   },
+	{ "indirect only",       _KIND::IMAGE   },
+	{ "light sampling",      _KIND::IMAGE   },
+	{ "wavelength sampling", _KIND::IMAGE   },
+	{ "sampler",             _KIND::NOISE   },
+	{ "seed",                _KIND::NOISE   },
+	{ "camera position x",   _KIND::IMAGE   },
+	{ "camera position y",   _KIND::IMAGE   },
+	{ "camera position z",   _KIND::IMAGE   },
+	{ "camera direction x",  _KIND::IMAGE   },
+	{ "camera direction y",  _KIND::IMAGE   },
+	{ "camera direction z",  _KIND::IMAGE   },
+	{ "camera up x",         _KIND::IMAGE   },
+	{ "camera up y",         _KIND::IMAGE   },
+	{ "camera up z",         _KIND::IMAGE   },
+	{ "camera field of view",_KIND::IMAGE   }
+};
+static constexpr size_t _num_fields = sizeof(_fields) / sizeof(*_fields);
+static constexpr uint32_t _version = 3u;
+//	Indices of fields used directly.  The crop region's are x, y, width, and height in order.
+static constexpr size_t _WIDTH=3, _HEIGHT=4, _CROP=5, _SAMPLES=9, _SAMPLER=13, _SEED=14;
+
+static uint32_t _float_bits(float value) {
+	uint32_t bits;
+	memcpy( &bits, &value, sizeof(uint32_t) );
+	return bits;
+}
+static std::array<uint32_t,_num_fields> _get_header(Renderer::Options const& options) {
+	return {
+		_version,
+		#ifdef RENDER_MODE_SPECTRAL
+		static_cast<uint32_t>(RENDER_MODE_SPECTRAL_ALGNUM),
+		static_cast<uint32_t>(CIE_OBSERVER),
+		#else
+		0u,
+		0u,
+		#endif
+		static_cast<uint32_t>(options.res[0]),
+		static_cast<uint32_t>(options.res[1]),
+		static_cast<uint32_t>(options.crop.pos[0]),
+		static_cast<uint32_t>(options.crop.pos[1]),
+		static_cast<uint32_t>(options.crop.res[0]),
+		static_cast<uint32_t>(options.crop.res[1]),
+		static_cast<uint32_t>(options.spp),
+		options.indirect_only?1u:0u,
+		static_cast<uint32_t>(options.light_sampling),
+		#ifdef RENDER_MODE_SPECTRAL
+		static_cast<uint32_t>(options.wavelength_sampling),
+		#else
+		0u,
+		#endif
+		static_cast<uint32_t>(options.sampler),
+		options.seed,
+		_float_bits(options.camera_pos.x), _float_bits(options.camera_pos.y), _float_bits(options.camera_pos.z),
+		_float_bits(options.camera_dir.x), _float_bits(options.camera_dir.y), _float_bits(options.camera_dir.z),
+		_float_bits(options.camera_up .x), _float_bits(options.camera_up .y), _float_bits(options.camera_up .z),
+		_float_bits(options.camera_vfov_deg)
+	};
+}
+
+//Seeking and telling with 64-bit offsets (`long` is 32-bit on Windows)
+#ifdef _WIN32
+	static int     _seek(FILE* file, int64_t offset, int origin) { return _fseeki64(file,offset,origin); }
+	static int64_t _tell(FILE* file                            ) { return _ftelli64(file              ); }
+#else
+	static int     _seek(FILE* file, int64_t offset, int origin) { return fseeko(file,static_cast<off_t>(offset),origin); }
+	static int64_t _tell(FILE* file                            ) { return static_cast<int64_t>(ftello(file)); }
+#endif
+
+//An open checkpoint file, positioned after the header and scene name
+class _File final {
+	public:
+		std::string const path;
+		FILE* file;
+		//Size of the file (bytes), against which sizes read from it are checked before anything is
+		//	allocated for them
+		uint64_t size;
+
+		std::array<uint32_t,_num_fields> header;
+		std::string scene_name;
+
+	public:
+		explicit _File(std::string const& path) :
+			path(path)
+		{
+			file = fopen(path.c_str(),"rb");
+			if (file!=nullptr); else {
+				fprintf(stderr,"Could not open checkpoint file \"%s\"!\n",path.c_str());
+				throw -1;
+			}
+
+			try {
+				int64_t end;
+				if (_seek(file,0,SEEK_END)==0 && (end=_tell(file))>=0 && _seek(file,0,SEEK_SET)==0); else {
+					fail("could not get its size");
+				}
+				size = static_cast<uint64_t>(end);
+				_read_header();
+			} catch (int) {
+				fclose(file);
+				throw;
+			}
+		}
+		~_File() { fclose(file); }
+
+		[[noreturn]] void fail(char const* reason) {
+			fprintf(stderr,"Could not read checkpoint file \"%s\": %s!\n",path.c_str(),reason);
+			throw -2;
+		}
+
+	private:
+		//	Fail unless at least `count` more values of `value_size` bytes remain in the file
+		void _check_remaining(uint64_t count, uint64_t value_size) {
+			uint64_t remaining = size - static_cast<uint64_t>(_tell(file));
+			if (count <= remaining/value_size); else fail("file is truncated");
+		}
+
+		void _read_header() {
+			char magic[8];
+			if (fread( magic, sizeof(char),8, file )==8 && memcmp(magic,_magic,8)==0); else {
+				fail("not a checkpoint file");
+			}
+
+			uint32_t header_size;
+			if (fread( &header_size, sizeof(uint32_t),1, file )==1); else fail("file is truncated");
+			_check_remaining( header_size, sizeof(uint32_t) );
+			std::vector<uint32_t> values(header_size);
+			if (fread( values.data(), sizeof(uint32_t),header_size, file )==header_size); else fail("file is truncated");
+			if (header_size==_num_fields && values[0]==_version); else {
+				fail("unsupported format version");
+			}
+			std::copy( values.begin(),values.end(), header.begin() );
+
+			uint32_t name_size;
+			if (fread( &name_size, sizeof(uint32_t),1, file )==1); else fail("file is truncated");
+			_check_remaining( name_size, sizeof(char) );
+			scene_name.resize(name_size);
+			if (fread( &scene_name[0], sizeof(char),name_size, file )==name_size); else fail("file is truncated");
+
+			if (
+				static_cast<uint64_t>(header[_CROP  ])+header[_CROP+2]<=header[_WIDTH] &&
+				static_cast<uint64_t>(header[_CROP+1])+header[_CROP+3]<=header[_HEIGHT]
+			); else {
+				fail("invalid crop region");
+			}
+		}
+
+	public:
+		//Read the crop region's counts and sums into arrays for the whole image.  If `add`, the
+		//	values are added to those already there instead of replacing them.
+		void read_data(Renderer::PixelSum* sums, uint32_t* counts, bool add) {
+			size_t res_x = header[_WIDTH];
+			size_t pos[2] = { header[_CROP  ], header[_CROP+1] };
+			size_t res[2] = { header[_CROP+2], header[_CROP+3] };
+			_check_remaining( static_cast<uint64_t>(res[0])*res[1], sizeof(uint32_t)+sizeof(Renderer::PixelSum) );
+
+			std::vector<uint32_t>           row_counts( res[0] );
+			std::vector<Renderer::PixelSum> row_sums  ( res[0] );
+			for (size_t j=pos[1];j<pos[1]+res[1];++j) {
+				if (fread( row_counts.data(), sizeof(uint32_t),res[0], file )==res[0]); else fail("file is truncated");
+				for (size_t i=0;i<res[0];++i) {
+					if (row_counts[i]<=header[_SAMPLES]); else fail("invalid sample count");
+					counts[ j*res_x + pos[0]+i ] = ( add ? counts[j*res_x+pos[0]+i] : 0u ) + row_counts[i];
+				}
+			}
+			for (size_t j=pos[1];j<pos[1]+res[1];++j) {
+				if (fread( row_sums.data(), sizeof(Renderer::PixelSum),res[0], file )==res[0]); else fail("file is truncated");
+				for (size_t i=0;i<res[0];++i) {
+					if (add) sums[ j*res_x + pos[0]+i ] += row_sums[i];
+					else     sums[ j*res_x + pos[0]+i ]  = row_sums[i];
+				}
+			}
+		}
+};
+
+bool save(
+	std::string const& path, Renderer::Options const& options,
+	Renderer::PixelSum const* sums, uint32_t const* counts
+) {
+	static_assert(sizeof(Renderer::PixelSum)==4*sizeof(double),"Implementation error!");
+
+	Framebuffer::Tile const& crop = options.crop;
+
+	//Write to a temporary file, and then move it into place
+	std::string path_tmp = path + ".tmp";
+	FILE* file = fopen(path_tmp.c_str(),"wb");
+	if (file!=nullptr); else {
+		fprintf(stderr,"Could not open checkpoint file \"%s\" for writing!\n",path_tmp.c_str());
+		return false;
+	}
+
+	std::array<uint32_t,_num_fields> header = _get_header(options);
+	uint32_t header_size = static_cast<uint32_t>(header.size());
+	uint32_t name_size   = static_cast<uint32_t>(options.scene_name.size());
+
+	bool success =
+		fwrite( _magic,                   sizeof(char),    8,           file ) == 8           &&
+		fwrite( &header_size,             sizeof(uint32_t),1,           file ) == 1           &&
+		fwrite( header.data(),            sizeof(uint32_t),header_size, file ) == header_size &&
+		fwrite( &name_size,               sizeof(uint32_t),1,           file ) == 1           &&
+		fwrite( options.scene_name.data(),sizeof(char),    name_size,   file ) == name_size
+	;
+	for (size_t j=crop.pos[1];j<crop.pos[1]+crop.res[1]&&success;++j) {
+		success = fwrite( counts + j*options.res[0]+crop.pos[0], sizeof(uint32_t),          crop.res[0], file ) == crop.res[0];
+	}
+	for (size_t j=crop.pos[1];j<crop.pos[1]+crop.res[1]&&success;++j) {
+		success = fwrite( sums   + j*options.res[0]+crop.pos[0], sizeof(Renderer::PixelSum),crop.res[0], file ) == crop.res[0];
+	}
+	success = fclose(file)==0 && success;
+
+	if (success) {
+		//	Note on Windows, `rename(...)` does not replace an existing file.
+		#ifdef _WIN32
+		remove(path.c_str());
+		#endif
+		success = rename(path_tmp.c_str(),path.c_str())==0;
+	}
+	if (success); else {
+		fprintf(stderr,"Could not write checkpoint file \"%s\"!\n",path.c_str());
+		remove(path_tmp.c_str());
+	}
+	return success;
+}
+
+void load(
+	std::string const& path, Renderer::Options const& options,
+	Renderer::PixelSum* sums, uint32_t* counts
+) {
+	_File file(path);
+
+	std::array<uint32_t,_num_fields> expected = _get_header(options);
+	for (size_t i=1;i<_num_fields;++i) {
+		if (file.header[i]==expected[i]) continue;
+		fprintf(stderr,
+			"Could not resume from checkpoint file \"%s\": it is for a render with a different %s (%u, not %u)!\n",
+			path.c_str(), _fields[i].first, file.header[i], expected[i]
+		);
+		throw -3;
+	}
+	if (file.scene_name==options.scene_name); else file.fail("it is for a render of a different scene");
+
+	file.read_data( sums,counts, false );
+}
+
+void merge(std::vector<std::string> const& paths, std::string const& output_path) {
+	assert(!paths.empty());
+
+	std::vector<Renderer::PixelSum> sums;
+	std::vector<uint32_t>           counts;
+	std::vector<_File*> files;
+	auto cleanup = [&]() -> void {
+		for (_File* file : files) delete file;
+	};
+
+	try {
+		for (std::string const& path : paths) {
+			_File* file = new _File(path);
+			files.push_back(file);
+
+			_File const* first = files[0];
+			if (file==first) {
+				sums.resize  ( static_cast<size_t>(file->header[_WIDTH])*file->header[_HEIGHT], Renderer::PixelSum(0) );
+				counts.resize( static_cast<size_t>(file->header[_WIDTH])*file->header[_HEIGHT], 0u                    );
+			} else {
+				for (size_t i=1;i<_num_fields;++i) {
+					if (_fields[i].second!=_KIND::IMAGE || file->header[i]==first->header[i]) continue;
+					fprintf(stderr,
+						"Cannot merge \"%s\" with \"%s\": they are for renders with a different %s (%u and %u)!\n",
+						first->path.c_str(), path.c_str(), _fields[i].first, first->header[i], file->header[i]
+					);
+					throw -3;
+				}
+				if (file->scene_name==first->scene_name); else {
+					fprintf(stderr,
+						"Cannot merge \"%s\" with \"%s\": they are renders of different scenes!\n",
+						first->path.c_str(), path.c_str()
+					);
+					throw -3;
+				}
+
+				//	Overlapping regions are fine (their samples are simply averaged), but only if the
+				//		samples are actually different.
+				for (_File const* other : files) {
+					if (other==file) break;
+					bool overlap = true;
+					for (size_t k=0;k<2;++k) {
+						uint32_t lo = std::max( other->header[_CROP+k], file->header[_CROP+k] );
+						uint32_t hi = std::min(
+							other->header[_CROP+k] + other->header[_CROP+2+k],
+							file ->header[_CROP+k] + file ->header[_CROP+2+k]
+						);
+						overlap = overlap && lo<hi;
+					}
+					if (overlap && other->header[_SAMPLER]==file->header[_SAMPLER] && other->header[_SEED]==file->header[_SEED]) {
+						fprintf(stderr,
+							"Warning: \"%s\" and \"%s\" overlap and have the same sampler and seed; their samples are not independent!\n",
+							other->path.c_str(), path.c_str()
+						);
+					}
+				}
+			}
+
+			file->read_data( sums.data(),counts.data(), true );
+		}
+	} catch (int) {
+		cleanup();
+		throw;
+	}
+
+	//Resolve the merged pixels into an image
+	size_t res[2] = { files[0]->header[_WIDTH], files[0]->header[_HEIGHT] };
+	std::string scene_name = files[0]->scene_name;
+	cleanup();
+
+	Framebuffer framebuffer(res);
+	size_t num_missing = 0;
+	uint32_t count_min=~0u, count_max=0u;
+	for (size_t j=0;j<res[1];++j) {
+		for (size_t i=0;i<res[0];++i) {
+			uint32_t count = counts[ j*res[0] + i ];
+			if (count>0u) {
+				framebuffer(i,j) = Renderer::resolve( sums[j*res[0]+i], count );
+			} else {
+				++num_missing;
+			}
+			count_min = std::min( count_min, count );
+			count_max = std::max( count_max, count );
+		}
+	}
+	if (num_missing>0) {
+		fprintf(stderr,"Warning: %zu pixel(s) are not covered by any partial image!\n",num_missing);
+	}
+
+	std::string samples = std::to_string(count_min);
+	if (count_max!=count_min) samples+="-"+std::to_string(count_max);
+	ThreadPool pool(0);
+	framebuffer.save( output_path, {
+		{ "Scene",           scene_name },
+		{ "SamplesPerPixel", samples    }
+	}, {}, {}, &pool );
+}
+
+
+
+}
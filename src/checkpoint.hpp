@@ -0,0 +1,47 @@
+#pragma once
+
+#include "stdafx.hpp"
+
+#include "renderer.hpp"
+
+
+
+//Checkpoints of a render in progress, so that a long render can be stopped and later resumed.  A
+//	checkpoint holds the linear accumulation buffer (each pixel's sum of samples and its count of
+//	samples) over the render's crop region, along with the options that determine the image.  The
+//	samplers are counter-based, so a pixel's sample count is also the position of its random
+//	numbers; nothing else is needed to continue the render exactly as if it had never stopped.
+//
+//	The same files also serve as partial images: the output of one shard of a render split across
+//	machines (or of one of several renders of the same image with different seeds).  These are
+//	merged by summing the pixels' sums and counts, which is exactly what a single render of the
+//	whole image would have computed for those samples, so there are no seams.
+namespace Checkpoint {
+
+
+
+//Write a checkpoint for a render with options `options` to `path`.  The arrays have one entry per
+//	pixel of the whole image, but only the crop region `options.crop` is written.  The file is
+//	replaced atomically, so an interrupted write leaves any previous checkpoint intact.  Returns
+//	whether the write succeeded.
+bool save(
+	std::string const& path, Renderer::Options const& options,
+	Renderer::PixelSum const* sums, uint32_t const* counts
+);
+
+//Read the checkpoint at `path` into the arrays (which have one entry per pixel of the whole
+//	image).  The checkpoint must have been written by a render with the same options as `options`
+//	(except for those, like the number of threads, that do not affect the image).
+void load(
+	std::string const& path, Renderer::Options const& options,
+	Renderer::PixelSum* sums, uint32_t* counts
+);
+
+//Merge the partial images (checkpoints) at `paths` and save the result as an image to
+//	`output_path`.  The partial images must be of the same image (scene, resolution, and rendering
+//	options), but may cover different regions, and may have different seeds and sample counts.
+void merge(std::vector<std::string> const& paths, std::string const& output_path);
+
+
+
+}
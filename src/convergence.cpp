@@ -0,0 +1,304 @@
+#include "convergence.hpp"
+
+
+
+/*
+LDR-FLIP (Andersson et al. 2020, "FLIP: A Difference Evaluator for Alternating Images"), for an
+observer at 0.7 m from a 0.7 m wide, 3840-pixel display (about 67 pixels per degree).  Both images
+are filtered by the contrast sensitivity functions of the eye in an opponent color space (YCxCz),
+and compared in a Hunt-adjusted L*a*b* with the HyAB distance; that color difference is then
+amplified where the images' edges and points (in luminance) differ.  The filters are all sums of
+separable ones, so they are applied as such.
+*/
+
+static float const _flip_ppd = 0.7f * (3840.0f/0.7f) * Constants::pi<float>/180.0f;
+static float const _flip_qc=0.7f, _flip_qf=0.5f, _flip_pc=0.4f, _flip_pt=0.95f;
+
+//BT.709 ℓRGB to CIE XYZ (and back), with the D65 white (the XYZ of ℓRGB white) as the reference
+static glm::vec3 _lrgb_to_xyz(glm::vec3 const& c) {
+	return glm::vec3(
+		0.4124564f*c.r + 0.3575761f*c.g + 0.1804375f*c.b,
+		0.2126729f*c.r + 0.7151522f*c.g + 0.0721750f*c.b,
+		0.0193339f*c.r + 0.1191920f*c.g + 0.9503041f*c.b
+	);
+}
+static glm::vec3 _xyz_to_lrgb(glm::vec3 const& c) {
+	return glm::vec3(
+		 3.2404542f*c.x - 1.5371385f*c.y - 0.4985314f*c.z,
+		-0.9692660f*c.x + 1.8760108f*c.y + 0.0415560f*c.z,
+		 0.0556434f*c.x - 0.2040259f*c.y + 1.0572252f*c.z
+	);
+}
+static glm::vec3 const _white_xyz = _lrgb_to_xyz(glm::vec3(1.0f));
+
+static glm::vec3 _lrgb_to_ycxcz(glm::vec3 const& lrgb) {
+	glm::vec3 xyz = _lrgb_to_xyz(lrgb) / _white_xyz;
+	return glm::vec3( 116.0f*xyz.y-16.0f, 500.0f*(xyz.x-xyz.y), 200.0f*(xyz.y-xyz.z) );
+}
+static glm::vec3 _ycxcz_to_lrgb(glm::vec3 const& ycxcz) {
+	float y = (ycxcz[0]+16.0f) / 116.0f;
+	return _xyz_to_lrgb( glm::vec3( y+ycxcz[1]/500.0f, y, y-ycxcz[2]/200.0f ) * _white_xyz );
+}
+//	ℓRGB to L*a*b*, with the chroma scaled by the lightness (the Hunt effect)
+static glm::vec3 _lrgb_to_huntlab(glm::vec3 const& lrgb) {
+	auto f = [](float t) -> float {
+		float const delta = 6.0f / 29.0f;
+		return t>delta*delta*delta ? std::cbrt(t) : t/(3.0f*delta*delta)+4.0f/29.0f;
+	};
+	glm::vec3 xyz = _lrgb_to_xyz(lrgb) / _white_xyz;
+	float L = 116.0f*f(xyz.y) - 16.0f;
+	float a = 500.0f*( f(xyz.x) - f(xyz.y) );
+	float b = 200.0f*( f(xyz.y) - f(xyz.z) );
+	return glm::vec3( L, 0.01f*L*a, 0.01f*L*b );
+}
+static float _hyab(glm::vec3 const& lab0, glm::vec3 const& lab1) {
+	glm::vec3 delta = lab0 - lab1;
+	return std::abs(delta[0]) + std::sqrt( delta[1]*delta[1] + delta[2]*delta[2] );
+}
+
+//Convolve the image `in` (`res[0]`×`res[1]`) along rows with `kernel_x`, and then along columns with
+//	`kernel_y` (both of odd size, centered), clamping to the edges.
+static std::vector<float> _convolve(
+	std::vector<float> const& in, size_t const res[2],
+	std::vector<float> const& kernel_x, std::vector<float> const& kernel_y
+) {
+	std::vector<float> tmp(in.size()), out(in.size());
+	int w=static_cast<int>(res[0]), h=static_cast<int>(res[1]);
+	int rx=static_cast<int>(kernel_x.size()/2), ry=static_cast<int>(kernel_y.size()/2);
+	for (int j=0;j<h;++j) {
+		for (int i=0;i<w;++i) {
+			float sum = 0.0f;
+			for (int k=-rx;k<=rx;++k) sum += kernel_x[static_cast<size_t>(k+rx)] * in[ static_cast<size_t>( j*w + std::clamp(i+k,0,w-1) ) ];
+			tmp[static_cast<size_t>(j*w+i)] = sum;
+		}
+	}
+	for (int j=0;j<h;++j) {
+		for (int i=0;i<w;++i) {
+			float sum = 0.0f;
+			for (int k=-ry;k<=ry;++k) sum += kernel_y[static_cast<size_t>(k+ry)] * tmp[ static_cast<size_t>( std::clamp(j+k,0,h-1)*w + i ) ];
+			out[static_cast<size_t>(j*w+i)] = sum;
+		}
+	}
+	return out;
+}
+
+//The LDR-FLIP intermediates of an image (clipped ℓRGB, in `lrgb`) that are compared between images:
+//	for each pixel, its filtered color (in Hunt-adjusted L*a*b*), and the magnitudes of its edge and
+//	point features.
+static void _flip_prepare(
+	std::vector<lRGB_F32> const& lrgb, size_t const res[2],
+	std::vector<glm::vec3>* lab, std::vector<glm::vec2>* features
+) {
+	size_t num_pixels = res[0] * res[1];
+
+	//Color pipeline: filter each opponent channel by its contrast sensitivity function, a sum of
+	//	(one or two) Gaussians.
+	std::vector<float> channels[3];
+	for (std::vector<float>& channel : channels) channel.resize(num_pixels);
+	for (size_t k=0;k<num_pixels;++k) {
+		glm::vec3 ycxcz = _lrgb_to_ycxcz(lrgb[k]);
+		for (size_t c=0;c<3;++c) channels[c][k]=ycxcz[static_cast<int>(c)];
+	}
+	{
+		//	Parameters (a₁,b₁,a₂,b₂) for the achromatic, red-green, and blue-yellow channels
+		float const params[3][4] = {
+			{  1.0f, 0.0047f,  0.0f, 1.0e-5f },
+			{  1.0f, 0.0053f,  0.0f, 1.0e-5f },
+			{ 34.1f, 0.04f,   13.5f, 0.025f  }
+		};
+		float const pi = Constants::pi<float>;
+		int radius = static_cast<int>(std::ceil( 3.0f * std::sqrt(0.04f/(2.0f*pi*pi)) * _flip_ppd ));
+		for (size_t c=0;c<3;++c) {
+			std::vector<float> gaussians[2];
+			float weights[2], total=0.0f;
+			for (size_t g=0;g<2;++g) {
+				float a=params[c][2*g], b=params[c][2*g+1];
+				float sum = 0.0f;
+				for (int x=-radius;x<=radius;++x) {
+					float dx = static_cast<float>(x) / _flip_ppd;
+					gaussians[g].push_back(std::exp( -pi*pi*dx*dx/b ));
+					sum += gaussians[g].back();
+				}
+				weights[g] = a * std::sqrt(pi/b);
+				total += weights[g] * sum*sum;
+			}
+			std::vector<float> filtered = _convolve( channels[c], res, gaussians[0],gaussians[0] );
+			if (weights[1]>0.0f) {
+				std::vector<float> filtered2 = _convolve( channels[c], res, gaussians[1],gaussians[1] );
+				for (size_t k=0;k<num_pixels;++k) filtered[k]=weights[0]*filtered[k]+weights[1]*filtered2[k];
+			} else {
+				for (size_t k=0;k<num_pixels;++k) filtered[k]*=weights[0];
+			}
+			for (size_t k=0;k<num_pixels;++k) channels[c][k]=filtered[k]/total;
+		}
+	}
+	lab->resize(num_pixels);
+	for (size_t k=0;k<num_pixels;++k) {
+		glm::vec3 filtered = _ycxcz_to_lrgb(glm::vec3( channels[0][k], channels[1][k], channels[2][k] ));
+		(*lab)[k] = _lrgb_to_huntlab(glm::clamp( filtered, glm::vec3(0.0f),glm::vec3(1.0f) ));
+	}
+
+	//Feature pipeline: edges and points in the (normalized) luminance, from the first and second
+	//	derivatives of a Gaussian.  Each kernel's positive and negative weights are normalized to
+	//	sum to ±1.
+	std::vector<float> luminance(num_pixels);
+	for (size_t k=0;k<num_pixels;++k) luminance[k]=_lrgb_to_xyz(lrgb[k]).y/_white_xyz.y;
+	{
+		float sd = 0.5f * 0.082f * _flip_ppd;
+		int radius = static_cast<int>(std::ceil( 3.0f * sd ));
+		std::vector<float> gaussian, edge, point;
+		for (int x=-radius;x<=radius;++x) {
+			float fx = static_cast<float>(x);
+			float g = std::exp( -fx*fx/(2.0f*sd*sd) );
+			gaussian.push_back(g);
+			edge    .push_back( -fx*g );
+			point   .push_back( (fx*fx/(sd*sd)-1.0f) * g );
+		}
+		auto normalize = [](std::vector<float>* kernel) -> void {
+			float pos=0.0f, neg=0.0f;
+			for (float w : *kernel) { if (w>0.0f) pos+=w; else neg-=w; }
+			for (float& w : *kernel) {
+				if      (w>0.0f) w/=pos;
+				else if (w<0.0f) w/=neg;
+			}
+		};
+		normalize(&gaussian); normalize(&edge); normalize(&point);
+
+		std::vector<float> edge_x  = _convolve( luminance, res, edge,    gaussian );
+		std::vector<float> edge_y  = _convolve( luminance, res, gaussian,edge     );
+		std::vector<float> point_x = _convolve( luminance, res, point,   gaussian );
+		std::vector<float> point_y = _convolve( luminance, res, gaussian,point    );
+		features->resize(num_pixels);
+		for (size_t k=0;k<num_pixels;++k) {
+			(*features)[k] = glm::vec2(
+				std::sqrt( edge_x [k]*edge_x [k] + edge_y [k]*edge_y [k] ),
+				std::sqrt( point_x[k]*point_x[k] + point_y[k]*point_y[k] )
+			);
+		}
+	}
+}
+
+
+
+Convergence::Convergence(std::string const& reference_path, std::string const& csv_path, size_t const res[2]) :
+	_res{ res[0], res[1] }
+{
+	//Load the reference image.  See `Framebuffer::save(...)` for the row order.
+	{
+		FILE* file = fopen(reference_path.c_str(),"rb");
+		if (file!=nullptr); else {
+			fprintf(stderr,"Could not open reference image \"%s\"!\n",reference_path.c_str());
+			throw -1;
+		}
+		char type[3];
+		size_t width, height;
+		float scale;
+		if (
+			fscanf(file,"%2s %zu %zu %f",type,&width,&height,&scale)==4 && std::string(type)=="PF" &&
+			fgetc(file)=='\n'
+		); else {
+			fprintf(stderr,"Reference image \"%s\" is not an RGB PFM image!\n",reference_path.c_str());
+			fclose(file);
+			throw -2;
+		}
+		if (width==_res[0] && height==_res[1]); else {
+			fprintf(stderr,
+				"Reference image \"%s\" is %zux%zu, but the render is %zux%zu!\n",
+				reference_path.c_str(), width,height, _res[0],_res[1]
+			);
+			fclose(file);
+			throw -2;
+		}
+		_reference.resize(_res[0]*_res[1]);
+		for (size_t j=0;j<_res[1];++j) {
+			lRGB_F32* row = _reference.data() + (_res[1]-1-j)*_res[0];
+			if (fread( row, sizeof(float),3*_res[0], file ) == 3*_res[0]); else {
+				fprintf(stderr,"Could not read reference image \"%s\"!\n",reference_path.c_str());
+				fclose(file);
+				throw -2;
+			}
+		}
+		fclose(file);
+
+		//	A positive scale means the data is big-endian.
+		uint16_t const one = 1u;
+		bool little_endian = *reinterpret_cast<uint8_t const*>(&one) == 1u;
+		if ((scale<0.0f) != little_endian) {
+			for (lRGB_F32& pixel : _reference) {
+				for (int c=0;c<3;++c) {
+					uint8_t bytes[4];
+					memcpy( bytes, &pixel[c], 4 );
+					std::reverse( bytes, bytes+4 );
+					memcpy( &pixel[c], bytes, 4 );
+				}
+			}
+		}
+	}
+
+	std::vector<lRGB_F32> clipped = _reference;
+	for (lRGB_F32& pixel : clipped) pixel=glm::clamp( pixel, lRGB_F32(0.0f),lRGB_F32(1.0f) );
+	_flip_prepare( clipped, _res, &_reference_lab, &_reference_features );
+
+	_file = fopen(csv_path.c_str(),"wb");
+	if (_file!=nullptr); else {
+		fprintf(stderr,"Could not open convergence file \"%s\" for writing!\n",csv_path.c_str());
+		throw -1;
+	}
+	fprintf(_file,"time,samples_per_pixel,rmse,relmse,flip\n");
+	fflush(_file);
+}
+Convergence::~Convergence() {
+	fclose(_file);
+}
+
+Convergence::Errors Convergence::compute(Framebuffer const& framebuffer) const {
+	size_t num_pixels = _res[0] * _res[1];
+
+	Errors errors = { 0.0, 0.0, 0.0 };
+
+	std::vector<lRGB_F32> clipped(num_pixels);
+	for (size_t j=0;j<_res[1];++j) {
+		for (size_t i=0;i<_res[0];++i) {
+			size_t k = j*_res[0] + i;
+			lRGB_F32 test = lRGB_F32( framebuffer(i,j) );
+			lRGB_F32 const& ref = _reference[k];
+			for (int c=0;c<3;++c) {
+				double diff2 = static_cast<double>(test[c]-ref[c]);
+				diff2 *= diff2;
+				errors.rmse   += diff2;
+				errors.relmse += diff2 / ( static_cast<double>(ref[c])*static_cast<double>(ref[c]) + 0.01 );
+			}
+			clipped[k] = glm::clamp( test, lRGB_F32(0.0f),lRGB_F32(1.0f) );
+		}
+	}
+	errors.rmse   = std::sqrt( errors.rmse / static_cast<double>(3*num_pixels) );
+	errors.relmse /= static_cast<double>(3*num_pixels);
+
+	std::vector<glm::vec3> lab;
+	std::vector<glm::vec2> features;
+	_flip_prepare( clipped, _res, &lab, &features );
+
+	//	The largest color difference (that between green and blue), and its redistribution so that
+	//		differences below a fraction `_flip_pc` of it take a fraction `_flip_pt` of the range
+	float cmax = std::pow( _hyab( _lrgb_to_huntlab(glm::vec3(0,1,0)), _lrgb_to_huntlab(glm::vec3(0,0,1)) ), _flip_qc );
+	float pccmax = _flip_pc * cmax;
+	for (size_t k=0;k<num_pixels;++k) {
+		float delta_c = std::pow( _hyab(lab[k],_reference_lab[k]), _flip_qc );
+		if (delta_c<pccmax) delta_c=(_flip_pt/pccmax)*delta_c;
+		else                delta_c=_flip_pt + (delta_c-pccmax)/(cmax-pccmax)*(1.0f-_flip_pt);
+
+		glm::vec2 delta = glm::abs( features[k] - _reference_features[k] );
+		float delta_f = std::clamp( std::pow( std::max(delta.x,delta.y)/std::sqrt(2.0f), _flip_qf ), 0.0f,1.0f );
+
+		errors.flip += static_cast<double>(std::pow( delta_c, 1.0f-delta_f ));
+	}
+	errors.flip /= static_cast<double>(num_pixels);
+
+	return errors;
+}
+
+void Convergence::record(Framebuffer const& framebuffer, double time, size_t spp) {
+	Errors errors = compute(framebuffer);
+	fprintf(_file, "%.6f,%zu,%.9g,%.9g,%.9g\n", time,spp, errors.rmse,errors.relmse,errors.flip);
+	fflush(_file);
+}
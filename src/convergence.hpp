@@ -0,0 +1,45 @@
+#pragma once
+
+#include "stdafx.hpp"
+
+#include "framebuffer.hpp"
+
+
+
+//Measures how a progressive render converges: the error of its image against a reference image,
+//	recorded over time as rows of a CSV file.  Running each rendering mode with the same reference
+//	gives time-to-error curves, so that the methods can be compared at equal time (rather than at
+//	equal sample counts).
+class Convergence final {
+	public:
+		//Errors of an image against the reference
+		class Errors final { public:
+			double rmse;   //Root mean squared error of the linear RGB values
+			double relmse; //Mean relative squared error of the linear RGB values, (x-r)²/(r²+0.01)
+			double flip;   //Mean LDR-FLIP error of the images as displayed (i.e., clipped sRGB)
+		};
+
+	private:
+		size_t const _res[2];
+
+		//The reference image, in the framebuffer's order (see `Framebuffer`)
+		std::vector<lRGB_F32> _reference;
+		//	Its LDR-FLIP intermediates, which don't change between measurements
+		std::vector<glm::vec3> _reference_lab;
+		std::vector<glm::vec2> _reference_features;
+
+		FILE* _file;
+
+	public:
+		//Load the reference image from `reference_path` (a PFM image with the resolution `res`, as
+		//	this renderer saves), and start the CSV file at `csv_path`.
+		Convergence(std::string const& reference_path, std::string const& csv_path, size_t const res[2]);
+		~Convergence();
+
+		//Errors of the framebuffer's current image
+		Errors compute(Framebuffer const& framebuffer) const;
+
+		//Measure the framebuffer's errors, and write them to the CSV file along with the render
+		//	time so far (s) and the samples per pixel.
+		void record(Framebuffer const& framebuffer, double time, size_t spp);
+};
@@ -0,0 +1,416 @@
+#include "daemon.hpp"
+
+#include "util/socket.hpp"
+#include "util/string.hpp"
+#include "util/thread-pool.hpp"
+
+#include "checkpoint.hpp"
+
+
+
+namespace Daemon {
+
+
+
+/*
+Protocol (messages as `Net::Socket::send_message(...)`; values in the machine's native byte order):
+	Client to server:
+		`RENDER`: the render's arguments, each followed by a null character
+		`CANCEL`: (empty) stop the client's request
+	Server to client:
+		`TILE`:   `uint32_t` x, y, width, and height of a tile, then its sample counts and sums (as
+		          in a checkpoint)
+		`DONE`:   `uint32_t` whether the render completed (i.e., was not cancelled)
+		`REJECTED`: a message (the request was not rendered)
+*/
+
+enum class _MSG : uint32_t { RENDER, CANCEL, TILE, DONE, REJECTED };
+
+static size_t _get_tile_size(size_t num_pixels) {
+	return 4*sizeof(uint32_t) + num_pixels*( sizeof(uint32_t) + sizeof(Renderer::PixelSum) );
+}
+
+
+
+//A client, as seen by the server
+class _Client final {
+	public:
+		size_t const id;
+		Net::Socket*const socket;
+
+		//Data received but not yet handled (i.e., the start of an incomplete message)
+		std::vector<uint8_t> buffer;
+
+		//Whether the client has a request queued or rendering (a client can have only one at a
+		//	time), and whether it has disconnected
+		bool has_request;
+		bool dead;
+
+	public:
+		_Client(size_t id, Net::Socket* socket) :
+			id(id), socket(socket), has_request(false), dead(false)
+		{}
+		~_Client() { delete socket; }
+
+		//Send a message (from the server thread only).  A client that can't be sent to is dead.
+		bool send(_MSG type, void const* payload,size_t size) {
+			if (socket->send_message( static_cast<uint32_t>(type), payload,size )); else dead=true;
+			return !dead;
+		}
+		void send_error(std::string const& message) {
+			send( _MSG::REJECTED, message.data(),message.size() );
+		}
+		void send_done(bool completed) {
+			uint32_t value = completed ? 1u : 0u;
+			send( _MSG::DONE, &value,sizeof(uint32_t) );
+		}
+};
+
+void run_server(
+	std::string const& path, size_t num_threads, ParseFunction const& parse,
+	std::sig_atomic_t volatile const* interrupted
+) {
+	Net::Listener* listener = new Net::Listener(path);
+	ThreadPool pool(num_threads);
+	printf("Serving render requests on \"%s\" with %zu thread(s).\n",path.c_str(),pool.get_num_threads());
+
+	//Loaded scenes, by name
+	std::map<std::string,Scene*> scenes;
+
+	std::vector<_Client*> clients;
+	size_t next_client_id = 0;
+
+	//Requests waiting to render, and the one rendering
+	std::deque<std::pair<_Client*,Renderer::Options>> queue;
+	Renderer* renderer        = nullptr;
+	_Client*  renderer_client = nullptr;
+
+	//Payloads of the `TILE` messages for the rendering client, queued by the render threads for
+	//	this thread to send (so a slow client never holds up rendering)
+	std::mutex                        tiles_mutex;
+	std::vector<std::vector<uint8_t>> tiles;
+	auto send_tiles = [&]() -> void {
+		std::vector<std::vector<uint8_t>> to_send;
+		{
+			std::lock_guard<std::mutex> lock(tiles_mutex);
+			to_send.swap(tiles);
+		}
+		for (std::vector<uint8_t> const& payload : to_send) {
+			if (!renderer_client->dead); else break;
+			renderer_client->send( _MSG::TILE, payload.data(),payload.size() );
+		}
+	};
+
+	auto start_next = [&]() -> void {
+		while (renderer==nullptr && !queue.empty()) {
+			_Client*          client  = queue.front().first;
+			Renderer::Options options = queue.front().second;
+			queue.pop_front();
+
+			Scene*& scene = scenes[options.scene_name];
+			try {
+				if (scene==nullptr) {
+					printf("Loading scene \"%s\".\n",options.scene_name.c_str());
+					scene = Scene::get_new(options.scene_name);
+				}
+				renderer = new Renderer( options, &pool, scene );
+			} catch (int) {
+				client->send_error("Could not set up render (see the server's output)!");
+				client->has_request = false;
+				continue;
+			}
+			renderer_client = client;
+
+			//	Queue each tile when it has all its samples.
+			Renderer* tile_renderer = renderer;
+			renderer->tile_callback = [tile_renderer,&tiles_mutex,&tiles](Framebuffer::Tile const& tile, size_t end) -> void {
+				if (end==tile_renderer->options.spp); else return;
+
+				size_t num_pixels = tile.res[0] * tile.res[1];
+				std::vector<uint32_t>           counts( num_pixels );
+				std::vector<Renderer::PixelSum> sums  ( num_pixels );
+				tile_renderer->get_region( tile, sums.data(),counts.data() );
+
+				std::vector<uint8_t> payload( _get_tile_size(num_pixels) );
+				uint32_t region[4] = {
+					static_cast<uint32_t>(tile.pos[0]), static_cast<uint32_t>(tile.pos[1]),
+					static_cast<uint32_t>(tile.res[0]), static_cast<uint32_t>(tile.res[1])
+				};
+				memcpy( payload.data(),                                                region,        sizeof(region)                        );
+				memcpy( payload.data()+sizeof(region),                                 counts.data(), num_pixels*sizeof(uint32_t)           );
+				memcpy( payload.data()+sizeof(region)+num_pixels*sizeof(uint32_t),    sums.data(),   num_pixels*sizeof(Renderer::PixelSum) );
+				std::lock_guard<std::mutex> lock(tiles_mutex);
+				tiles.emplace_back(std::move(payload));
+			};
+
+			printf(
+				"\nRendering \"%s\" (%zux%zu, %zu samples per pixel) for client %zu.\n",
+				options.scene_name.c_str(), options.res[0],options.res[1], options.spp, client->id
+			);
+			renderer->render_start();
+		}
+	};
+	auto finish_render = [&]() -> void {
+		renderer->render_wait();
+		send_tiles();
+		if (!renderer_client->dead) renderer_client->send_done(renderer->is_completed());
+		renderer_client->has_request = false;
+		delete renderer;
+		renderer        = nullptr;
+		renderer_client = nullptr;
+	};
+
+	auto handle_message = [&](_Client* client, _MSG type, uint8_t const* payload,size_t size) -> void {
+		switch (type) {
+			case _MSG::RENDER: {
+				if (!client->has_request); else {
+					client->send_error("A request is already in progress!");
+					return;
+				}
+				//	Arguments are each terminated by a null character.
+				std::vector<std::string> args;
+				std::string arg;
+				for (size_t k=0;k<size;++k) {
+					char c = static_cast<char>(payload[k]);
+					if (c!='\0') arg.push_back(c);
+					else { args.push_back(arg); arg.clear(); }
+				}
+
+				Renderer::Options options;
+				try {
+					parse( args, &options );
+				} catch (int) {
+					client->send_error("Invalid request (see the server's output)!");
+					return;
+				}
+				//	Tiles are sent when they have all their samples, which with a time limit they
+				//		might never.
+				if (options.time_limit==0); else {
+					client->send_error("Time limits are not supported for requests!");
+					return;
+				}
+				//	Nothing is written on the server's side (and a request mustn't be able to write
+				//		files there).
+				if (
+					options.out_of_core_path.empty() && options.stats_path.empty() &&
+					options.cost_path.empty() && options.trace_path.empty()
+				); else {
+					client->send_error("`--out-of-core`, `--stats`, `--cost`, and `--trace` are not supported for requests!");
+					return;
+				}
+				//	The server renders on its own threads, and the client saves the result.
+				options.num_threads = 0;
+				options.output_path.clear();
+				options.checkpoint_path.clear();
+				options.checkpoint_interval = 0;
+				options.resume_path.clear();
+				options.perf_counters = false;
+				options.convergence_path.clear();
+				options.snapshots.clear();
+				options.exr_aovs = false;
+				#ifdef SUPPORT_WINDOWED
+				options.open_window = false;
+				#endif
+
+				client->has_request = true;
+				queue.emplace_back( client, options );
+				break;
+			}
+			case _MSG::CANCEL:
+				if (client==renderer_client) {
+					renderer->render_stop();
+				} else {
+					for (auto iter=queue.begin(); iter!=queue.end(); ++iter) {
+						if (iter->first!=client) continue;
+						queue.erase(iter);
+						client->has_request = false;
+						client->send_done(false);
+						break;
+					}
+				}
+				break;
+			default:
+				client->dead = true;
+				break;
+		}
+	};
+
+	//Main loop
+	std::vector<uint8_t> recv_buffer( 65536 );
+	while (!*interrupted) {
+		if (renderer!=nullptr && !renderer->is_rendering()) finish_render();
+		start_next();
+
+		std::vector<Net::Handle> handles = { listener->get_handle() };
+		for (_Client const* client : clients) handles.push_back(client->socket->get_handle());
+		std::vector<bool> ready = Net::poll( handles, 20 );
+
+		if (renderer!=nullptr) send_tiles();
+
+		//	New clients
+		if (ready[0]) {
+			Net::Socket* socket = listener->accept();
+			if (socket!=nullptr) clients.push_back(new _Client( next_client_id++, socket ));
+		}
+
+		//	Requests from clients.  Only what has arrived is read (so a client that sends part of a
+		//		message can't hold up the others), and kept until its message is complete.
+		for (size_t k=0;k<clients.size();++k) {
+			_Client* client = clients[k];
+			if (ready[k+1] && !client->dead); else continue;
+
+			size_t received = client->socket->recv_some( recv_buffer.data(), recv_buffer.size() );
+			if (received==0) {
+				client->dead = true;
+				continue;
+			}
+			std::vector<uint8_t>& buffer = client->buffer;
+			buffer.insert( buffer.end(), recv_buffer.begin(),recv_buffer.begin()+static_cast<ptrdiff_t>(received) );
+
+			size_t offset = 0;
+			while (buffer.size()-offset >= 2*sizeof(uint32_t) && !client->dead) {
+				uint32_t header[2];
+				memcpy( header, buffer.data()+offset, sizeof(header) );
+				if (header[1]<=Net::Socket::MAX_PAYLOAD_SIZE); else {
+					fprintf(stderr,"\nMessage too large from client %zu; disconnecting it!\n",client->id);
+					client->dead = true;
+					break;
+				}
+				if (buffer.size()-offset-sizeof(header) >= header[1]); else break;
+
+				handle_message( client, static_cast<_MSG>(header[0]), buffer.data()+offset+sizeof(header),header[1] );
+				offset += sizeof(header) + header[1];
+			}
+			buffer.erase( buffer.begin(), buffer.begin()+static_cast<ptrdiff_t>(offset) );
+		}
+
+		//	Forget clients that have disconnected, cancelling their requests.  The rendering one's
+		//		is stopped, and it's forgotten once the render finishes.
+		for (auto iter=clients.begin(); iter!=clients.end(); ) {
+			_Client* client = *iter;
+			if (client->dead); else { ++iter; continue; }
+
+			if (client==renderer_client) {
+				renderer->render_stop();
+				++iter;
+				continue;
+			}
+			for (auto iter2=queue.begin(); iter2!=queue.end(); ) {
+				if (iter2->first==client) iter2=queue.erase(iter2);
+				else ++iter2;
+			}
+			delete client;
+			iter = clients.erase(iter);
+		}
+	}
+
+	//Clean up, stopping any render
+	if (renderer!=nullptr) {
+		renderer->render_stop();
+		finish_render();
+	}
+	for (_Client* client : clients) delete client;
+	for (auto const& iter : scenes) delete iter.second;
+	delete listener;
+	printf("\nServer stopped.\n");
+}
+
+
+
+void run_client(
+	std::string const& path, std::vector<std::string> const& args, Renderer::Options const& options,
+	std::sig_atomic_t volatile const* interrupted
+) {
+	Net::Socket* socket = Net::Socket::connect_local(path);
+
+	std::string request;
+	for (std::string const& arg : args) {
+		request += arg;
+		request.push_back('\0');
+	}
+	if (socket->send_message( static_cast<uint32_t>(_MSG::RENDER), request.data(),request.size() )); else {
+		delete socket;
+		fprintf(stderr,"Lost connection to server!\n");
+		throw -2;
+	}
+
+	//Receive tiles until the render is done
+	std::vector<Renderer::PixelSum> sums  ( options.res[0]*options.res[1], Renderer::PixelSum(0) );
+	std::vector<uint32_t>           counts( options.res[0]*options.res[1], 0u                    );
+	size_t num_tiles = 0;
+	bool completed = false;
+	bool cancelled = false;
+	while (true) {
+		if (*interrupted && !cancelled) {
+			printf("\nCancelling request.\n");
+			socket->send_message( static_cast<uint32_t>(_MSG::CANCEL), nullptr,0 );
+			cancelled = true;
+		}
+		if (Net::poll( { socket->get_handle() }, 50 )[0]); else continue;
+
+		uint32_t type;
+		std::vector<uint8_t> payload;
+		if (socket->recv_message( &type, &payload )); else {
+			delete socket;
+			fprintf(stderr,"\nLost connection to server!\n");
+			throw -2;
+		}
+
+		if        (static_cast<_MSG>(type)==_MSG::TILE && payload.size()>=4*sizeof(uint32_t)) {
+			uint32_t region[4];
+			memcpy( region, payload.data(), sizeof(region) );
+			size_t num_pixels = static_cast<size_t>(region[2]) * region[3];
+			if (
+				static_cast<size_t>(region[0])+region[2]<=options.res[0] &&
+				static_cast<size_t>(region[1])+region[3]<=options.res[1] &&
+				payload.size()==_get_tile_size(num_pixels)
+			); else continue;
+
+			uint8_t const* tile_counts = payload.data() + sizeof(region);
+			uint8_t const* tile_sums   = tile_counts + num_pixels*sizeof(uint32_t);
+			for (size_t j=0;j<region[3];++j) {
+				size_t index = (region[1]+j)*options.res[0] + region[0];
+				memcpy( counts.data()+index, tile_counts+j*region[2]*sizeof(uint32_t),           region[2]*sizeof(uint32_t)           );
+				memcpy( sums  .data()+index, tile_sums  +j*region[2]*sizeof(Renderer::PixelSum), region[2]*sizeof(Renderer::PixelSum) );
+			}
+			++num_tiles;
+		} else if (static_cast<_MSG>(type)==_MSG::DONE && payload.size()==sizeof(uint32_t)) {
+			uint32_t value;
+			memcpy( &value, payload.data(), sizeof(uint32_t) );
+			completed = value!=0u;
+			break;
+		} else if (static_cast<_MSG>(type)==_MSG::REJECTED) {
+			delete socket;
+			fprintf(stderr,"Server: %s\n",std::string(payload.begin(),payload.end()).c_str());
+			throw -3;
+		}
+	}
+	delete socket;
+
+	printf(
+		"Render %s; received %zu tile(s).\n",
+		completed ? "completed" : "cancelled", num_tiles
+	);
+
+	//Save the tiles received (as a partial image, if asked for)
+	if (Str::endswith(options.output_path,".partial")) {
+		Checkpoint::save( options.output_path, options, sums.data(),counts.data() );
+	} else {
+		Framebuffer framebuffer(options.res);
+		ThreadPool pool(options.num_threads);
+		for (size_t j=0;j<options.res[1];++j) {
+			for (size_t i=0;i<options.res[0];++i) {
+				size_t index = j*options.res[0] + i;
+				if (counts[index]>0u) framebuffer(i,j)=Renderer::resolve( sums[index], counts[index] );
+			}
+		}
+		framebuffer.save( options.output_path, {
+			{ "Scene",           options.scene_name                               },
+			{ "SamplesPerPixel", std::to_string(options.spp)                         }
+		}, options.exr, {}, &pool );
+	}
+}
+
+
+
+}
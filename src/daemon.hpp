@@ -0,0 +1,40 @@
+#pragma once
+
+#include "stdafx.hpp"
+
+#include "renderer.hpp"
+
+
+
+//A long-lived render server, for interactive tools that render many (small) images and can't wait
+//	for a new process and scene load each time.  It listens on a Unix-domain socket for requests,
+//	each the arguments of a render (as on the command line, including camera overrides and a crop
+//	region).  Requests are rendered one at a time, in order, on a resident pool of threads, with
+//	scenes loaded once and kept by name.  Each tile is sent back (as linear sums and sample counts)
+//	as soon as it has all its samples.  A client can cancel its request, which stops the render
+//	through `Renderer::render_stop()`.
+namespace Daemon {
+
+
+
+//Parses a render's arguments into options, printing an error and throwing if they are invalid
+typedef std::function<void(std::vector<std::string> const&,Renderer::Options*)> ParseFunction;
+
+//Serve requests on the Unix-domain socket at `path`, rendering with `num_threads` threads (zero for
+//	one per hardware thread), until `*interrupted` becomes nonzero.
+void run_server(
+	std::string const& path, size_t num_threads, ParseFunction const& parse,
+	std::sig_atomic_t volatile const* interrupted
+);
+
+//Request the render with arguments `args` (parsed into `options`) from the server at `path`, and
+//	save the result to `options.output_path`.  If `*interrupted` becomes nonzero, the request is
+//	cancelled, and the tiles received so far are saved.
+void run_client(
+	std::string const& path, std::vector<std::string> const& args, Renderer::Options const& options,
+	std::sig_atomic_t volatile const* interrupted
+);
+
+
+
+}
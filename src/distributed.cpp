@@ -0,0 +1,558 @@
+#include "distributed.hpp"
+
+#include "util/socket.hpp"
+
+
+
+namespace Distributed {
+
+
+
+/*
+Protocol (all values in the machine's native byte order, so machines must agree on it):
+	Each message is a `uint32_t` type (see `_MSG`), a `uint32_t` payload size, and the payload.
+	Coordinator to worker:
+		`OPTIONS`: `uint32_t` values (see `_get_option_fields(...)`), then the scene name
+		`UNIT`:    `uint32_t` unit index, then the unit's region's x, y, width, and height
+		`DONE`:    (empty) the render is complete
+	Worker to coordinator:
+		`REQUEST`: (empty) a thread wants a unit
+		`RESULT`:  `uint32_t` unit index, then the unit's sample counts and sums (as in a checkpoint)
+*/
+
+enum class _MSG : uint32_t { OPTIONS, UNIT, DONE, REQUEST, RESULT };
+static constexpr uint32_t _protocol_version = 2u;
+
+//Side length of a (square) work unit, in pixels.  Large enough that a unit's samples take much
+//	longer than sending it.
+static constexpr size_t _UNIT_SIZE = 4*TILE_SIZE;
+
+class _Message final { public:
+	_MSG type;
+	std::vector<uint8_t> payload;
+};
+
+static uint32_t _float_bits(float value) {
+	uint32_t bits;
+	memcpy( &bits, &value, sizeof(uint32_t) );
+	return bits;
+}
+static float _bits_float(uint32_t bits) {
+	float value;
+	memcpy( &value, &bits, sizeof(float) );
+	return value;
+}
+static std::vector<uint32_t> _get_option_fields(Renderer::Options const& options) {
+	return {
+		_protocol_version,
+		#ifdef RENDER_MODE_SPECTRAL
+		static_cast<uint32_t>(RENDER_MODE_SPECTRAL_ALGNUM),
+		static_cast<uint32_t>(CIE_OBSERVER),
+		#else
+		0u,
+		0u,
+		#endif
+		static_cast<uint32_t>(options.res[0]),
+		static_cast<uint32_t>(options.res[1]),
+		static_cast<uint32_t>(options.spp),
+		options.indirect_only?1u:0u,
+		static_cast<uint32_t>(options.light_sampling),
+		#ifdef RENDER_MODE_SPECTRAL
+		static_cast<uint32_t>(options.wavelength_sampling),
+		#else
+		0u,
+		#endif
+		static_cast<uint32_t>(options.sampler),
+		options.seed,
+		_float_bits(options.camera_pos.x), _float_bits(options.camera_pos.y), _float_bits(options.camera_pos.z),
+		_float_bits(options.camera_dir.x), _float_bits(options.camera_dir.y), _float_bits(options.camera_dir.z),
+		_float_bits(options.camera_up .x), _float_bits(options.camera_up .y), _float_bits(options.camera_up .z),
+		_float_bits(options.camera_vfov_deg)
+	};
+}
+static constexpr size_t _num_option_fields = 21;
+
+//Send a message, or receive one (waiting for it).  Return whether successful.
+static bool _send(Net::Socket* socket, _MSG type, void const* payload,size_t size) {
+	return socket->send_message( static_cast<uint32_t>(type), payload,size );
+}
+static bool _recv(Net::Socket* socket, _Message* message) {
+	uint32_t type;
+	bool success = socket->recv_message( &type, &message->payload );
+	message->type = static_cast<_MSG>(type);
+	return success;
+}
+
+//Size of the payload of a `RESULT` message for a unit with `num_pixels` pixels
+static size_t _get_result_size(size_t num_pixels) {
+	return sizeof(uint32_t) + num_pixels*( sizeof(uint32_t) + sizeof(Renderer::PixelSum) );
+}
+
+
+
+//A worker, as seen by the coordinator
+class _Connection final {
+	public:
+		size_t const id;
+		Net::Socket*const socket;
+
+		//Data received but not yet handled (i.e., the start of an incomplete message)
+		std::vector<uint8_t> buffer;
+
+		//Number of units the worker has asked for but not been sent
+		size_t num_requests;
+		//Units sent to the worker whose results have not arrived
+		std::vector<size_t> units;
+
+		bool dead;
+
+	public:
+		_Connection(size_t id, Net::Socket* socket) :
+			id(id), socket(socket), num_requests(0), dead(false)
+		{}
+		~_Connection() { delete socket; }
+};
+
+//A part of the image handed out to workers
+class _Unit final { public:
+	Framebuffer::Tile region;
+	bool done;
+
+	//Workers (by id) the unit has been sent to, which have not returned it, and when it was first
+	//	sent to any of them
+	std::vector<size_t> workers;
+	std::chrono::steady_clock::time_point time_assigned;
+};
+
+void run_coordinator(
+	Renderer::Options const& options, std::string const& host,uint16_t port,
+	std::sig_atomic_t volatile const* interrupted
+) {
+	Renderer* renderer = new Renderer(options);
+	Net::Listener* listener;
+	try {
+		listener = new Net::Listener(host,port);
+	} catch (int) {
+		delete renderer;
+		throw;
+	}
+
+	std::vector<uint32_t> option_fields = _get_option_fields(options);
+	std::vector<uint8_t> options_payload( option_fields.size()*sizeof(uint32_t) + options.scene_name.size() );
+	memcpy( options_payload.data(), option_fields.data(), option_fields.size()*sizeof(uint32_t) );
+	memcpy( options_payload.data()+option_fields.size()*sizeof(uint32_t), options.scene_name.data(), options.scene_name.size() );
+
+	//Divide the crop region into units.  Units already complete (when resuming) are skipped.
+	std::vector<_Unit> units;
+	std::deque<size_t> pending;
+	size_t num_done = 0;
+	{
+		Framebuffer::Tile const& crop = options.crop;
+		std::vector<Renderer::PixelSum> sums  ( _UNIT_SIZE*_UNIT_SIZE );
+		std::vector<uint32_t>           counts( _UNIT_SIZE*_UNIT_SIZE );
+		//	From the top, so that the image fills in like a local render's.
+		for (size_t j1=crop.pos[1]+crop.res[1]; j1>crop.pos[1]; ) {
+			size_t j0 = j1-std::min( _UNIT_SIZE, j1-crop.pos[1] );
+			for (size_t i=crop.pos[0];i<crop.pos[0]+crop.res[0];i+=_UNIT_SIZE) {
+				_Unit unit;
+				unit.region = { { i, j0 }, { std::min(_UNIT_SIZE,crop.pos[0]+crop.res[0]-i), j1-j0 } };
+
+				renderer->get_region( unit.region, sums.data(),counts.data() );
+				unit.done = std::all_of( counts.begin(), counts.begin()+static_cast<ptrdiff_t>(unit.region.res[0]*unit.region.res[1]),
+					[&](uint32_t count) -> bool { return count==options.spp; }
+				);
+				if (unit.done) ++num_done;
+				else pending.push_back(units.size());
+
+				units.push_back(unit);
+			}
+			j1 = j0;
+		}
+	}
+
+	printf(
+		"Coordinating render of %zu unit(s) (%zu already complete) on port %u; waiting for workers.\n",
+		units.size(), num_done, static_cast<unsigned>(port)
+	);
+
+	std::vector<_Connection*> connections;
+	size_t next_connection_id = 0;
+
+	//Time taken by units so far (from first being sent to the result arriving), for spotting units
+	//	held up by slow (or hung) workers
+	double units_total_time = 0.0;
+	size_t units_timed = 0;
+
+	auto seconds_since = [](std::chrono::steady_clock::time_point time) -> double {
+		return std::chrono::duration<double>( std::chrono::steady_clock::now() - time ).count();
+	};
+	std::chrono::steady_clock::time_point time_start           = std::chrono::steady_clock::now();
+	std::chrono::steady_clock::time_point time_last_print      = time_start;
+	std::chrono::steady_clock::time_point time_last_checkpoint = time_start;
+	auto print_progress = [&]() -> void {
+		size_t num_workers = 0;
+		for (_Connection const* connection : connections) if (!connection->dead) ++num_workers;
+		printf(
+			"\rRendered %zu of %zu units with %zu worker(s) (%.1f seconds)   ",
+			num_done, units.size(), num_workers, seconds_since(time_start)
+		);
+		fflush(stdout);
+		time_last_print = std::chrono::steady_clock::now();
+	};
+
+	//	Handle a message from a worker.  Returns whether it was valid.
+	auto handle_message = [&](_Connection* connection, _MSG type, uint8_t const* payload,size_t size) -> bool {
+		switch (type) {
+			case _MSG::REQUEST:
+				++connection->num_requests;
+				return true;
+			case _MSG::RESULT: {
+				uint32_t index;
+				if (size>=sizeof(uint32_t)); else return false;
+				memcpy( &index, payload, sizeof(uint32_t) );
+				if (index<units.size()); else return false;
+				_Unit& unit = units[index];
+				size_t num_pixels = unit.region.res[0] * unit.region.res[1];
+				if (size==_get_result_size(num_pixels)); else return false;
+
+				auto iter = std::find( connection->units.begin(),connection->units.end(), index );
+				if (iter!=connection->units.end()); else return false;
+				connection->units.erase(iter);
+				unit.workers.erase(std::find( unit.workers.begin(),unit.workers.end(), connection->id ));
+
+				//	If the unit was also sent to another worker, the first result wins.
+				if (!unit.done) {
+					std::vector<uint32_t>           counts( num_pixels );
+					std::vector<Renderer::PixelSum> sums  ( num_pixels );
+					memcpy( counts.data(), payload+sizeof(uint32_t),                             num_pixels*sizeof(uint32_t)           );
+					memcpy( sums  .data(), payload+sizeof(uint32_t)+num_pixels*sizeof(uint32_t), num_pixels*sizeof(Renderer::PixelSum) );
+					for (uint32_t count : counts) {
+						if (count==options.spp); else return false;
+					}
+					renderer->set_region( unit.region, sums.data(),counts.data() );
+
+					unit.done = true;
+					++num_done;
+					units_total_time += seconds_since(unit.time_assigned);
+					++units_timed;
+				}
+				return true;
+			}
+			default:
+				return false;
+		}
+	};
+
+	//	Hand out units to workers that have asked for them
+	auto dispatch = [&]() -> void {
+		for (_Connection* connection : connections) {
+			while (!connection->dead && connection->num_requests>0) {
+				size_t index;
+				if (!pending.empty()) {
+					index = pending.front();
+					pending.pop_front();
+				} else {
+					//	No units left to hand out, so help with the one that has been out longest,
+					//		if it has been out for much longer than units usually take.
+					double threshold = std::max( 2.0, units_timed>0 ? 3.0*units_total_time/static_cast<double>(units_timed) : 0.0 );
+					index = units.size();
+					for (size_t k=0;k<units.size();++k) {
+						_Unit const& unit = units[k];
+						if (
+							!unit.done && unit.workers.size()==1 && unit.workers[0]!=connection->id &&
+							seconds_since(unit.time_assigned)>threshold &&
+							( index==units.size() || unit.time_assigned<units[index].time_assigned )
+						) index=k;
+					}
+					if (index<units.size()); else break;
+				}
+
+				_Unit& unit = units[index];
+				uint32_t payload[5] = {
+					static_cast<uint32_t>(index),
+					static_cast<uint32_t>(unit.region.pos[0]), static_cast<uint32_t>(unit.region.pos[1]),
+					static_cast<uint32_t>(unit.region.res[0]), static_cast<uint32_t>(unit.region.res[1])
+				};
+				if (unit.workers.empty()) unit.time_assigned=std::chrono::steady_clock::now();
+				unit.workers.push_back(connection->id);
+				connection->units.push_back(index);
+				--connection->num_requests;
+				if (_send( connection->socket, _MSG::UNIT, payload,sizeof(payload) )); else {
+					connection->dead = true;
+				}
+			}
+		}
+	};
+
+	//	Forget workers that have disconnected (or misbehaved), returning their units to the queue
+	auto remove_dead = [&]() -> void {
+		for (auto iter=connections.begin(); iter!=connections.end(); ) {
+			_Connection* connection = *iter;
+			if (connection->dead); else { ++iter; continue; }
+
+			size_t num_requeued = 0;
+			for (size_t index : connection->units) {
+				_Unit& unit = units[index];
+				unit.workers.erase(std::find( unit.workers.begin(),unit.workers.end(), connection->id ));
+				if (!unit.done && unit.workers.empty()) {
+					pending.push_front(index);
+					++num_requeued;
+				}
+			}
+			printf("\nWorker %zu disconnected; %zu unit(s) requeued.\n",connection->id,num_requeued);
+
+			delete connection;
+			iter = connections.erase(iter);
+		}
+	};
+
+	//Main loop
+	std::vector<uint8_t> recv_buffer( 65536 );
+	while (num_done<units.size() && !*interrupted) {
+		std::vector<Net::Handle> handles = { listener->get_handle() };
+		for (_Connection const* connection : connections) handles.push_back(connection->socket->get_handle());
+		std::vector<bool> ready = Net::poll( handles, 100 );
+
+		//	New workers
+		if (ready[0]) {
+			Net::Socket* socket = listener->accept();
+			if (socket!=nullptr) {
+				_Connection* connection = new _Connection( next_connection_id++, socket );
+				connections.push_back(connection);
+				if (_send( socket, _MSG::OPTIONS, options_payload.data(),options_payload.size() )); else {
+					connection->dead = true;
+				}
+				printf("\nWorker %zu connected.\n",connection->id);
+			}
+		}
+
+		//	Messages from workers
+		for (size_t k=0;k<connections.size();++k) {
+			_Connection* connection = connections[k];
+			if (ready[k+1] && !connection->dead); else continue;
+
+			size_t received = connection->socket->recv_some( recv_buffer.data(), recv_buffer.size() );
+			if (received==0) {
+				connection->dead = true;
+				continue;
+			}
+			std::vector<uint8_t>& buffer = connection->buffer;
+			buffer.insert( buffer.end(), recv_buffer.begin(),recv_buffer.begin()+static_cast<ptrdiff_t>(received) );
+
+			size_t offset = 0;
+			while (buffer.size()-offset >= 2*sizeof(uint32_t)) {
+				uint32_t header[2];
+				memcpy( header, buffer.data()+offset, sizeof(header) );
+				if (header[1]<=Net::Socket::MAX_PAYLOAD_SIZE); else {
+					fprintf(stderr,"\nMessage too large from worker %zu; disconnecting it!\n",connection->id);
+					connection->dead = true;
+					break;
+				}
+				if (buffer.size()-offset-sizeof(header) >= header[1]); else break;
+
+				if (handle_message( connection, static_cast<_MSG>(header[0]), buffer.data()+offset+sizeof(header),header[1] )); else {
+					fprintf(stderr,"\nInvalid message from worker %zu; disconnecting it!\n",connection->id);
+					connection->dead = true;
+					break;
+				}
+				offset += sizeof(header) + header[1];
+			}
+			buffer.erase( buffer.begin(), buffer.begin()+static_cast<ptrdiff_t>(offset) );
+		}
+
+		remove_dead();
+		dispatch();
+		remove_dead();
+
+		if (seconds_since(time_last_print)>=1.0) print_progress();
+
+		if (
+			options.checkpoint_interval>0 && num_done<units.size() &&
+			seconds_since(time_last_checkpoint)>=static_cast<double>(options.checkpoint_interval)
+		) {
+			renderer->write_checkpoint();
+			time_last_checkpoint = std::chrono::steady_clock::now();
+		}
+	}
+	bool completed = num_done==units.size();
+
+	print_progress();
+	if (completed) {
+		printf("\nRender completed with %zu samples per pixel in %.3f seconds.\n",options.spp,seconds_since(time_start));
+		for (_Connection* connection : connections) _send( connection->socket, _MSG::DONE, nullptr,0 );
+	} else {
+		printf("\nRender stopped; writing checkpoint \"%s\" and partial image.\n",options.checkpoint_path.c_str());
+	}
+	for (_Connection* connection : connections) delete connection;
+	delete listener;
+
+	renderer->save_result(completed);
+	delete renderer;
+}
+
+
+
+void run_worker(std::string const& host,uint16_t port, size_t num_threads) {
+	Net::Socket* socket = Net::Socket::connect(host,port);
+
+	//Set up a renderer for the coordinator's render
+	Renderer* renderer;
+	try {
+		_Message message;
+		if (_recv( socket, &message )); else {
+			fprintf(stderr,"Lost connection to coordinator!\n");
+			throw -2;
+		}
+		std::vector<uint32_t> expected = _get_option_fields(Renderer::Options());
+		std::vector<uint32_t> fields( _num_option_fields, 0u );
+		if (message.type==_MSG::OPTIONS && message.payload.size()>=_num_option_fields*sizeof(uint32_t)) {
+			memcpy( fields.data(), message.payload.data(), _num_option_fields*sizeof(uint32_t) );
+		}
+		if (fields[0]==expected[0]); else {
+			fprintf(stderr,"Coordinator uses a different protocol version!\n");
+			throw -3;
+		}
+		if (fields[1]==expected[1] && fields[2]==expected[2]); else {
+			fprintf(stderr,"Coordinator uses a different render mode or observer!\n");
+			throw -3;
+		}
+
+		Renderer::Options options;
+		options.scene_name.assign(
+			reinterpret_cast<char const*>(message.payload.data()) + _num_option_fields*sizeof(uint32_t),
+			message.payload.size() - _num_option_fields*sizeof(uint32_t)
+		);
+		options.res[0] = fields[3];
+		options.res[1] = fields[4];
+		options.crop = { { 0, 0 }, { options.res[0], options.res[1] } };
+		options.spp = fields[5];
+		options.time_limit = 0;
+		options.indirect_only = fields[6]!=0u;
+		options.light_sampling = static_cast<Renderer::Options::LIGHT_SAMPLING>(fields[7]);
+		#ifdef RENDER_MODE_SPECTRAL
+		options.wavelength_sampling = static_cast<Renderer::Options::WAVELENGTH_SAMPLING>(fields[8]);
+		#endif
+		options.sampler = static_cast<SamplerBase::TYPE>(fields[9]);
+		options.seed = fields[10];
+		options.camera_pos      = Pos( _bits_float(fields[11]), _bits_float(fields[12]), _bits_float(fields[13]) );
+		options.camera_dir      = Dir( _bits_float(fields[14]), _bits_float(fields[15]), _bits_float(fields[16]) );
+		options.camera_up       = Dir( _bits_float(fields[17]), _bits_float(fields[18]), _bits_float(fields[19]) );
+		options.camera_vfov_deg =      _bits_float(fields[20]);
+		options.num_threads = num_threads;
+		options.checkpoint_interval = 0;
+		options.perf_counters = false;
+		options.exr_aovs = false;
+		#ifdef SUPPORT_WINDOWED
+		options.open_window = false;
+		#endif
+
+		renderer = new Renderer(options);
+	} catch (int) {
+		delete socket;
+		throw;
+	}
+	if (num_threads==0) num_threads=std::max( std::thread::hardware_concurrency(), 1u );
+	printf(
+		"Rendering \"%s\" (%zux%zu, %zu samples per pixel) for coordinator with %zu thread(s).\n",
+		renderer->options.scene_name.c_str(), renderer->options.res[0],renderer->options.res[1],
+		renderer->options.spp, num_threads
+	);
+
+	//Units received and not yet started, and whether there will be no more
+	std::mutex units_mutex;
+	std::condition_variable units_cv;
+	std::deque<std::pair<uint32_t,Framebuffer::Tile>> units;
+	bool finished = false;
+
+	//Threads share the connection, so sends must not interleave.
+	std::mutex send_mutex;
+	auto send = [&](_MSG type, void const* payload,size_t size) -> bool {
+		std::lock_guard<std::mutex> lock(send_mutex);
+		return _send( socket, type, payload,size );
+	};
+
+	//Each thread asks for a unit ahead of the one it's rendering, so that it doesn't wait.
+	auto threadwork = [&]() -> void {
+		SamplerBase* sampler = renderer->create_sampler();
+		std::vector<Renderer::PixelSum> sums  ( _UNIT_SIZE*_UNIT_SIZE );
+		std::vector<uint32_t>           counts( _UNIT_SIZE*_UNIT_SIZE );
+		std::vector<uint8_t> payload( _get_result_size(_UNIT_SIZE*_UNIT_SIZE) );
+
+		bool connected = send( _MSG::REQUEST, nullptr,0 );
+		while (connected) {
+			std::unique_lock<std::mutex> lock(units_mutex);
+			units_cv.wait( lock, [&]() -> bool { return finished || !units.empty(); } );
+			if (units.empty()) break;
+			uint32_t          index  = units.front().first;
+			Framebuffer::Tile region = units.front().second;
+			units.pop_front();
+			lock.unlock();
+
+			connected = send( _MSG::REQUEST, nullptr,0 );
+
+			renderer->render_region( *sampler, region );
+
+			size_t num_pixels = region.res[0] * region.res[1];
+			renderer->get_region( region, sums.data(),counts.data() );
+			memcpy( payload.data(),                                               &index,        sizeof(uint32_t)                      );
+			memcpy( payload.data()+sizeof(uint32_t),                              counts.data(), num_pixels*sizeof(uint32_t)           );
+			memcpy( payload.data()+sizeof(uint32_t)+num_pixels*sizeof(uint32_t), sums.data(),   num_pixels*sizeof(Renderer::PixelSum) );
+			connected = send( _MSG::RESULT, payload.data(),_get_result_size(num_pixels) ) && connected;
+		}
+
+		delete sampler;
+	};
+	std::vector<std::thread*> threads(num_threads);
+	for (std::thread*& thread : threads) thread=new std::thread(threadwork);
+
+	//Receive units until the render is done (or the coordinator goes away)
+	bool completed = false;
+	{
+		_Message message;
+		while (_recv( socket, &message )) {
+			if        (message.type==_MSG::UNIT && message.payload.size()==5*sizeof(uint32_t)) {
+				uint32_t values[5];
+				memcpy( values, message.payload.data(), sizeof(values) );
+				Framebuffer::Tile region = { { values[1], values[2] }, { values[3], values[4] } };
+				if (
+					region.res[0]<=_UNIT_SIZE && region.res[1]<=_UNIT_SIZE &&
+					region.pos[0]+region.res[0]<=renderer->options.res[0] &&
+					region.pos[1]+region.res[1]<=renderer->options.res[1]
+				); else break;
+
+				std::lock_guard<std::mutex> lock(units_mutex);
+				units.emplace_back( values[0], region );
+				units_cv.notify_one();
+			} else if (message.type==_MSG::DONE) {
+				completed = true;
+				break;
+			} else {
+				break;
+			}
+		}
+	}
+	{
+		std::lock_guard<std::mutex> lock(units_mutex);
+		units.clear();
+		finished = true;
+		units_cv.notify_all();
+	}
+
+	for (std::thread* thread : threads) {
+		thread->join();
+		delete thread;
+	}
+	delete socket;
+	delete renderer;
+
+	if (completed) {
+		printf("Render completed.\n");
+	} else {
+		fprintf(stderr,"Lost connection to coordinator!\n");
+		throw -2;
+	}
+}
+
+
+
+}
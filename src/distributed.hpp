@@ -0,0 +1,39 @@
+#pragma once
+
+#include "stdafx.hpp"
+
+#include "renderer.hpp"
+
+
+
+//Rendering across processes (on this machine or others), over TCP.  A coordinator owns the render:
+//	it divides the crop region into work units (squares of tiles), hands them out to workers as they
+//	ask for them, and collects the results into its accumulation buffer, from which it writes
+//	checkpoints and the image as usual.  Each worker renders whole units (all samples, in the same
+//	passes a local render takes), so the image is exactly what a local render would produce no
+//	matter which worker renders which unit.
+//
+//	Workers ask for one unit per idle thread, so faster workers take more.  If a worker disconnects
+//	(or dies), its units go back to the front of the queue.  When the queue runs dry, units that
+//	have been out much longer than average are also handed to another worker; whichever result
+//	arrives first is kept.
+namespace Distributed {
+
+
+
+//Run the render described by `options` as a coordinator, listening for workers on `host` (empty
+//	for every interface) and `port`.  Returns when the render completes, or when `*interrupted`
+//	becomes nonzero (writing a checkpoint and the partial image, as a local render does).
+void run_coordinator(
+	Renderer::Options const& options, std::string const& host,uint16_t port,
+	std::sig_atomic_t volatile const* interrupted
+);
+
+//Run a worker for the coordinator at `host`:`port`, with `num_threads` threads (zero for one per
+//	hardware thread).  Returns when the coordinator's render completes, or if the connection is
+//	lost.
+void run_worker(std::string const& host,uint16_t port, size_t num_threads);
+
+
+
+}
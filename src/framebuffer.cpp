@@ -1,31 +1,142 @@
 #include "framebuffer.hpp"
 
-#include "util/lodepng/lodepng.h"
+#include <cstring>
+
 #include "util/color.hpp"
+#include "util/png.hpp"
 #include "util/string.hpp"
+#include "util/thread-pool.hpp"
+
+
+
+//Backing files are TIFF images whose pixels are stored just as in memory: after the header (and
+//	page-aligned, for mapping), scanlines from bottom to top (as strips of one row, listed from the
+//	top), with the directory of tags at the end.  Images over 4 GiB are BigTIFF.
+#define BACKING_PIXELS_OFFSET 4096_zu
+
+//	Append `value` to `data` as an integer of `size` bytes, in the machine's byte order (which the
+//		header names)
+static void _write_uint(std::vector<uint8_t>* data, uint64_t value, size_t size) {
+	uint8_t bytes[8];
+	switch (size) {
+		case 2: { uint16_t v=static_cast<uint16_t>(value); memcpy(bytes,&v,2); break; }
+		case 4: { uint32_t v=static_cast<uint32_t>(value); memcpy(bytes,&v,4); break; }
+		default: memcpy(bytes,&value,8); break;
+	}
+	data->insert( data->end(), bytes,bytes+size );
+}
 
+//	The header (the first bytes of the file) and the directory (the last, starting at
+//		`directory_offset`) of the backing file of a `res[0]`×`res[1]` image
+static void _get_backing_tiff(
+	size_t const res[2],
+	std::vector<uint8_t>* header, size_t* directory_offset, std::vector<uint8_t>* directory
+) {
+	size_t row_size = res[0] * sizeof(lRGB_A_F32);
+	*directory_offset = BACKING_PIXELS_OFFSET + res[1]*row_size;
+	bool big = *directory_offset + res[1]*16 + 1024 > 0xFFFFFFFFull;
 
+	//	Tags (in increasing order), with their types (SHORT, LONG, or LONG8) and values
+	enum TYPE { SHORT=3, LONG=4, LONG8=16 };
+	auto type_size = [](TYPE type) -> size_t { return type==SHORT ? 2 : type==LONG ? 4 : 8; };
+	class Tag final { public:
+		uint16_t tag;
+		TYPE type;
+		std::vector<uint64_t> values;
+	};
+	std::vector<Tag> tags;
+	std::vector<uint64_t> strip_offsets(res[1]);
+	for (size_t k=0;k<res[1];++k) strip_offsets[k]=BACKING_PIXELS_OFFSET+(res[1]-1-k)*row_size;
+	tags.push_back({ 256, LONG,  {res[0]}      }); //Width
+	tags.push_back({ 257, LONG,  {res[1]}      }); //Height
+	tags.push_back({ 258, SHORT, {32,32,32,32} }); //Bits per sample
+	tags.push_back({ 259, SHORT, {1}           }); //Uncompressed
+	tags.push_back({ 262, SHORT, {2}           }); //RGB
+	tags.push_back({ 273, big?LONG8:LONG, strip_offsets });
+	tags.push_back({ 277, SHORT, {4}           }); //Samples per pixel
+	tags.push_back({ 278, LONG,  {1}           }); //Rows per strip
+	tags.push_back({ 279, LONG,  std::vector<uint64_t>(res[1],row_size) }); //Strip sizes
+	tags.push_back({ 284, SHORT, {1}           }); //Interleaved
+	tags.push_back({ 338, SHORT, {1}           }); //Premultiplied alpha
+	tags.push_back({ 339, SHORT, {3,3,3,3}     }); //Floating-point
+
+	uint16_t probe = 1;
+	uint8_t order;
+	memcpy( &order, &probe, 1 );
+	header->clear();
+	header->push_back( order==1 ? 'I' : 'M' );
+	header->push_back( order==1 ? 'I' : 'M' );
+	if (big) {
+		_write_uint( header, 43, 2 );
+		_write_uint( header,  8, 2 );
+		_write_uint( header,  0, 2 );
+		_write_uint( header, *directory_offset, 8 );
+	} else {
+		_write_uint( header, 42, 2 );
+		_write_uint( header, *directory_offset, 4 );
+	}
+
+	//	Each tag's entry holds its values if they fit, and otherwise their offset; those values
+	//		follow the directory (each starting on a word).
+	size_t offset_size = big ? 8 : 4;
+	size_t entry_size = big ? 20 : 12;
+	directory->clear();
+	_write_uint( directory, tags.size(), big?8:2 );
+	std::vector<uint8_t> values;
+	size_t values_offset = *directory_offset + directory->size() + tags.size()*entry_size + offset_size;
+	for (Tag const& tag : tags) {
+		_write_uint( directory, tag.tag,  2 );
+		_write_uint( directory, tag.type, 2 );
+		_write_uint( directory, tag.values.size(), offset_size );
+		std::vector<uint8_t> data;
+		for (uint64_t value : tag.values) _write_uint( &data, value, type_size(tag.type) );
+		if (data.size()<=offset_size) {
+			data.resize( offset_size, 0 );
+			directory->insert( directory->end(), data.begin(),data.end() );
+		} else {
+			_write_uint( directory, values_offset+values.size(), offset_size );
+			values.insert( values.end(), data.begin(),data.end() );
+			values.resize( (values.size()+7)/8*8, 0 );
+		}
+	}
+	_write_uint( directory, 0, offset_size ); //No next directory
+	directory->insert( directory->end(), values.begin(),values.end() );
+}
 
-Framebuffer::Framebuffer(size_t const res[2]) :
-	res{res[0],res[1]}
+Framebuffer::Framebuffer(size_t const res[2], std::string const& backing_path/*=""*/) :
+	res{res[0],res[1]}, _backing(nullptr)
 {
+	static_assert(sizeof(lRGB_A_F32)==16,"Backing files store pixels as in memory!");
+	if (!backing_path.empty()) {
+		//Create the file, and leave the pixels (mapped from it) as zeros
+		std::vector<uint8_t> header, directory;
+		size_t directory_offset;
+		_get_backing_tiff( res, &header,&directory_offset,&directory );
+		_backing = new MappedFile( backing_path, directory_offset+directory.size() );
+		std::copy( header.begin(),header.end(), _backing->get_data() );
+		std::copy( directory.begin(),directory.end(), _backing->get_data()+directory_offset );
+		_backing->flush( 0, _backing->get_size() );
+		_pixels = reinterpret_cast<lRGB_A_F32*>( _backing->get_data() + BACKING_PIXELS_OFFSET );
+		return;
+	}
+
 	//Create pixel buffer
-	_pixels = new sRGB_A_F32[res[1]*res[0]];
+	_pixels = new lRGB_A_F32[res[1]*res[0]];
 
 	//Fill it with a checkerboard pattern
 	for (size_t j=0;j<res[1];++j) {
 		for (size_t i=0;i<res[0];++i) {
 			#ifdef WITH_TRANSPARENT_FRAMEBUFFER
 				if (((i/TILE_SIZE)^(j/TILE_SIZE))%2==0) {
-					_pixels[j*res[0]+i] = sRGB_A_F32( sRGB_F32(1.0f), 0.5f );
+					_pixels[j*res[0]+i] = lRGB_A_F32( lRGB_F32(1.0f), 0.5f );
 				} else {
-					_pixels[j*res[0]+i] = sRGB_A_F32( sRGB_F32(0.0f), 0.5f );
+					_pixels[j*res[0]+i] = lRGB_A_F32( lRGB_F32(0.0f), 0.5f );
 				}
 			#else
 				if (((i/TILE_SIZE)^(j/TILE_SIZE))%2==0) {
-					_pixels[j*res[0]+i] = sRGB_A_F32( sRGB_F32(0.7f), 1.0f );
+					_pixels[j*res[0]+i] = lRGB_A_F32( Color::srgb_to_lrgb(sRGB_F32(0.7f)), 1.0f );
 				} else {
-					_pixels[j*res[0]+i] = sRGB_A_F32( sRGB_F32(0.3f), 1.0f );
+					_pixels[j*res[0]+i] = lRGB_A_F32( Color::srgb_to_lrgb(sRGB_F32(0.3f)), 1.0f );
 				}
 			#endif
 		}
@@ -33,10 +144,71 @@ Framebuffer::Framebuffer(size_t const res[2]) :
 }
 Framebuffer::~Framebuffer() {
 	//Clean up pixel buffer
-	delete[] _pixels;
+	if (_backing==nullptr) delete[] _pixels;
+	else                   delete _backing;
+}
+
+void Framebuffer::flush(Tile const& tile) const {
+	if (_backing!=nullptr); else return;
+
+	//The tile's rows span a single range of the file
+	size_t begin =  tile.pos[1]             *res[0] + tile.pos[0];
+	size_t end   = (tile.pos[1]+tile.res[1]-1)*res[0] + tile.pos[0]+tile.res[0];
+	_backing->flush(
+		BACKING_PIXELS_OFFSET + begin*sizeof(lRGB_A_F32),
+		(end-begin)*sizeof(lRGB_A_F32)
+	);
 }
 
-void Framebuffer::save(std::string const& path) const {
+//Number of pixels in each band of rows that is encoded at once (roughly; bands are whole rows)
+#define SAVE_BAND_PIXELS (1_zu<<16)
+
+//Write a file's data in bands of rows, which are encoded in parallel (a bounded number ahead of the
+//	one being written) and each written with a single `fwrite(...)`.  `encode(y0,y1,data)` appends
+//	the data of the file's rows [`y0`,`y1`) to `data`; it is called from `pool`'s threads at once (or
+//	only from the calling thread, if `pool` is null).
+static void _write_bands(
+	FILE* file, size_t num_rows, size_t row_size, ThreadPool* pool,
+	std::function<void(size_t,size_t,std::vector<char>*)> const& encode
+) {
+	size_t rows_per_band = std::max( SAVE_BAND_PIXELS/row_size, 1_zu );
+	size_t num_bands = (num_rows+rows_per_band-1) / rows_per_band;
+	size_t num_ahead = pool!=nullptr ? 2*pool->get_num_threads() : 1;
+
+	std::deque<std::pair<std::future<void>,std::vector<char>*>> pending;
+	size_t next_band = 0;
+	for (size_t k=0;k<num_bands;++k) {
+		while (next_band<num_bands && next_band<k+num_ahead) {
+			std::vector<char>* data = new std::vector<char>;
+			size_t y0 =          next_band   *rows_per_band;
+			size_t y1 = std::min((next_band+1)*rows_per_band, num_rows);
+			pending.emplace_back( ThreadPool::submit( pool, [&encode,y0,y1,data]() -> void { encode(y0,y1,data); } ), data );
+			++next_band;
+		}
+
+		pending.front().first.wait();
+		std::vector<char>* data = pending.front().second;
+		pending.pop_front();
+		fwrite( data->data(), 1,data->size(), file );
+		delete data;
+	}
+}
+
+//Append `value` as with `printf(...)`'s "%g"
+static void _write_g(std::vector<char>* data, float value) {
+	char buffer[32];
+	std::to_chars_result result = std::to_chars( buffer,buffer+sizeof(buffer), static_cast<double>(value), std::chars_format::general, 6 );
+	data->insert( data->end(), buffer,result.ptr );
+}
+
+void Framebuffer::save(
+	std::string const& path,
+	std::vector<std::pair<std::string,std::string>> const& metadata/*={}*/,
+	EXR::Settings const& exr_settings/*={}*/, std::vector<Aov> const& aovs/*={}*/,
+	ThreadPool* pool/*=nullptr*/
+) const {
+	//Rows are converted (and formatted) as the encoders need them, in parallel, so there's no
+	//	temporary copy of the whole image.
 	if        (Str::endswith(path,".csv")) {
 		//Save floating-point image in CSV file
 
@@ -44,20 +216,18 @@ void Framebuffer::save(std::string const& path) const {
 		FILE* file = fopen(path.c_str(),"wb");
 		assert(file!=nullptr);
 
-		for (size_t j=0;j<res[1];++j) {
-			for (size_t i=0;;++i) {
-				sRGB_A_F32 const& srgba = _pixels[ j*res[0] + i ];
-				lRGB_F32 lrgb = Color::srgb_to_lrgb(sRGB_F32(srgba));
-
-				fprintf(file, "%g,%g,%g",
-					static_cast<double>(lrgb.r),
-					static_cast<double>(lrgb.g),
-					static_cast<double>(lrgb.b)
-				);
-				if (i<res[0]-1) fputc(',',file);
-				else          { fputc('\n',file); break; }
+		//	Write data
+		_write_bands( file, res[1], res[0], pool, [&](size_t y0,size_t y1, std::vector<char>* data) -> void {
+			for (size_t j=y0;j<y1;++j) {
+				lRGB_A_F32 const* row = _pixels + j*res[0];
+				for (size_t i=0;i<res[0];++i) {
+					_write_g( data, row[i].r ); data->push_back(',');
+					_write_g( data, row[i].g ); data->push_back(',');
+					_write_g( data, row[i].b );
+					data->push_back( i<res[0]-1 ? ',' : '\n' );
+				}
 			}
-		}
+		});
 
 		//	Done
 		fclose(file);
@@ -74,38 +244,43 @@ void Framebuffer::save(std::string const& path) const {
 			"FORMAT=32-bit_rle_rgbe\n"
 			"EXPOSURE=1.0\n"
 			"SOFTWARE=simple-spectral\n"
+		);
+		for (auto const& entry : metadata) {
+			fprintf(file, "%s=%s\n", entry.first.c_str(),entry.second.c_str());
+		}
+		fprintf(file,
 			"\n"
 			"-Y %zu +X %zu\n",
 			res[1], res[0]
 		);
 
-		//	Write data
-		for (size_t j=0;j<res[1];++j) {
-			for (size_t i=0;i<res[0];++i) {
-				sRGB_A_F32 const& srgba = _pixels[ (res[1]-1-j)*res[0] + i ];
-				lRGB_F32 lrgb = Color::srgb_to_lrgb(sRGB_F32(srgba));
+		//	Write data (rows from the top)
+		_write_bands( file, res[1], res[0], pool, [&](size_t y0,size_t y1, std::vector<char>* data) -> void {
+			for (size_t y=y0;y<y1;++y) {
+				lRGB_A_F32 const* row = _pixels + (res[1]-1-y)*res[0];
+				for (size_t i=0;i<res[0];++i) {
+					lRGB_F32 lrgb = lRGB_F32(row[i]);
 
-				float v = std::max(lrgb.r,std::max(lrgb.g,lrgb.b));
+					float v = std::max(lrgb.r,std::max(lrgb.g,lrgb.b));
 
-				if (v < 1.0e-32f) {
-					uint32_t zero = 0u;
-					fwrite( &zero, sizeof(uint32_t),1u, file );
-				} else {
-					int e;
-					v = std::frexp(v,&e) * 256.0f/v;
-					e += 128;
-
-					glm::vec3 rgb = glm::round(lrgb*v);
-					uint8_t data[4] = {
-						static_cast<uint8_t>(glm::clamp( static_cast<int>(std::round(rgb[0])), 0,255 )),
-						static_cast<uint8_t>(glm::clamp( static_cast<int>(std::round(rgb[1])), 0,255 )),
-						static_cast<uint8_t>(glm::clamp( static_cast<int>(std::round(rgb[2])), 0,255 )),
-						static_cast<uint8_t>(                                        e                )
-					};
-					fwrite( data, sizeof(uint8_t),4, file );
+					if (v < 1.0e-32f) {
+						data->insert( data->end(), 4, 0 );
+					} else {
+						int e;
+						v = std::frexp(v,&e) * 256.0f/v;
+						e += 128;
+
+						glm::vec3 rgb = glm::round(lrgb*v);
+						data->insert( data->end(), {
+							static_cast<char>(static_cast<uint8_t>(glm::clamp( static_cast<int>(std::round(rgb[0])), 0,255 ))),
+							static_cast<char>(static_cast<uint8_t>(glm::clamp( static_cast<int>(std::round(rgb[1])), 0,255 ))),
+							static_cast<char>(static_cast<uint8_t>(glm::clamp( static_cast<int>(std::round(rgb[2])), 0,255 ))),
+							static_cast<char>(static_cast<uint8_t>(                                        e                ))
+						});
+					}
 				}
 			}
-		}
+		});
 
 		//	Done
 		fclose(file);
@@ -124,54 +299,48 @@ void Framebuffer::save(std::string const& path) const {
 			res[0], res[1]
 		);
 
-		//	Write data
-		for (size_t j=0;j<res[1];++j) {
-			for (size_t i=0;i<res[0];++i) {
-				//		It's unclear, but the data is supposed to be stored in bottom-to-top order
-				//			in the file, unlike NetPBM.  Note that some reference data gets this
-				//			wrong!
-				sRGB_A_F32 const& srgba = _pixels[ (res[1]-1-j)*res[0] + i ];
-				lRGB_F32 lrgb = Color::srgb_to_lrgb(sRGB_F32(srgba));
-				fwrite( &lrgb, sizeof(float),3, file );
+		//	Write data.  It's unclear, but the data is supposed to be stored in bottom-to-top order
+		//		in the file, unlike NetPBM.  Note that some reference data gets this wrong!
+		_write_bands( file, res[1], res[0], pool, [&](size_t y0,size_t y1, std::vector<char>* data) -> void {
+			for (size_t j=y0;j<y1;++j) {
+				lRGB_A_F32 const* row = _pixels + (res[1]-1-j)*res[0];
+				for (size_t i=0;i<res[0];++i) {
+					char const* bytes = reinterpret_cast<char const*>(&row[i]);
+					data->insert( data->end(), bytes,bytes+3*sizeof(float) );
+				}
 			}
-		}
+		});
 
 		//	Done
 		fclose(file);
-	} else {
-		//Save PNG image
+	} else if (Str::endswith(path,".exr")) {
+		//Save OpenEXR image
 
-		//	Construct temporary buffer
-		sRGB_A_U8* pixels = new sRGB_A_U8[res[1]*res[0]];
-
-		//	Fill it with pixels byte-quantized from the internal storage.  While we are doing that,
-		//		note we also flip the order of the scanlines so that they are from top to bottom,
-		//		since this is the order the PNG saver expects.
-		for (size_t j=0;j<res[1];++j) {
-			for (size_t i=0;i<res[0];++i) {
-				//Source and destination pixel; note vertical flip
-				sRGB_A_U8&        dst   = pixels [(res[1]-1-j)*res[0]+i];
-				sRGB_A_F32 const& srgba = _pixels[          j *res[0]+i];
-
-				//Convert to bytes
-				sRGB_A_F32 srgba_clipped = glm::clamp( 255.0f*srgba, sRGB_A_F32(0),sRGB_A_F32(255) );
-				dst.r = static_cast<uint8_t>(std::round(srgba_clipped.r));
-				dst.g = static_cast<uint8_t>(std::round(srgba_clipped.g));
-				dst.b = static_cast<uint8_t>(std::round(srgba_clipped.b));
-				dst.a = static_cast<uint8_t>(std::round(srgba_clipped.a));
-			}
-		}
+		std::vector<EXR::Channel> channels = {
+			{ "R", exr_settings.type }, { "G", exr_settings.type }, { "B", exr_settings.type },
+			{ "A", exr_settings.type }
+		};
+		for (Aov const& aov : aovs) channels.push_back({ aov.name, aov.type });
 
-		//	Save the image to disk
-		lodepng::encode(
-			path,
-			reinterpret_cast<uint8_t*>(pixels),
-			static_cast<unsigned>(res[0]), static_cast<unsigned>(res[1]),
-			LCT_RGBA
-		);
+		//	As for PNG (below), pixels are converted as the writer needs them, and flipped.
+		EXR::save( path, res[0],res[1], channels, [this,&aovs](size_t y, size_t x, size_t count, float* values) -> void {
+			size_t num_channels = 4 + aovs.size();
+			size_t k = (res[1]-1-y)*res[0] + x;
+			for (size_t i=0;i<count;++i,++k) {
+				float* pixel = values + i*num_channels;
+				pixel[0]=_pixels[k].r; pixel[1]=_pixels[k].g; pixel[2]=_pixels[k].b; pixel[3]=_pixels[k].a;
+				for (size_t l=0;l<aovs.size();++l) pixel[4+l]=aovs[l].values[k];
+			}
+		}, exr_settings, metadata, pool );
+	} else {
+		//Save PNG image
 
-		//	Cleanup
-		delete[] pixels;
+		//	Rows are gamma-corrected and byte-quantized from the internal storage as the writer needs
+		//		them (from several threads), so there's no temporary copy of the whole image.  Note
+		//		the vertical flip, since PNG rows are from top to bottom.
+		PNG::save( path, res[0],res[1], [this](size_t y, uint8_t* row) -> void {
+			Color::lrgb_to_srgb8( _pixels+(res[1]-1-y)*res[0], res[0], row );
+		}, metadata, pool );
 	}
 }
 
@@ -179,9 +348,13 @@ void Framebuffer::save(std::string const& path) const {
 void Framebuffer::draw() const {
 	glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
 
+	//Apply the gamma (as for PNG)
+	_draw_pixels.resize( 4*res[0]*res[1] );
+	Color::lrgb_to_srgb8( _pixels, res[0]*res[1], _draw_pixels.data() );
+
 	glDrawPixels(
 		static_cast<GLsizei>(res[0]), static_cast<GLsizei>(res[1]),
-		GL_RGBA, GL_FLOAT, _pixels
+		GL_RGBA, GL_UNSIGNED_BYTE, _draw_pixels.data()
 	);
 }
 #endif
@@ -2,6 +2,9 @@
 
 #include "stdafx.hpp"
 
+#include "util/exr.hpp"
+#include "util/mapped-file.hpp"
+
 
 
 //Encapsulates the renderer's framebuffer
@@ -13,28 +16,63 @@ class Framebuffer final {
 		//Rectangular region of pixels (useful for dividing up rendering work).
 		class Tile final {
 			public:
-				//Index of top-left pixel
+				//Index of bottom-left pixel (rows are bottom-to-top, as in OpenGL)
 				size_t pos[2];
 
 				//Width and height of rectangular region
 				size_t res[2];
 		};
 
+		//Extra channel of per-pixel values (an "AOV", e.g. the variance of a render), saved along
+		//	with the color by formats that have a place for it (EXR).
+		class Aov final {
+			public:
+				std::string name;
+				EXR::TYPE type;
+				//One value per pixel, in the framebuffer's order
+				std::vector<float> values;
+		};
+
 	private:
 		//Pixel storage, stored as a flat array of pixels stored in OpenGL order (i.e., scanlines
-		//	ordered bottom to top) for efficiency if drawing is enabled.
-		sRGB_A_F32* _pixels;
+		//	ordered bottom to top) for efficiency if drawing is enabled.  The pixels are linear
+		//	(ℓRGB and alpha), as most formats store them; the gamma is applied only when drawing and
+		//	saving PNG images.
+		lRGB_A_F32* _pixels;
+		//	If the pixels are kept in a file rather than in memory (see the constructor), the file
+		MappedFile* _backing;
+		#ifdef SUPPORT_WINDOWED
+		//	The pixels as drawn (8-bit sRGB), kept between draws
+		mutable std::vector<uint8_t> _draw_pixels;
+		#endif
 
 	public:
-		explicit Framebuffer(size_t const res[2]);
+		//The pixels are kept in memory, or if `backing_path` is given, in the file there instead (for
+		//	images too large for memory).  The file is an (uncompressed, 32-bit float ℓRGBA) TIFF
+		//	image, so it can be read at any time, even while the image is being rendered; its pixels
+		//	start as zero (transparent) rather than the usual checkerboard.  The OS keeps only the
+		//	pixels in use in memory.
+		explicit Framebuffer(size_t const res[2], std::string const& backing_path="");
 		~Framebuffer();
 
 		//Get access to the framebuffer's pixel at coordinate (`i`,`j`).
-		sRGB_A_F32 const& operator()(size_t i,size_t j) const { return _pixels[j*res[0]+i]; }
-		sRGB_A_F32&       operator()(size_t i,size_t j)       { return _pixels[j*res[0]+i]; }
+		lRGB_A_F32 const& operator()(size_t i,size_t j) const { return _pixels[j*res[0]+i]; }
+		lRGB_A_F32&       operator()(size_t i,size_t j)       { return _pixels[j*res[0]+i]; }
+
+		//Start writing the pixels of `tile` to the backing file (if any), now that they're done.
+		void flush(Tile const& tile) const;
 
-		//Save the framebuffer's contents to the given path `path`.
-		void save(std::string const& path) const;
+		//Save the framebuffer's contents to the given path `path`, along with textual metadata (key-
+		//	value pairs) if the format has a place for it (PNG, Radiance HDR, and EXR; not PFM or
+		//	CSV).  EXR images are stored as `exr_settings` says, with linear RGB and alpha channels,
+		//	and the extra channels `aovs`.  The file is encoded in parallel on `pool`'s threads (or on
+		//	the calling thread alone, if `pool` is null).
+		void save(
+			std::string const& path,
+			std::vector<std::pair<std::string,std::string>> const& metadata={},
+			EXR::Settings const& exr_settings={}, std::vector<Aov> const& aovs={},
+			ThreadPool* pool=nullptr
+		) const;
 
 		#ifdef SUPPORT_WINDOWED
 		//Draw the framebuffer to the current OpenGL window.
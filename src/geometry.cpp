@@ -100,7 +100,7 @@ bool PrimTri:: intersect(Ray const& ray, HitRecord* hitrec) const /*override*/ {
 	return false;
 }
 
-void PrimTri::get_rand_toward(Math::RNG& rng, Pos const& from, Dir* dir,float* pdf) const /*override*/ {
+void PrimTri::get_rand_toward(SamplerBase& sampler, Pos const& from, Dir* dir,float* pdf) const /*override*/ {
 	//Generate the spherical triangle on the sphere centered on `from`.  Think of this as
 	//	the projection of the primitive onto the space of all possible directions the ray
 	//	could go.
@@ -111,9 +111,18 @@ void PrimTri::get_rand_toward(Math::RNG& rng, Pos const& from, Dir* dir,float* p
 	);
 
 	//Sample randomly from that triangle
-	*dir = Math::rand_toward_sphericaltri( rng, tri );
+	*dir = Math::rand_toward_sphericaltri( sampler.get_2f(), tri );
 	*pdf = 1.0f / tri.surface_area;
 }
+float PrimTri::get_pdf_toward(Pos const& from, Dir const& /*dir*/) const /*override*/ {
+	//Directions are chosen uniformly over the spherical triangle, so this is just its area.
+	Math::SphericalTriangle tri(
+		glm::normalize( verts[0].pos - from ),
+		glm::normalize( verts[1].pos - from ),
+		glm::normalize( verts[2].pos - from )
+	);
+	return 1.0f / tri.surface_area;
+}
 
 SphereBound PrimTri::get_bound() const /*override*/ {
 	//Just compute the bounding sphere centered on the centroid.  This is not optimal,
@@ -125,6 +134,36 @@ SphereBound PrimTri::get_bound() const /*override*/ {
 }
 
 
+PrimQuad::PrimQuad(
+	MaterialBase* material,
+	Vertex const& vert00, Vertex const& vert10, Vertex const& vert11, Vertex const& vert01
+) :
+	PrimBase(TYPE::QUAD,material),
+	tri0( material, vert00,vert10,vert11 ),
+	tri1( material, vert00,vert11,vert01 )
+{
+	//Check whether we're a rectangle.  The edges from `vert00` must be perpendicular, and the
+	//	opposite corner must be where they meet (i.e., the diagonals must bisect each other).
+	Dir edge_x = vert10.pos - vert00.pos;
+	Dir edge_y = vert01.pos - vert00.pos;
+	rect.corner     = vert00.pos;
+	rect.lengths[0] = glm::length(edge_x);
+	rect.lengths[1] = glm::length(edge_y);
+	if (rect.lengths[0]>0.0f && rect.lengths[1]>0.0f) {
+		rect.axes[0] = edge_x / rect.lengths[0];
+		rect.axes[1] = edge_y / rect.lengths[1];
+
+		float tolerance = 1.0e-5f * std::max(rect.lengths[0],rect.lengths[1]);
+		Dir skew = (vert00.pos+vert11.pos) - (vert10.pos+vert01.pos);
+		is_rectangle =
+			glm::length(skew) <= tolerance &&
+			std::abs(glm::dot( rect.axes[0], rect.axes[1] )) <= 1.0e-5f
+		;
+	} else {
+		is_rectangle = false;
+	}
+}
+
 bool PrimQuad::intersect(Ray const& ray, HitRecord* hitrec) const /*override*/ {
 	//Check for intersection with our triangles.  Note that we assume that only one triangle can be
 	//	hit, implying that the quadrilateral is planar.
@@ -138,10 +177,38 @@ bool PrimQuad::intersect(Ray const& ray, HitRecord* hitrec) const /*override*/ {
 	return true;
 }
 
-void PrimQuad::get_rand_toward(Math::RNG& rng, Pos const& from, Dir* dir,float* pdf) const /*override*/ {
-	//Choose one of our triangles randomly and get a random ray toward it.
-	( rand_1f(rng)<=0.5f ? tri0 : tri1 ).get_rand_toward(rng,from,dir,pdf);
-	*pdf *= 0.5f;
+void PrimQuad::get_rand_toward(SamplerBase& sampler, Pos const& from, Dir* dir,float* pdf) const /*override*/ {
+	if (is_rectangle) {
+		//Generate the spherical rectangle on the sphere centered on `from` and sample it directly.
+		//	This covers our whole solid angle at once, and is cheaper than even one spherical
+		//	triangle.
+		Math::SphericalRectangle sph_rect(
+			from,
+			rect.corner, rect.axes[0],rect.axes[1], rect.lengths[0],rect.lengths[1]
+		);
+
+		*dir = Math::rand_toward_sphericalrect( sampler.get_2f(), sph_rect );
+		*pdf = 1.0f / sph_rect.surface_area;
+	} else {
+		//Choose one of our triangles randomly and get a random ray toward it.
+		( sampler.get_1f()<0.5f ? tri0 : tri1 ).get_rand_toward(sampler,from,dir,pdf);
+		*pdf *= 0.5f;
+	}
+}
+float PrimQuad::get_pdf_toward(Pos const& from, Dir const& dir) const /*override*/ {
+	if (is_rectangle) {
+		Math::SphericalRectangle sph_rect(
+			from,
+			rect.corner, rect.axes[0],rect.axes[1], rect.lengths[0],rect.lengths[1]
+		);
+		return 1.0f / sph_rect.surface_area;
+	} else {
+		//The direction could only have been chosen through the triangle it hits.
+		HitRecord hitrec;
+		hitrec.dist = INF;
+		PrimTri const& tri = tri0.intersect({from,dir},&hitrec) ? tri0 : tri1;
+		return 0.5f * tri.get_pdf_toward(from,dir);
+	}
 }
 
 SphereBound PrimQuad::get_bound() const /*override*/ {
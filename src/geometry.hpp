@@ -2,7 +2,7 @@
 
 #include "stdafx.hpp"
 
-#include "util/random.hpp"
+#include "sampler.hpp"
 
 
 
@@ -45,7 +45,10 @@ class PrimBase {
 
 		//Get a random direction `dir` from `from` toward the primitive.  The probability density of
 		//	choosing this direction is returned in `pdf`.
-		virtual void get_rand_toward(Math::RNG& rng, Pos const& from, Dir* dir,float* pdf) const = 0;
+		virtual void get_rand_toward(SamplerBase& sampler, Pos const& from, Dir* dir,float* pdf) const = 0;
+		//Get the probability density with which `.get_rand_toward(...)` would choose the direction
+		//	`dir` from `from`.  The direction is assumed to hit the primitive.
+		virtual float get_pdf_toward(Pos const& from, Dir const& dir) const = 0;
 
 		virtual SphereBound get_bound() const = 0;
 };
@@ -71,7 +74,8 @@ class PrimTri final : public PrimBase {
 
 		virtual bool intersect(Ray const& ray, HitRecord* hitrec) const override;
 
-		virtual void get_rand_toward(Math::RNG& rng, Pos const& from, Dir* dir,float* pdf) const override;
+		virtual void get_rand_toward(SamplerBase& sampler, Pos const& from, Dir* dir,float* pdf) const override;
+		virtual float get_pdf_toward(Pos const& from, Dir const& dir) const override;
 
 		virtual SphereBound get_bound() const override;
 };
@@ -84,21 +88,29 @@ class PrimQuad final : public PrimBase {
 		PrimTri tri0;
 		PrimTri tri1;
 
+		//Whether the quadrilateral is a rectangle (a parallelogram with perpendicular edges).  If
+		//	so, its solid angle can be sampled directly, instead of through its triangles.  The
+		//	rectangle is stored as a corner, unit vectors along the two edges from it, and the
+		//	lengths of those edges.
+		bool is_rectangle;
+		struct {
+			Pos corner;
+			Dir axes[2];
+			float lengths[2];
+		} rect;
+
 	public:
 		PrimQuad() = default;
 		PrimQuad(
 			MaterialBase* material,
 			Vertex const& vert00, Vertex const& vert10, Vertex const& vert11, Vertex const& vert01
-		) :
-			PrimBase(TYPE::QUAD,material),
-			tri0( material, vert00,vert10,vert11 ),
-			tri1( material, vert00,vert11,vert01 )
-		{}
+		);
 		virtual ~PrimQuad() = default;
 
 		virtual bool intersect(Ray const& ray, HitRecord* hitrec) const override;
 
-		virtual void get_rand_toward(Math::RNG& rng, Pos const& from, Dir* dir,float* pdf) const override;
+		virtual void get_rand_toward(SamplerBase& sampler, Pos const& from, Dir* dir,float* pdf) const override;
+		virtual float get_pdf_toward(Pos const& from, Dir const& dir) const override;
 
 		virtual SphereBound get_bound() const override;
 };
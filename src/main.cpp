@@ -3,9 +3,16 @@
 #include "stdafx.hpp"
 
 #include "util/color.hpp"
+#include "util/socket.hpp"
 #include "util/string.hpp"
+#include "util/thread-pool.hpp"
+#include "util/trace.hpp"
 
+#include "checkpoint.hpp"
+#include "daemon.hpp"
+#include "distributed.hpp"
 #include "framebuffer.hpp"
+#include "material.hpp"
 #include "renderer.hpp"
 
 
@@ -30,6 +37,14 @@ inline static void _callback_key(GLFWwindow* window, int key,int /*scancode*/, i
 }
 #endif
 
+//Set by SIGINT/SIGTERM, to stop the render (writing a checkpoint and the partial image).  A second
+//	signal terminates immediately.
+static volatile std::sig_atomic_t _interrupted = 0;
+inline static void _callback_signal(int signal) {
+	_interrupted = 1;
+	std::signal(signal, SIG_DFL);
+}
+
 inline static void _print_usage() {
 	printf(
 		"Simple Spectral: a simple spectral renderer for demonstration purposes\n"
@@ -41,20 +56,156 @@ inline static void _print_usage() {
 		"    `--height=<height>`/`-h=<height>`\n"
 		"          Set the height of the render.\n"
 		"    `--samples=<samples>`/`-spp=<samples>`\n"
-		"          Set the number of samples per pixel.\n"
+		"          Set the number of samples per pixel (the maximum, with `--time-limit`, in\n"
+		"          which case it is optional).\n"
 		"    `--output=<output-image-path>\n`/`-o=<output-image-path>`\n"
-		"          Set the path to the output image.\n"
+		"          Set the path to the output image.  If it ends with \".partial\", a partial\n"
+		"          image (linear sums and sample counts of the pixels rendered) is saved\n"
+		"          instead, for merging with `--merge`.\n"
 		"  Optional arguments:\n"
+		"    `--crop=<x>,<y>,<width>,<height>`\n"
+		"          Render only the given region of the image (from the top left).\n"
+		"    `--shard=<index>/<count>`\n"
+		"          Render only the given shard (numbered from zero) of the image split into\n"
+		"          `<count>` horizontal bands, from the top.\n"
+		"    `--time-limit=<seconds>`\n"
+		"          Render progressive passes until the time limit, instead of to a fixed number\n"
+		"          of samples.  The last pass is shortened so that it finishes in time, and every\n"
+		"          pixel ends with the same number of samples.\n"
+		"    `--camera-pos=<x>,<y>,<z>`, `--camera-dir=<x>,<y>,<z>`, `--camera-up=<x>,<y>,<z>`\n"
+		"          Override the scene camera's position, view direction, or up direction.\n"
+		"    `--camera-fov=<degrees>`\n"
+		"          Override the scene camera's vertical field of view.\n"
 		"    `--indirect-only`/`-io`\n"
 		"          Render only indirect illumination.\n"
+		"    `--light-sampling=<mode>`/`-ls=<mode>`\n"
+		"          Set how paths find lights: \"none\" (BSDF sampling only), \"explicit\" (light\n"
+		"          sampling for direct lighting), or \"mis\" (both, combined with multiple\n"
+		"          importance sampling; default).\n"
+		#ifdef RENDER_MODE_SPECTRAL
+		"    `--wavelength-sampling=<mode>`/`-ws=<mode>`\n"
+		"          Set how hero wavelengths are importance-sampled: \"uniform\" (default), \"y\" (by\n"
+		"          the observer's luminance response), \"xyz\" (by the observer's total response),\n"
+		"          or \"xyz-emitters\" (by that times the lights' emission).\n"
+		#endif
+		"    `--sampler=<sampler>`/`-sa=<sampler>`\n"
+		"          Set where samples' random numbers come from: \"random\" (independent uniform),\n"
+		"          \"sobol\" (Owen-scrambled Sobol; default), or \"pmj02\" (progressive multi-\n"
+		"          jittered (0,2)).\n"
+		"    `--seed=<seed>`\n"
+		"          Set the seed for the samples' random numbers (default 0).  The same seed gives\n"
+		"          exactly the same image, regardless of the number of threads.\n"
+		"    `--threads=<count>`/`-t=<count>`\n"
+		"          Set the number of worker threads (default: one per hardware thread).  Images\n"
+		"          are also encoded on that many threads (in batches, on one while the next\n"
+		"          job renders).\n"
+		"    `--checkpoint=<checkpoint-path>`/`-c=<checkpoint-path>`\n"
+		"          Set the path checkpoints are written to (default: the output path with\n"
+		"          \".checkpoint\" appended).  A checkpoint is written periodically, and when the\n"
+		"          render is interrupted (SIGINT/SIGTERM), along with the partial image.\n"
+		"    `--checkpoint-interval=<seconds>`\n"
+		"          Set the time between checkpoints (default 600; 0 to only write one when\n"
+		"          interrupted).  Checkpoints are written between passes over the image, so\n"
+		"          this is approximate.\n"
+		"    `--resume=<checkpoint-path>`\n"
+		"          Continue the render from a checkpoint.  The other options must be the same\n"
+		"          as for the render that wrote it (except the number of threads).\n"
+		"    `--snapshots=<samples>,<samples>,...`\n"
+		"          Also save the image as it is at each of the given samples per pixel, to the\n"
+		"          output path with \"-<samples>spp\" before the extension (and in its format).\n"
+		"          They are saved in the background while the render continues.\n"
+		"    `--exr-type=<type>`, `--exr-compression=<method>`, `--exr-tile=<size>`\n"
+		"          For an EXR output image, set the type of its linear RGBA channels (\"half\",\n"
+		"          the default, or \"float\"), its compression (\"none\", \"rle\", \"zips\", or\n"
+		"          \"zip\", the default), and whether it's stored in square tiles of the given\n"
+		"          size (default 0: in scanlines).\n"
+		"    `--exr-aovs`\n"
+		"          Add channels to the EXR output image: \"variance\", of each pixel's\n"
+		"          luminance (as estimated from its samples), and \"samples\", their count.\n"
+		"    `--out-of-core=<path>`\n"
+		"          Keep the image in a file instead of in memory, for images too large for it:\n"
+		"          a 32-bit float TIFF image, which tiles are written to as they're rendered\n"
+		"          (so it can be viewed while the render runs).  The accumulation buffer is\n"
+		"          kept in a temporary file beside it.  The output image is saved as usual.\n"
+		"          Not supported with `--snapshots`, `--exr-aovs`, `--cost`, or `--convergence`,\n"
+		"          which all need buffers the size of the image in memory.\n"
+		"    `--stats=<stats-path>`\n"
+		"          Save statistics of the render (rays cast, intersection tests, path lengths,\n"
+		"          shading calls per material, and timings) as JSON.\n"
+		"    `--cost=<path>`\n"
+		"          Save the cost of each pixel (the time its samples took), as microseconds per\n"
+		"          sample in \"<path>.pfm\", and color-mapped in \"<path>.png\".\n"
+		"    `--perf-counters`\n"
+		"          Measure hardware performance counters (cycles, instructions, cache and branch\n"
+		"          misses) while rendering, resolving, and saving (Linux only).  They are printed\n"
+		"          at the end, and saved with `--stats`.\n"
+		"    `--convergence=<csv-path>`\n"
+		"          Record the error (RMSE, relMSE, and FLIP) of the render against the reference\n"
+		"          image given with `--reference=<pfm-path>` as it progresses, in CSV rows with\n"
+		"          the render time and samples per pixel.  A row is written after each pass that\n"
+		"          ends a new interval of `--convergence-interval=<seconds>` (default 1), and\n"
+		"          passes are of one sample per pixel.  Comparing the rendering modes' files gives\n"
+		"          their errors at equal time.\n"
+		"    `--trace=<trace-path>`\n"
+		"          Save a timeline of the render's phases and each thread's tiles, in the\n"
+		"          Chrome trace-event format (for \"chrome://tracing\" or Perfetto).\n"
 		#ifdef SUPPORT_WINDOWED
 		"    `--window`/`-w`\n"
 		"          Opens a window to display the ongoing render.\n"
 		#endif
+		"  Distributed rendering:\n"
+		"    `--coordinator=[<host>:]<port>`\n"
+		"          Instead of rendering locally, hand out parts of the image to workers that\n"
+		"          connect on the given port (and interface), and collect their results.\n"
+		"          The other options are as for a local render (except `--time-limit`).\n"
+		"  Running a worker for a distributed render (instead of rendering):\n"
+		"    `--worker=<host>:<port>`\n"
+		"          Render parts of the image for the coordinator at the given address, until\n"
+		"          its render completes.  Only `--threads` may also be given.\n"
+		"  Render server:\n"
+		"    `--serve=<socket-path>`\n"
+		"          Instead of rendering, serve render requests on a Unix-domain socket.\n"
+		"          Scenes, color data, and threads are kept between requests.  Only\n"
+		"          `--threads` may also be given (requests' own `--threads` are ignored).\n"
+		"    `--request=<socket-path>`\n"
+		"          Instead of rendering locally, have the server at the given socket render,\n"
+		"          receiving tiles as they complete.  The other options are as for a local\n"
+		"          render (except checkpoints).  Interrupting cancels the request, and saves\n"
+		"          the tiles received.\n"
+		"  Batches of renders:\n"
+		"    `--batch=<manifest-path>`\n"
+		"          Run the renders listed in the manifest, one per line, each given by the\n"
+		"          arguments for a render as above (blank lines and lines starting with '#'\n"
+		"          are ignored).  Color data, textures, and threads are kept between renders,\n"
+		"          and each render's image is saved while the next renders.  Only `--threads`\n"
+		"          may also be given (renders' own `--threads` are ignored).\n"
+		"  Merging partial images (instead of rendering):\n"
+		"    `--merge=<partial-path>,<partial-path>,...`\n"
+		"          Merge partial images of different regions, or with different seeds, of the\n"
+		"          same image into `--output`.  Pixels in more than one are averaged.\n"
 	);
 }
 
-inline static void _parse_arguments( char const*const argv[],size_t length, Renderer::Options* options ) {
+//What to do instead of a simple render, if anything (at most one of these is set)
+class _Mode final { public:
+	std::vector<std::string> merge_paths; //Merge partial images
+	std::string coordinator_address;      //Coordinate a distributed render
+	std::string worker_address;           //Work for a distributed render's coordinator
+	std::string batch_path;               //Run a batch of renders
+	std::string serve_path;               //Serve render requests
+	std::string request_path;             //Request a render from a server
+
+	bool is_render() const {
+		return
+			merge_paths.empty() && coordinator_address.empty() && worker_address.empty() &&
+			batch_path.empty() && serve_path.empty() && request_path.empty()
+		;
+	}
+};
+
+inline static void _parse_arguments(
+	char const*const argv[],size_t length, Renderer::Options* options, _Mode* mode
+) {
 	std::vector<std::string> args;
 	for (size_t i=0;i<length;++i) args.emplace_back(argv[i]);
 
@@ -88,13 +239,78 @@ inline static void _parse_arguments( char const*const argv[],size_t length, Rend
 		}
 	};
 
+	auto warn_extraneous = [&]() -> void {
+		if (args.size()>1) {
+			fprintf(stderr,"Warning: ignoring extraneous argument(s):\n");
+			for (size_t i=1;i<args.size();++i) {
+				fprintf(stderr,"  \"%s\"\n",args[i].c_str());
+			}
+		}
+	};
+
+	//Merging partial images needs only their paths and the output path
+	std::string str_merge;
+	try {
+		str_merge = get_arg("--merge");
+	} catch (...) {}
+	if (!str_merge.empty()) {
+		if (str_merge=="--merge") {
+			fprintf(stderr,"`--merge` requires paths!\n");
+			throw -1;
+		}
+		mode->merge_paths = Str::split(str_merge,",");
+		options->output_path = get_arg_req("--output", "-o");
+		warn_extraneous();
+		return;
+	}
+
+	//Running a worker needs only the coordinator's address (which sends everything else), a batch
+	//	only its manifest, and a server only its socket (the manifest and the requests have the
+	//	renders' arguments).  All can have a number of threads.
+	std::pair<char const*,std::string*> const services[] = {
+		{ "--worker", &mode->worker_address },
+		{ "--batch",  &mode->batch_path     },
+		{ "--serve",  &mode->serve_path     }
+	};
+	size_t num_services = 0;
+	for (auto const& service : services) {
+		try {
+			*service.second = get_arg(service.first);
+		} catch (...) {}
+		if (service.second->empty()) continue;
+		if (*service.second==service.first) {
+			fprintf(stderr,"`%s` requires a value!\n",service.first);
+			throw -1;
+		}
+		++num_services;
+	}
+	if (num_services>1) {
+		fprintf(stderr,"Only one of `--worker`, `--batch`, and `--serve` can be given!\n");
+		throw -1;
+	}
+	if (num_services==1) {
+		std::string str_threads;
+		try {
+			str_threads = get_arg("--threads", "-t");
+		} catch (...) {}
+		try {
+			options->num_threads = str_threads.empty() ? 0 : Str::to_pos(str_threads);
+		} catch (int) {
+			fprintf(stderr,"Invalid number of threads!\n");
+			throw;
+		}
+		warn_extraneous();
+		return;
+	}
+
 	options->scene_name = get_arg_req("--scene","-s");
-	if      (options->scene_name=="cornell"     );
-	else if (options->scene_name=="cornell-srgb");
-	else if (options->scene_name=="plane-srgb"  );
+	if      (options->scene_name=="cornell"          );
+	else if (options->scene_name=="cornell-srgb"     );
+	else if (options->scene_name=="plane-srgb"       );
+	else if (options->scene_name=="plane-srgb-mirror");
 	else {
 		fprintf(stderr,
-			"Unrecognized scene \"%s\"!  (Supported scenes: \"cornell\", \"cornell-srgb\", \"plane-srgb\")\n",
+			"Unrecognized scene \"%s\"!  (Supported scenes: \"cornell\", \"cornell-srgb\", \"plane-srgb\", \"plane-srgb-mirror\")\n",
 			options->scene_name.c_str()
 		);
 		throw -3;
@@ -111,7 +327,81 @@ inline static void _parse_arguments( char const*const argv[],size_t length, Rend
 		throw;
 	}
 
-	std::string str_spp = get_arg_req("--samples", "-spp");
+	std::string str_crop, str_shard;
+	try {
+		str_crop  = get_arg("--crop" );
+	} catch (...) {}
+	try {
+		str_shard = get_arg("--shard");
+	} catch (...) {}
+	if (!str_crop.empty() && !str_shard.empty()) {
+		fprintf(stderr,"Only one of `--crop` and `--shard` can be given!\n");
+		throw -1;
+	}
+	//	Note the crop region is in framebuffer coordinates, from the bottom left.
+	options->crop = { { 0, 0 }, { options->res[0], options->res[1] } };
+	if        (!str_crop.empty()) {
+		size_t x, y, w, h;
+		try {
+			std::vector<std::string> parts = Str::split(str_crop,",");
+			if (parts.size()==4); else throw -1;
+			x = Str::to_nneg(parts[0]);
+			y = Str::to_nneg(parts[1]);
+			w = Str::to_pos (parts[2]);
+			h = Str::to_pos (parts[3]);
+			if (x+w<=options->res[0] && y+h<=options->res[1]); else throw -1;
+		} catch (...) {
+			fprintf(stderr,"Invalid crop region!\n");
+			throw -1;
+		}
+		options->crop = { { x, options->res[1]-y-h }, { w, h } };
+	} else if (!str_shard.empty()) {
+		size_t index, count;
+		try {
+			std::vector<std::string> parts = Str::split(str_shard,"/");
+			if (parts.size()==2); else throw -1;
+			index = Str::to_nneg(parts[0]);
+			count = Str::to_pos (parts[1]);
+			if (index<count); else throw -1;
+		} catch (...) {
+			fprintf(stderr,"Invalid shard!\n");
+			throw -1;
+		}
+		//	Shards are bands of whole rows of tiles.
+		size_t rows = ( options->res[1] + TILE_SIZE-1 ) / TILE_SIZE;
+		if (count<=rows); else {
+			fprintf(stderr,"Too many shards (at most %zu for this height)!\n",rows);
+			throw -1;
+		}
+		size_t y0 =          rows* index    /count*TILE_SIZE;
+		size_t y1 = std::min(rows*(index+1)/count*TILE_SIZE, options->res[1]);
+		options->crop = { { 0, options->res[1]-y1 }, { options->res[0], y1-y0 } };
+	}
+
+	std::string str_time_limit;
+	try {
+		str_time_limit = get_arg("--time-limit");
+	} catch (...) {
+		str_time_limit = "0";
+	}
+	try {
+		options->time_limit = Str::to_nneg(str_time_limit);
+	} catch (int) {
+		fprintf(stderr,"Invalid time limit!\n");
+		throw;
+	}
+
+	//	With a time limit, the number of samples is only a maximum, and is optional.
+	std::string str_spp;
+	if (options->time_limit==0) {
+		str_spp = get_arg_req("--samples", "-spp");
+	} else {
+		try {
+			str_spp = get_arg("--samples", "-spp");
+		} catch (...) {
+			str_spp = "1048576";
+		}
+	}
 	try {
 		options->spp = Str::to_pos(str_spp);
 	} catch (int) {
@@ -119,6 +409,46 @@ inline static void _parse_arguments( char const*const argv[],size_t length, Rend
 		throw;
 	}
 
+	auto get_camera_vec3 = [&](std::string const& name, glm::vec3* vec) -> void {
+		std::string str;
+		try {
+			str = get_arg(name);
+		} catch (...) {
+			*vec = glm::vec3(qNaN);
+			return;
+		}
+		try {
+			std::vector<std::string> parts = Str::split(str,",");
+			if (parts.size()==3); else throw -1;
+			for (int k=0;k<3;++k) (*vec)[k]=Str::to_float(parts[static_cast<size_t>(k)]);
+		} catch (...) {
+			fprintf(stderr,"Invalid `%s`!  (Expected \"<x>,<y>,<z>\".)\n",name.c_str());
+			throw -1;
+		}
+	};
+	get_camera_vec3( "--camera-pos", &options->camera_pos );
+	get_camera_vec3( "--camera-dir", &options->camera_dir );
+	get_camera_vec3( "--camera-up",  &options->camera_up  );
+	if (glm::length(options->camera_dir)==0.0f || glm::length(options->camera_up)==0.0f) {
+		fprintf(stderr,"Camera directions must not be zero!\n");
+		throw -1;
+	}
+	std::string str_fov;
+	try {
+		str_fov = get_arg("--camera-fov");
+	} catch (...) {}
+	if (str_fov.empty()) {
+		options->camera_vfov_deg = qNaN;
+	} else {
+		try {
+			options->camera_vfov_deg = Str::to_float(str_fov);
+			if (options->camera_vfov_deg>0.0f && options->camera_vfov_deg<180.0f); else throw -1;
+		} catch (...) {
+			fprintf(stderr,"Invalid camera field of view!\n");
+			throw -1;
+		}
+	}
+
 	std::string str_indonly;
 	try {
 		str_indonly = get_arg("--indirect-only", "-io");
@@ -134,8 +464,364 @@ inline static void _parse_arguments( char const*const argv[],size_t length, Rend
 		}
 	}
 
+	std::string str_ls;
+	try {
+		str_ls = get_arg("--light-sampling", "-ls");
+	} catch (...) {
+		str_ls = "mis";
+	}
+	if      (str_ls=="none"    ) options->light_sampling=Renderer::Options::LIGHT_SAMPLING::NONE;
+	else if (str_ls=="explicit") options->light_sampling=Renderer::Options::LIGHT_SAMPLING::EXPLICIT;
+	else if (str_ls=="mis"     ) options->light_sampling=Renderer::Options::LIGHT_SAMPLING::MIS;
+	else {
+		fprintf(stderr,"Unrecognized light sampling mode \"%s\"!  (Supported modes: \"none\", \"explicit\", \"mis\")\n",str_ls.c_str());
+		throw -3;
+	}
+
+	#ifdef RENDER_MODE_SPECTRAL
+	std::string str_ws;
+	try {
+		str_ws = get_arg("--wavelength-sampling", "-ws");
+	} catch (...) {
+		str_ws = "uniform";
+	}
+	if      (str_ws=="uniform"     ) options->wavelength_sampling=Renderer::Options::WAVELENGTH_SAMPLING::UNIFORM;
+	else if (str_ws=="y"           ) options->wavelength_sampling=Renderer::Options::WAVELENGTH_SAMPLING::Y;
+	else if (str_ws=="xyz"         ) options->wavelength_sampling=Renderer::Options::WAVELENGTH_SAMPLING::XYZ;
+	else if (str_ws=="xyz-emitters") options->wavelength_sampling=Renderer::Options::WAVELENGTH_SAMPLING::XYZ_EMITTERS;
+	else {
+		fprintf(stderr,"Unrecognized wavelength sampling mode \"%s\"!  (Supported modes: \"uniform\", \"y\", \"xyz\", \"xyz-emitters\")\n",str_ws.c_str());
+		throw -3;
+	}
+	#endif
+
+	std::string str_sampler;
+	try {
+		str_sampler = get_arg("--sampler", "-sa");
+	} catch (...) {
+		str_sampler = "sobol";
+	}
+	if      (str_sampler=="random") options->sampler=SamplerBase::TYPE::RANDOM;
+	else if (str_sampler=="sobol" ) options->sampler=SamplerBase::TYPE::SOBOL;
+	else if (str_sampler=="pmj02" ) options->sampler=SamplerBase::TYPE::PMJ02;
+	else {
+		fprintf(stderr,"Unrecognized sampler \"%s\"!  (Supported samplers: \"random\", \"sobol\", \"pmj02\")\n",str_sampler.c_str());
+		throw -3;
+	}
+
+	std::string str_seed;
+	try {
+		str_seed = get_arg("--seed");
+	} catch (...) {
+		str_seed = "0";
+	}
+	try {
+		options->seed = static_cast<uint32_t>(Str::to_nneg(str_seed));
+	} catch (int) {
+		fprintf(stderr,"Invalid seed!\n");
+		throw;
+	}
+
+	std::string str_threads;
+	try {
+		str_threads = get_arg("--threads", "-t");
+	} catch (...) {}
+	if (str_threads.empty()) {
+		options->num_threads = 0;
+	} else {
+		try {
+			options->num_threads = Str::to_pos(str_threads);
+		} catch (int) {
+			fprintf(stderr,"Invalid number of threads!\n");
+			throw;
+		}
+	}
+
 	options->output_path = get_arg_req("--output", "-o");
 
+	std::string str_exr_type;
+	try {
+		str_exr_type = get_arg("--exr-type");
+	} catch (...) {
+		str_exr_type = "half";
+	}
+	if      (str_exr_type=="half" ) options->exr.type=EXR::TYPE::HALF;
+	else if (str_exr_type=="float") options->exr.type=EXR::TYPE::FLOAT;
+	else {
+		fprintf(stderr,"Unrecognized EXR channel type \"%s\"!  (Supported types: \"half\", \"float\")\n",str_exr_type.c_str());
+		throw -3;
+	}
+
+	std::string str_exr_comp;
+	try {
+		str_exr_comp = get_arg("--exr-compression");
+	} catch (...) {
+		str_exr_comp = "zip";
+	}
+	if      (str_exr_comp=="none") options->exr.compression=EXR::COMPRESSION::NONE;
+	else if (str_exr_comp=="rle" ) options->exr.compression=EXR::COMPRESSION::RLE;
+	else if (str_exr_comp=="zips") options->exr.compression=EXR::COMPRESSION::ZIPS;
+	else if (str_exr_comp=="zip" ) options->exr.compression=EXR::COMPRESSION::ZIP;
+	else {
+		fprintf(stderr,"Unrecognized EXR compression \"%s\"!  (Supported methods: \"none\", \"rle\", \"zips\", \"zip\")\n",str_exr_comp.c_str());
+		throw -3;
+	}
+
+	std::string str_exr_tile;
+	try {
+		str_exr_tile = get_arg("--exr-tile");
+	} catch (...) {
+		str_exr_tile = "0";
+	}
+	try {
+		options->exr.tile_size = Str::to_nneg(str_exr_tile);
+	} catch (int) {
+		fprintf(stderr,"Invalid EXR tile size!\n");
+		throw;
+	}
+
+	std::string str_exr_aovs;
+	try {
+		str_exr_aovs = get_arg("--exr-aovs");
+		options->exr_aovs = true;
+	} catch (...) {
+		options->exr_aovs = false;
+	}
+	if (options->exr_aovs) {
+		if (str_exr_aovs=="--exr-aovs");
+		else {
+			fprintf(stderr,"`--exr-aovs` does not take a value!\n");
+			throw -1;
+		}
+		if (Str::endswith(options->output_path,".exr")); else {
+			fprintf(stderr,"`--exr-aovs` requires an EXR output image!\n");
+			throw -1;
+		}
+	}
+
+	try {
+		options->out_of_core_path = get_arg("--out-of-core");
+	} catch (...) {
+		options->out_of_core_path.clear();
+	}
+	if (!options->out_of_core_path.empty()) {
+		if (options->out_of_core_path=="--out-of-core") {
+			fprintf(stderr,"`--out-of-core` requires a path!\n");
+			throw -1;
+		}
+		if (options->out_of_core_path!=options->output_path); else {
+			fprintf(stderr,"`--out-of-core` requires a path other than the output image's!\n");
+			throw -1;
+		}
+		if (!options->exr_aovs); else {
+			//	(The extra channels are made in memory to be saved.)
+			fprintf(stderr,"`--exr-aovs` is not supported with `--out-of-core`!\n");
+			throw -1;
+		}
+	}
+
+	try {
+		options->checkpoint_path = get_arg("--checkpoint", "-c");
+	} catch (...) {
+		options->checkpoint_path = options->output_path + ".checkpoint";
+	}
+	if (options->checkpoint_path=="--checkpoint") {
+		fprintf(stderr,"`--checkpoint`/`-c` requires a path!\n");
+		throw -1;
+	}
+
+	std::string str_ckpt_int;
+	try {
+		str_ckpt_int = get_arg("--checkpoint-interval");
+	} catch (...) {
+		str_ckpt_int = "600";
+	}
+	try {
+		options->checkpoint_interval = Str::to_nneg(str_ckpt_int);
+	} catch (int) {
+		fprintf(stderr,"Invalid checkpoint interval!\n");
+		throw;
+	}
+
+	try {
+		options->resume_path = get_arg("--resume");
+	} catch (...) {
+		options->resume_path = "";
+	}
+	if (options->resume_path=="--resume") {
+		fprintf(stderr,"`--resume` requires a path!\n");
+		throw -1;
+	}
+
+	std::string str_snapshots;
+	try {
+		str_snapshots = get_arg("--snapshots");
+	} catch (...) {}
+	options->snapshots.clear();
+	if (!str_snapshots.empty()) {
+		try {
+			for (std::string const& part : Str::split(str_snapshots,",")) {
+				size_t spp = Str::to_pos(part);
+				if (spp<=options->spp); else throw -1;
+				options->snapshots.push_back(spp);
+			}
+		} catch (...) {
+			fprintf(stderr,"Invalid snapshots (sample counts, at most the number of samples)!\n");
+			throw -1;
+		}
+		std::sort( options->snapshots.begin(), options->snapshots.end() );
+		options->snapshots.erase(
+			std::unique( options->snapshots.begin(), options->snapshots.end() ),
+			options->snapshots.end()
+		);
+		if (options->out_of_core_path.empty()); else {
+			//	(Each is copied into memory.)
+			fprintf(stderr,"`--snapshots` is not supported with `--out-of-core`!\n");
+			throw -1;
+		}
+	}
+
+	try {
+		options->stats_path = get_arg("--stats");
+	} catch (...) {
+		options->stats_path = "";
+	}
+	if (options->stats_path=="--stats") {
+		fprintf(stderr,"`--stats` requires a path!\n");
+		throw -1;
+	}
+
+	try {
+		options->cost_path = get_arg("--cost");
+	} catch (...) {
+		options->cost_path = "";
+	}
+	if (options->cost_path=="--cost") {
+		fprintf(stderr,"`--cost` requires a path!\n");
+		throw -1;
+	}
+	if (options->cost_path.empty() || options->out_of_core_path.empty()); else {
+		//	(The cost maps are made in memory to be saved.)
+		fprintf(stderr,"`--cost` is not supported with `--out-of-core`!\n");
+		throw -1;
+	}
+
+	std::string str_perf;
+	try {
+		str_perf = get_arg("--perf-counters");
+		options->perf_counters = true;
+	} catch (...) {
+		options->perf_counters = false;
+	}
+	if (options->perf_counters) {
+		if (str_perf=="--perf-counters");
+		else {
+			fprintf(stderr,"`--perf-counters` does not take a value!\n");
+			throw -1;
+		}
+	}
+
+	try {
+		options->convergence_path = get_arg("--convergence");
+	} catch (...) {
+		options->convergence_path = "";
+	}
+	options->convergence_interval = 1.0f;
+	if (!options->convergence_path.empty()) {
+		if (options->convergence_path=="--convergence") {
+			fprintf(stderr,"`--convergence` requires a path!\n");
+			throw -1;
+		}
+		try {
+			options->convergence_reference = get_arg("--reference");
+		} catch (...) {
+			fprintf(stderr,"`--convergence` requires a reference image (`--reference=<pfm-path>`)!\n");
+			throw -1;
+		}
+		if (Str::endswith(options->convergence_reference,".pfm")); else {
+			fprintf(stderr,"The reference image must be a PFM image!\n");
+			throw -1;
+		}
+		std::string str_interval;
+		try {
+			str_interval = get_arg("--convergence-interval");
+		} catch (...) {
+			str_interval = "1";
+		}
+		try {
+			options->convergence_interval = Str::to_float(str_interval);
+		} catch (int) {
+			options->convergence_interval = 0.0f;
+		}
+		if (options->convergence_interval>0.0f); else {
+			fprintf(stderr,"Invalid convergence interval!\n");
+			throw -1;
+		}
+		Framebuffer::Tile const& crop = options->crop;
+		if (crop.pos[0]==0 && crop.pos[1]==0 && crop.res[0]==options->res[0] && crop.res[1]==options->res[1]); else {
+			fprintf(stderr,"`--convergence` requires rendering the whole image!\n");
+			throw -1;
+		}
+		if (options->out_of_core_path.empty()); else {
+			//	(The reference image is loaded into memory, and so is each measured image.)
+			fprintf(stderr,"`--convergence` is not supported with `--out-of-core`!\n");
+			throw -1;
+		}
+	}
+
+	try {
+		options->trace_path = get_arg("--trace");
+	} catch (...) {
+		options->trace_path = "";
+	}
+	if (options->trace_path=="--trace") {
+		fprintf(stderr,"`--trace` requires a path!\n");
+		throw -1;
+	}
+
+	try {
+		mode->coordinator_address = get_arg("--coordinator");
+	} catch (...) {}
+	if (!mode->coordinator_address.empty()) {
+		if (mode->coordinator_address=="--coordinator") {
+			fprintf(stderr,"`--coordinator` requires a port!\n");
+			throw -1;
+		}
+		if (options->time_limit==0); else {
+			fprintf(stderr,"`--time-limit` is not supported for distributed renders!\n");
+			throw -1;
+		}
+		if (
+			options->stats_path.empty() && options->cost_path.empty() && options->convergence_path.empty() &&
+			options->snapshots.empty() && !options->exr_aovs && options->out_of_core_path.empty()
+		); else {
+			fprintf(stderr,"`--stats`, `--cost`, `--convergence`, `--snapshots`, `--exr-aovs`, and `--out-of-core` are not supported for distributed renders!\n");
+			throw -1;
+		}
+	}
+
+	try {
+		mode->request_path = get_arg("--request");
+	} catch (...) {}
+	if (!mode->request_path.empty()) {
+		if (mode->request_path=="--request") {
+			fprintf(stderr,"`--request` requires a path!\n");
+			throw -1;
+		}
+		if (mode->coordinator_address.empty()); else {
+			fprintf(stderr,"Only one of `--coordinator` and `--request` can be given!\n");
+			throw -1;
+		}
+		if (
+			options->stats_path.empty() && options->cost_path.empty() && options->trace_path.empty() &&
+			options->convergence_path.empty() && options->snapshots.empty() && !options->exr_aovs &&
+			options->out_of_core_path.empty()
+		); else {
+			fprintf(stderr,"`--stats`, `--cost`, `--trace`, `--convergence`, `--snapshots`, `--exr-aovs`, and `--out-of-core` are not supported for requested renders!\n");
+			throw -1;
+		}
+	}
+
 	#ifdef SUPPORT_WINDOWED
 	std::string str_win;
 	try {
@@ -153,12 +839,112 @@ inline static void _parse_arguments( char const*const argv[],size_t length, Rend
 	}
 	#endif
 
-	if (args.size()>1) {
-		fprintf(stderr,"Warning: ignoring extraneous argument(s):\n");
-		for (size_t i=1;i<args.size();++i) {
-			fprintf(stderr,"  \"%s\"\n",args[i].c_str());
+	warn_extraneous();
+}
+
+//Run the renders listed in the manifest at `manifest_path`.  Returns the number of them that failed
+//	(or were stopped), or -1 if the manifest could not be read.
+inline static int _run_batch(std::string const& manifest_path, size_t num_threads) {
+	//Read the renders' arguments
+	std::vector<std::pair<size_t,std::vector<std::string>>> jobs; //(line number, arguments)
+	{
+		std::ifstream file(manifest_path);
+		if (file.is_open()); else {
+			fprintf(stderr,"Could not open batch manifest \"%s\"!\n",manifest_path.c_str());
+			return -1;
+		}
+		std::string line;
+		for (size_t line_number=1; std::getline(file,line); ++line_number) {
+			std::vector<std::string> args = { "simple-spectral" };
+			for (std::string const& arg : Str::split(line," ")) {
+				std::string trimmed = arg;
+				while (!trimmed.empty() && (trimmed.back()=='\r'||trimmed.back()=='\t')) trimmed.pop_back();
+				if (!trimmed.empty()) args.push_back(trimmed);
+			}
+			if (args.size()==1 || args[1][0]=='#') continue;
+			jobs.emplace_back( line_number, args );
+		}
+	}
+
+	ThreadPool pool(num_threads);
+	sRGB_ReflectanceTexture::set_caching(true);
+
+	std::signal(SIGINT,  _callback_signal);
+	std::signal(SIGTERM, _callback_signal);
+
+	//	Wait for a render to finish (or stop it, if interrupted).
+	auto wait = [](Renderer* renderer) -> void {
+		while (renderer->is_rendering()) {
+			if (_interrupted) renderer->render_stop();
+			std::this_thread::sleep_for(std::chrono::milliseconds(50));
+		}
+		renderer->render_wait();
+	};
+
+	//Each render is set up while the previous one renders, and saved while the next one renders.
+	int num_failed = 0;
+	Renderer* previous = nullptr;
+	for (size_t k=0;k<jobs.size()&&!_interrupted;++k) {
+		size_t                   line_number = jobs[k].first;
+		std::vector<std::string> args        = jobs[k].second;
+
+		Renderer* renderer = nullptr;
+		try {
+			std::vector<char const*> argv;
+			for (std::string const& arg : args) argv.push_back(arg.c_str());
+			Renderer::Options options;
+			_Mode mode;
+			_parse_arguments( argv.data(),argv.size(), &options, &mode );
+			if (mode.is_render()); else {
+				fprintf(stderr,"Only renders can be run in a batch!\n");
+				throw -1;
+			}
+			if (options.trace_path.empty()); else {
+				fprintf(stderr,"`--trace` is not supported in a batch!\n");
+				throw -1;
+			}
+			#ifdef SUPPORT_WINDOWED
+			options.open_window = false;
+			#endif
+
+			renderer = new Renderer(options,&pool);
+		} catch (int) {
+			fprintf(stderr,"Skipping render on line %zu of batch manifest \"%s\"!\n",line_number,manifest_path.c_str());
+			++num_failed;
+		}
+
+		if (previous!=nullptr) wait(previous);
+		if (renderer!=nullptr) {
+			if (!_interrupted) {
+				printf("\nRender %zu of %zu: \"%s\"\n",k+1,jobs.size(),renderer->options.output_path.c_str());
+				renderer->render_start();
+			} else {
+				delete renderer;
+				renderer = nullptr;
+			}
+		}
+		if (previous!=nullptr) {
+			//	Encode on the resident pool only if it is idle; otherwise, leave it to the next render.
+			if (!previous->is_completed()) ++num_failed;
+			previous->save_result( previous->is_completed(), renderer==nullptr?&pool:nullptr );
+			delete previous;
 		}
+
+		previous = renderer;
+	}
+	if (previous!=nullptr) {
+		wait(previous);
+		if (!previous->is_completed()) ++num_failed;
+		previous->save_result( previous->is_completed(), &pool );
+		delete previous;
+	}
+
+	sRGB_ReflectanceTexture::set_caching(false);
+
+	if (num_failed>0) {
+		fprintf(stderr,"%d of %zu render(s) in the batch failed or were stopped.\n",num_failed,jobs.size());
 	}
+	return num_failed;
 }
 
 int main(int argc, char* argv[]) {
@@ -169,18 +955,97 @@ int main(int argc, char* argv[]) {
 	{
 		//Attempt to parse arguments for render
 		Renderer::Options options;
+		_Mode mode;
 		try {
-			_parse_arguments( argv,static_cast<size_t>(argc), &options );
+			_parse_arguments( argv,static_cast<size_t>(argc), &options, &mode );
 		} catch (int) {
 			_print_usage();
 			return -1;
 		}
 
+		//Start recording a timeline, if requested
+		if (!options.trace_path.empty()) {
+			Trace::enable();
+			Trace::name_thread("main");
+		}
+
 		#ifdef RENDER_MODE_SPECTRAL
 		//Initialize color data
-		Color::init();
+		{
+			Trace::Scope trace_scope("initialize color data");
+			Color::init();
+		}
 		#endif
 
+		//Merge partial images, if that's what was asked for instead of a render
+		if (!mode.merge_paths.empty()) {
+			int result = 0;
+			try {
+				Checkpoint::merge( mode.merge_paths, options.output_path );
+			} catch (int) {
+				result = -1;
+			}
+			#ifdef RENDER_MODE_SPECTRAL
+			Color::deinit();
+			#endif
+			return result;
+		}
+
+		//Run a batch of renders, if that's what was asked for
+		if (!mode.batch_path.empty()) {
+			int result = _run_batch( mode.batch_path, options.num_threads );
+			#ifdef RENDER_MODE_SPECTRAL
+			Color::deinit();
+			#endif
+			return result==0 ? 0 : -1;
+		}
+
+		//Take part in a distributed render, or serve or request renders, if that's what was asked
+		//	for
+		if (!mode.coordinator_address.empty() || !mode.worker_address.empty() || !mode.serve_path.empty() || !mode.request_path.empty()) {
+			int result = 0;
+			Net::init();
+			std::signal(SIGINT,  _callback_signal);
+			std::signal(SIGTERM, _callback_signal);
+			try {
+				std::string host;
+				uint16_t port;
+				if        (!mode.worker_address.empty()) {
+					Net::parse_address( mode.worker_address, &host,&port );
+					Distributed::run_worker( host,port, options.num_threads );
+				} else if (!mode.coordinator_address.empty()) {
+					Net::parse_address( mode.coordinator_address, &host,&port );
+					Distributed::run_coordinator( options, host,port, &_interrupted );
+				} else if (!mode.serve_path.empty()) {
+					//	Requests are the arguments for a render.
+					auto parse = [](std::vector<std::string> const& args, Renderer::Options* request_options) -> void {
+						std::vector<char const*> request_argv = { "simple-spectral" };
+						for (std::string const& arg : args) request_argv.push_back(arg.c_str());
+						_Mode request_mode;
+						_parse_arguments( request_argv.data(),request_argv.size(), request_options, &request_mode );
+						if (request_mode.is_render()); else {
+							fprintf(stderr,"Only renders can be requested!\n");
+							throw -1;
+						}
+					};
+					Daemon::run_server( mode.serve_path, options.num_threads, parse, &_interrupted );
+				} else {
+					std::vector<std::string> args;
+					for (int k=1;k<argc;++k) {
+						if (!Str::startswith(argv[k],"--request=")) args.emplace_back(argv[k]);
+					}
+					Daemon::run_client( mode.request_path, args, options, &_interrupted );
+				}
+			} catch (int) {
+				result = -1;
+			}
+			Net::deinit();
+			#ifdef RENDER_MODE_SPECTRAL
+			Color::deinit();
+			#endif
+			return result;
+		}
+
 		//Round-trip error test/demonstration
 		#if 0 && defined RENDER_MODE_SPECTRAL
 		{
@@ -225,7 +1090,7 @@ int main(int argc, char* argv[]) {
 					for (size_t k=0;k<count;++k) {
 						nm lambda_0 = LAMBDA_MIN + Math::rand_1f(rng)*LAMBDA_STEP;
 						SpectralRadiantFlux::HeroSample sample = flux[lambda_0];
-						CIEXYZ_32F xyz = Color::specradflux_to_ciexyz( sample, lambda_0 );
+						CIEXYZ_32F xyz = Color::specradflux_to_ciexyz( sample, lambda_0,1.0f/LAMBDA_STEP );
 						xyz_out += xyz;
 					}
 					xyz_out /= static_cast<double>(count);
@@ -267,7 +1132,20 @@ int main(int argc, char* argv[]) {
 		#endif
 
 		//Create renderer
-		Renderer renderer(options);
+		Renderer* renderer;
+		try {
+			renderer = new Renderer(options);
+		} catch (int) {
+			#ifdef RENDER_MODE_SPECTRAL
+			Color::deinit();
+			#endif
+			return -1;
+		}
+
+		//Stop the render gracefully when interrupted
+		std::signal(SIGINT,  _callback_signal);
+		std::signal(SIGTERM, _callback_signal);
+
 		#ifdef SUPPORT_WINDOWED
 		if (options.open_window) {
 			//Set up window and rendering parameters
@@ -312,20 +1190,21 @@ int main(int argc, char* argv[]) {
 			}
 
 			//Start rendering
-			renderer.render_start();
+			renderer->render_start();
 
 			//Display loop for the ongoing or completed render
 			while (!glfwWindowShouldClose(window)) {
 				glfwPollEvents();
+				if (_interrupted) glfwSetWindowShouldClose(window, GLFW_TRUE);
 
-				renderer.framebuffer.draw();
+				renderer->framebuffer.draw();
 
 				glfwSwapBuffers(window);
 			}
 
 			//Stop the renderer if it hasn't been already.
-			renderer.render_stop();
-			renderer.render_wait();
+			renderer->render_stop();
+			renderer->render_wait();
 
 			//Clean up
 			glfwDestroyWindow(window);
@@ -334,14 +1213,23 @@ int main(int argc, char* argv[]) {
 		} else {
 		#endif
 			//Start rendering
-			renderer.render_start();
+			renderer->render_start();
 
-			//Wait for completion
-			renderer.render_wait ();
+			//Wait for completion, or until interrupted
+			while (renderer->is_rendering()) {
+				if (_interrupted) {
+					renderer->render_stop();
+					break;
+				}
+				std::this_thread::sleep_for(std::chrono::milliseconds(50));
+			}
+			renderer->render_wait ();
 		#ifdef SUPPORT_WINDOWED
 		}
 		#endif
 
+		delete renderer;
+
 		#ifdef RENDER_MODE_SPECTRAL
 		//Clean up color data
 		Color::deinit();
@@ -7,14 +7,43 @@
 
 
 
+//Decoded images by path, if caching (see `sRGB_ReflectanceTexture::set_caching(...)`)
+class _DecodedImage final { public:
+	std::vector<unsigned char> data;
+	unsigned w, h;
+};
+static std::mutex _cache_mutex;
+static bool _cache_enabled = false;
+static std::map<std::string,_DecodedImage> _cache;
+
+void sRGB_ReflectanceTexture::set_caching(bool enable) {
+	std::lock_guard<std::mutex> lock(_cache_mutex);
+	_cache_enabled = enable;
+	if (!enable) _cache.clear();
+}
+
 sRGB_ReflectanceTexture::sRGB_ReflectanceTexture(std::string const& path) {
-	//Load data from file
+	//Load data from file (or the cache)
 	std::vector<unsigned char> out;
 	unsigned w, h;
-	lodepng::decode( out, w,h, path, LCT_RGB );
-	if (!out.empty()); else {
-		fprintf(stderr,"Could not load texture \"%s\"\n",path.c_str());
-		throw -1;
+	{
+		std::lock_guard<std::mutex> lock(_cache_mutex);
+		auto iter = _cache.find(path);
+		if (iter!=_cache.end()) {
+			out = iter->second.data;
+			w   = iter->second.w;
+			h   = iter->second.h;
+		}
+	}
+	if (out.empty()) {
+		lodepng::decode( out, w,h, path, LCT_RGB );
+		if (!out.empty()); else {
+			fprintf(stderr,"Could not load texture \"%s\"\n",path.c_str());
+			throw -1;
+		}
+
+		std::lock_guard<std::mutex> lock(_cache_mutex);
+		if (_cache_enabled) _cache[path]={ out, w,h };
 	}
 
 	//Set resolution
@@ -126,10 +155,13 @@ void MaterialLambertian::evaluate_bsdf(struct BSDF_Evaluation*  evaluation ) con
 		else                      evaluation->f_s=albedo.texture->sample(evaluation->st);
 	#endif
 	evaluation->f_s /= Constants::pi<float>;
+
+	//Matches the cosine-weighted sampling in `.interact_bsdf(...)`.
+	evaluation->pdf_w_i = std::max( glm::dot(evaluation->w_i,evaluation->N), 0.0f ) / Constants::pi<float>;
 }
 void MaterialLambertian::interact_bsdf(struct BSDF_Interaction* interaction) const /*override*/ {
 	//Importance-sample the geometry term
-	interaction->w_i = Math::rand_coshemi(interaction->rng,&interaction->pdf_w_i);
+	interaction->w_i = Math::rand_coshemi(interaction->sampler.get_2f(),&interaction->pdf_w_i);
 	interaction->w_i = Math::get_rotated_to(interaction->w_i,interaction->N);
 
 	#ifdef RENDER_MODE_SPECTRAL
@@ -150,6 +182,7 @@ void MaterialMirror::evaluate_bsdf(struct BSDF_Evaluation*  evaluation ) const /
 	#else
 		evaluation->f_s = RGB_RecipSR                 (0.0f);
 	#endif
+	evaluation->pdf_w_i = 0.0f;
 }
 void MaterialMirror::interact_bsdf(struct BSDF_Interaction* interaction) const /*override*/ {
 	//Importance-sample the Dirac δ function
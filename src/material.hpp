@@ -2,7 +2,7 @@
 
 #include "stdafx.hpp"
 
-#include "util/random.hpp"
+#include "sampler.hpp"
 
 #include "spectrum.hpp"
 
@@ -25,6 +25,10 @@ class sRGB_ReflectanceTexture final {
 		sRGB_ReflectanceTexture(sRGB_ReflectanceTexture const& other);
 		~sRGB_ReflectanceTexture();
 
+		//While enabled, decoded images are kept (by path), so that scenes loaded again (e.g. by a
+		//	batch of renders) don't decode them again.  Disabling frees them.
+		static void set_caching(bool enable);
+
 	#ifdef RENDER_MODE_SPECTRAL
 		//Return hero wavelength sample of the texture at the coordinates given by pixel index
 		//	(`i`,`j`) for the hero wavelength `lambda_0`.  Note that scanlines are stored top-to-
@@ -55,7 +59,8 @@ class MaterialBase {
 		#endif
 
 		//Encapsulates the state of a BSDF evaluation (that is, given the input, output, and normal
-		//	vectors, return the BSDF's value).
+		//	vectors, return the BSDF's value, and the PDF with which a BSDF interaction would have
+		//	chosen the input vector).
 		struct BSDF_Evaluation  final {
 			ST const st;
 			#ifdef RENDER_MODE_SPECTRAL
@@ -64,7 +69,7 @@ class MaterialBase {
 
 			Dir const w_o;
 			Dir const N;
-			Dir const w_i;
+			Dir const w_i; float pdf_w_i;
 
 			#ifdef RENDER_MODE_SPECTRAL
 				SpectralRadiance::HeroSample f_s;
@@ -83,7 +88,7 @@ class MaterialBase {
 
 			Dir const w_o;
 			Dir const N;
-			Dir w_i; float pdf_w_i; Math::RNG& rng;
+			Dir w_i; float pdf_w_i; SamplerBase& sampler;
 
 			#ifdef RENDER_MODE_SPECTRAL
 				SpectralRadiance::HeroSample f_s;
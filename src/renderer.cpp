@@ -2,52 +2,255 @@
 
 #include "util/color.hpp"
 #include "util/math-helpers.hpp"
+#include "util/string.hpp"
+#include "util/thread-pool.hpp"
+#include "util/trace.hpp"
 
+#include "checkpoint.hpp"
+#include "convergence.hpp"
 #include "geometry.hpp"
 #include "material.hpp"
 #include "scene.hpp"
 
 
 
-Renderer::Renderer(Options const& options) :
+Renderer::Renderer(Options const& options, ThreadPool* pool, Scene* shared_scene) :
 	options(options),
-	framebuffer(options.res)
+	framebuffer(options.res,options.out_of_core_path),
+	scene(shared_scene),
+	_owns_scene(shared_scene==nullptr),
+	_pool(pool)
 {
-	//Load the scene
-	if        (options.scene_name=="cornell"     ) {
-		scene = Scene::get_new_cornell     ();
-		#ifndef EXPLICIT_LIGHT_SAMPLING
-			fprintf(stderr,"Warning: Cornell converges much faster with explicit light sampling!  (See \"stdafx.hpp\" to enable.)\n");
-		#endif
-	} else if (options.scene_name=="cornell-srgb") {
-		scene = Scene::get_new_cornell_srgb();
-		#ifndef EXPLICIT_LIGHT_SAMPLING
-			fprintf(stderr,"Warning: Cornell converges much faster with explicit light sampling!  (See \"stdafx.hpp\" to enable.)\n");
-		#endif
-	} else if (options.scene_name=="plane-srgb"  ) {
-		scene = Scene::get_new_plane_srgb  ();
-		#ifdef EXPLICIT_LIGHT_SAMPLING
-			fprintf(stderr,"Warning: Plane converges much faster without explicit light sampling!  (See \"stdafx.hpp\" to disable.)\n");
-		#endif
+	//Load the scene, if not given one
+	if (_owns_scene) {
+		Trace::Scope trace_scope("load scene");
+		scene = Scene::get_new(options.scene_name);
+		if (scene!=nullptr); else {
+			fprintf(stderr,
+				"Unrecognized scene \"%s\"!  (Supported scenes: \"cornell\", \"cornell-srgb\", \"plane-srgb\", \"plane-srgb-mirror\")\n",
+				options.scene_name.c_str()
+			);
+			throw -3;
+		}
+	}
+	if (
+		(options.scene_name=="cornell" || options.scene_name=="cornell-srgb") &&
+		options.light_sampling==Options::LIGHT_SAMPLING::NONE
+	) {
+		fprintf(stderr,"Warning: Cornell converges much faster with light sampling!  (See `--light-sampling`.)\n");
+	}
+
+	//Set up the camera
+	camera = scene->camera;
+	if (!std::isnan(options.camera_pos.x)) camera.pos=options.camera_pos;
+	if (!std::isnan(options.camera_dir.x)) camera.dir=glm::normalize(options.camera_dir);
+	if (!std::isnan(options.camera_up .x)) camera.up =options.camera_up;
+	if (!std::isnan(options.camera_vfov_deg)) camera.vfov_deg=options.camera_vfov_deg;
+	camera.update_matrices();
+
+	//Note the materials, so shading calls can be counted by material
+	for (auto const& iter : scene->materials) _materials.push_back(iter.second);
+
+	#ifdef RENDER_MODE_SPECTRAL
+	//Set up the distribution of hero wavelengths
+	{
+		auto get_response = [](nm lambda_0) -> SpectrumUnspecified::HeroSample {
+			return
+				Color::data->std_obs_xbar[lambda_0] +
+				Color::data->std_obs_ybar[lambda_0] +
+				Color::data->std_obs_zbar[lambda_0]
+			;
+		};
+
+		std::function<SpectrumUnspecified::HeroSample(nm)> target;
+		switch (options.wavelength_sampling) {
+			case Options::WAVELENGTH_SAMPLING::UNIFORM:
+				break;
+			case Options::WAVELENGTH_SAMPLING::Y:
+				target = [](nm lambda_0) -> SpectrumUnspecified::HeroSample {
+					return Color::data->std_obs_ybar[lambda_0];
+				};
+				break;
+			case Options::WAVELENGTH_SAMPLING::XYZ:
+				target = get_response;
+				break;
+			case Options::WAVELENGTH_SAMPLING::XYZ_EMITTERS:
+				target = [&](nm lambda_0) -> SpectrumUnspecified::HeroSample {
+					SpectralRadiance::HeroSample emission(0.0f);
+					for (PrimBase const* light : scene->lights) emission+=light->material->emission[lambda_0];
+					return get_response(lambda_0) * emission;
+				};
+				break;
+			default:
+				assert(false);
+				break;
+		}
+		_lambda_0_distr = new HeroWavelengthDistribution(target);
+	}
+	#endif
+
+	//Generate sample points, if needed
+	if (options.sampler==SamplerBase::TYPE::PMJ02) {
+		_pmj02_sets = new SamplerPMJ02::Sets(options.spp);
 	} else {
-		fprintf(stderr,
-			"Unrecognized scene \"%s\"!  (Supported scenes: \"cornell\", \"cornell-srgb\", \"plane-srgb\")\n",
-			options.scene_name.c_str()
-		);
-		throw -3;
+		_pmj02_sets = nullptr;
 	}
 
 	//Allocate space for threads
-	#if 0
-		fprintf(stderr,"Warning: only using one thread!\n");
-		_threads.resize(1);
-	#else
-		_threads.resize(std::thread::hardware_concurrency());
-	#endif
+	if        (_pool!=nullptr) {
+		_pool_tasks.resize(_pool->get_num_threads());
+	} else if (options.num_threads>0) {
+		_threads.resize(options.num_threads);
+	} else {
+		//	Note `std::thread::hardware_concurrency()` returns zero if it can't tell.
+		_threads.resize(std::max( std::thread::hardware_concurrency(), 1u ));
+	}
+
+	//Set up the accumulation buffer, continuing from a checkpoint if requested, and the measurement
+	//	of convergence
+	_accumulation = nullptr;
+	_accumulation_file = nullptr;
+	_convergence = nullptr;
+	try {
+		//	The buffers are laid out one after another (each cache-line-aligned), and start as zeros.
+		size_t num_pixels = options.res[0] * options.res[1];
+		size_t size = 0;
+		auto reserve = [&size](size_t buffer_size) -> size_t {
+			size_t offset = size;
+			size += (buffer_size+63) / 64 * 64;
+			return offset;
+		};
+		size_t offset_sums        = reserve( num_pixels * sizeof(PixelSum) );
+		size_t offset_counts      = reserve( num_pixels * sizeof(uint32_t) );
+		bool costs = !options.cost_path.empty();
+		size_t offset_costs       = reserve( costs ? num_pixels*sizeof(float   ) : 0 );
+		size_t offset_cost_counts = reserve( costs ? num_pixels*sizeof(uint32_t) : 0 );
+		size_t offset_moments     = reserve( options.exr_aovs ? num_pixels*sizeof(glm::dvec3) : 0 );
+		if (options.out_of_core_path.empty()) {
+			_accumulation = new uint8_t[size]();
+		} else {
+			_accumulation_file = new MappedFile( options.out_of_core_path+".accumulation", size, true );
+			_accumulation = _accumulation_file->get_data();
+		}
+		_pixel_sums        = reinterpret_cast<PixelSum*>( _accumulation + offset_sums        );
+		_pixel_counts      = reinterpret_cast<uint32_t*>( _accumulation + offset_counts      );
+		_pixel_costs       = costs ? reinterpret_cast<float*   >( _accumulation + offset_costs       ) : nullptr;
+		_pixel_cost_counts = costs ? reinterpret_cast<uint32_t*>( _accumulation + offset_cost_counts ) : nullptr;
+		_pixel_moments = options.exr_aovs ? reinterpret_cast<glm::dvec3*>(_accumulation+offset_moments) : nullptr;
+
+		if (!options.resume_path.empty()) {
+			Checkpoint::load( options.resume_path, options, _pixel_sums,_pixel_counts );
+		}
+		if (!options.convergence_path.empty()) {
+			_convergence = new Convergence( options.convergence_reference, options.convergence_path, options.res );
+		}
+	} catch (int) {
+		if (_accumulation_file==nullptr) delete[] _accumulation;
+		delete _accumulation_file;
+		delete _pmj02_sets;
+		#ifdef RENDER_MODE_SPECTRAL
+		delete _lambda_0_distr;
+		#endif
+		if (_owns_scene) delete scene;
+		throw;
+	}
+	if (!options.resume_path.empty()) {
+		for (size_t j=0;j<options.res[1];++j) {
+			for (size_t i=0;i<options.res[0];++i) {
+				if (_pixel_counts[j*options.res[0]+i]>0u) _resolve_pixel(i,j);
+			}
+		}
+	}
+
+	//Nothing rendered or written yet (these are reset when rendering starts, but parts of the image
+	//	can also be rendered by other means)
+	_num_rendering = 0u;
+	_checkpoint_written = false;
+	_time_start = std::chrono::steady_clock::now();
+	_time_last_checkpoint = _time_start;
+	_time_end = _time_start;
+	_perf_save_available = false;
+	_time_next_convergence = 0.0;
+	_convergence_spp = 0;
+
+	//Start the thread saving snapshots, if there will be any
+	_snapshots_done = false;
+	if (!options.snapshots.empty()) {
+		_snapshot_writer = new std::thread( &Renderer::_snapshot_threadwork, this );
+	} else {
+		_snapshot_writer = nullptr;
+	}
+
+	//Divide the crop region into tiles
+	Framebuffer::Tile const& crop = options.crop;
+	for (size_t j=crop.pos[1];j<crop.pos[1]+crop.res[1];j+=TILE_SIZE) {
+		for (size_t i=crop.pos[0];i<crop.pos[0]+crop.res[0];i+=TILE_SIZE) {
+			_tiles_all.push_back({
+				{ i, j },
+				{
+					std::min( crop.pos[0]+crop.res[0]-i, TILE_SIZE ),
+					std::min( crop.pos[1]+crop.res[1]-j, TILE_SIZE )
+				}
+			});
+		}
+	}
+	//	Rearrange so that the lower tiles are at the end of the list (and thereby are pulled off and
+	//		rendered first).
+	std::reverse(_tiles_all.begin(),_tiles_all.end());
 }
 Renderer::~Renderer() {
+	//Wait for any snapshots to be saved
+	if (_snapshot_writer!=nullptr) {
+		{
+			std::lock_guard<std::mutex> lock(_snapshots_mutex);
+			_snapshots_done = true;
+			_snapshots_cv.notify_all();
+		}
+		_snapshot_writer->join();
+		delete _snapshot_writer;
+	}
+
+	//Cleanup measurement of convergence
+	delete _convergence;
+
+	//Cleanup accumulation buffer
+	if (_accumulation_file==nullptr) delete[] _accumulation;
+	delete _accumulation_file;
+
+	#ifdef RENDER_MODE_SPECTRAL
+	//Cleanup hero wavelength distribution
+	delete _lambda_0_distr;
+	#endif
+
+	//Cleanup sample points
+	delete _pmj02_sets;
+
 	//Cleanup scene
-	delete scene;
+	if (_owns_scene) delete scene;
+}
+
+Renderer::_Stats::_Stats(size_t num_materials) :
+	num_rays_camera(0), num_rays_indirect(0), num_rays_shadow(0),
+	num_prim_tests(0),
+	num_shading_calls(num_materials,0),
+	num_tiles(0), tile_time_total(0.0), tile_time_max(0.0),
+	perf_available(false)
+{
+	for (uint64_t& count : path_lengths) count=0;
+}
+Renderer::_Stats& Renderer::_Stats::operator+=(_Stats const& other) {
+	num_rays_camera   += other.num_rays_camera;
+	num_rays_indirect += other.num_rays_indirect;
+	num_rays_shadow   += other.num_rays_shadow;
+	num_prim_tests    += other.num_prim_tests;
+	for (size_t k=0;k<=MAX_DEPTH;++k) path_lengths[k]+=other.path_lengths[k];
+	for (size_t k=0;k<num_shading_calls.size();++k) num_shading_calls[k]+=other.num_shading_calls[k];
+	num_tiles       += other.num_tiles;
+	tile_time_total += other.tile_time_total;
+	tile_time_max    = std::max( tile_time_max, other.tile_time_max );
+	perf_render  += other.perf_render;
+	perf_resolve += other.perf_resolve;
+	return *this;
 }
 
 void Renderer::_print_progress() const {
@@ -75,16 +278,29 @@ void Renderer::_print_progress() const {
 		std::chrono::duration_cast<std::chrono::nanoseconds>(time_now-_time_start).count()
 	) * 1.0e-9;
 
-	//Fraction of the tiles that have been rendered (or are being rendered).  So, roughly the
-	//	overall fraction of the render that is completed.
-	double part = static_cast<double>(_num_tiles_start-_tiles.size()) / static_cast<double>(_num_tiles_start);
+	//Fraction of the samples that have been rendered (or are being rendered), counting the tiles
+	//	of the current pass.  So, roughly the overall fraction of the render that is completed.
+	double part = static_cast<double>(_pass_begin);
+	if (!_tiles_all.empty()) {
+		part += static_cast<double>(_pass_end-_pass_begin) *
+			static_cast<double>(_tiles_all.size()-_tiles.size()) / static_cast<double>(_tiles_all.size());
+	}
+	part /= static_cast<double>(options.spp);
+	double part_start = static_cast<double>(_spp_start) / static_cast<double>(options.spp);
 
-	if (part<1.0) {
-		if (part>0.0) {
-			//Middle of render.  Print fraction and expected time based on a simple extrapolation.
-			double expected_time_total = time_since_start / part;
-			double expected_time_remaining = expected_time_total - time_since_start;
-			printf("\rRender %.3f%% (ETA ",part*100.0);
+	if (!_render_completed) {
+		if (part>part_start) {
+			//Middle of render.  Print fraction and expected time based on a simple extrapolation
+			//	(from where this run started, in case it resumed from a checkpoint).
+			double expected_time_remaining = time_since_start * (1.0-part) / (part-part_start);
+			if (options.time_limit==0) {
+				printf("\rRender %.3f%% (ETA ",part*100.0);
+			} else {
+				//	The time limit probably ends the render first.
+				double time_remaining = static_cast<double>(options.time_limit) - time_since_start;
+				expected_time_remaining = std::min( expected_time_remaining, std::max(time_remaining,0.0) );
+				printf("\rRender at %zu of %zu samples per pixel (ETA ",_pass_begin,options.spp);
+			}
 			pretty_print_time(expected_time_remaining);
 			printf(")           ");
 			fflush(stdout);
@@ -93,25 +309,33 @@ void Renderer::_print_progress() const {
 			printf("\rRender started                               ");
 		}
 	} else {
-		//End of render.  Print elapsed time.
-		printf("\rRender completed in ");
+		//End of render.  Print sample count and elapsed time.
+		printf("\rRender completed with %zu samples per pixel in ",_pass_end);
 		pretty_print_time(time_since_start);
 		printf("             \n");
 	}
 }
 
+size_t Renderer::_get_material_index(MaterialBase const* material) const {
+	//	There are only a few materials, so a search is faster than anything fancier.
+	size_t index = 0;
+	while (_materials[index]!=material) ++index;
+	return index;
+}
+
 #ifdef RENDER_MODE_SPECTRAL
-CIEXYZ_A_32F Renderer::_render_sample(Math::RNG& rng, size_t i,size_t j)
+CIEXYZ_A_32F Renderer::_render_sample(SamplerBase& sampler,_Stats& stats, size_t i,size_t j)
 #else
-lRGB_A_F32   Renderer::_render_sample(Math::RNG& rng, size_t i,size_t j)
+lRGB_A_F32   Renderer::_render_sample(SamplerBase& sampler,_Stats& stats, size_t i,size_t j)
 #endif
 {
 	//Render sample within pixel (`i`,`j`).
 
 	//	Location within the framebuffer
+	glm::vec2 jitter = sampler.get_2f();
 	ST framebuffer_st(
-		(static_cast<float>(i)+rand_1f(rng)) / static_cast<float>(framebuffer.res[0]),
-		(static_cast<float>(j)+rand_1f(rng)) / static_cast<float>(framebuffer.res[1])
+		(static_cast<float>(i)+jitter[0]) / static_cast<float>(framebuffer.res[0]),
+		(static_cast<float>(j)+jitter[1]) / static_cast<float>(framebuffer.res[1])
 	);
 	//	Normalized device coordinates (to borrow OpenGL terminology)
 	glm::vec2 framebuffer_ndc = framebuffer_st*2.0f - glm::vec2(1.0f);
@@ -121,30 +345,45 @@ lRGB_A_F32   Renderer::_render_sample(Math::RNG& rng, size_t i,size_t j)
 	//		about the simplest-possible camera model.
 	Dir camera_ray_dir;
 	{
-		glm::vec4 point = scene->camera.matr_PV_inv * glm::vec4( framebuffer_ndc, 0.0f, 1.0f );
+		glm::vec4 point = camera.matr_PV_inv * glm::vec4( framebuffer_ndc, 0.0f, 1.0f );
 		point /= point.w;
-		camera_ray_dir = glm::normalize( Pos(point) - scene->camera.pos );
+		camera_ray_dir = glm::normalize( Pos(point) - camera.pos );
 	}
 
 	#ifdef RENDER_MODE_SPECTRAL
 	//	Hero wavelength sampling.
 	//		First, the spectrum is divided into some number of regions.  Then, the hero wavelength
-	//			is selected randomly from the first region.
-	nm lambda_0 = LAMBDA_MIN + rand_1f(rng)*LAMBDA_STEP;
+	//			is selected randomly from the first region.  Wavelength is the largest source of
+	//			color noise, so it is stratified over the pixel's samples (whatever the sampler), and
+	//			importance-sampled according to `options.wavelength_sampling`.
+	float pdf_lambda_0;
+	nm lambda_0 = _lambda_0_distr->sample( sampler.get_1f_stratified(), &pdf_lambda_0 );
 	//		Subsequent wavelengths are defined implicitly as multiples of `LAMBDA_STEP` above
 	//			`lambda_0`.  The vector of these wavelengths are the wavelengths that the light
 	//			transport is computed along.
 	#endif
 
-	//	Main radiance-gathering function used for recursive path tracing
+	//	Power heuristic (with "β=2") for weighting a sample taken with PDF `pdf` when it could also
+	//		have been taken by the other strategy with PDF `pdf_other`.
+	auto mis_weight = [](float pdf, float pdf_other) -> float {
+		float pdf_sq       = pdf       * pdf;
+		float pdf_other_sq = pdf_other * pdf_other;
+		return pdf_sq / ( pdf_sq + pdf_other_sq );
+	};
+
+	//	Main radiance-gathering function used for recursive path tracing.  Along with the ray, it
+	//		takes whether the ray was sampled from a Dirac δ BSDF and the PDF it was sampled with
+	//		(if not), which are needed to weight emission that the ray hits.
 	bool hit_anything = false;
+	//	Number of surfaces the path hits
+	unsigned path_length = 0u;
 	#ifdef RENDER_MODE_SPECTRAL
-	std::function<SpectralRadiance::HeroSample(Ray const&,bool,unsigned,PrimBase const*)> L = [&](
-		Ray const& ray, bool last_was_delta, unsigned depth, PrimBase const* ignore
+	std::function<SpectralRadiance::HeroSample(Ray const&,bool,float,unsigned,PrimBase const*)> L = [&](
+		Ray const& ray, bool last_was_delta, float last_pdf_w_i, unsigned depth, PrimBase const* ignore
 	) -> SpectralRadiance::HeroSample
 	#else
-	std::function<RGB_Radiance(Ray const&,bool,unsigned,PrimBase const*)> L = [&](
-		Ray const& ray, bool last_was_delta, unsigned depth, PrimBase const* ignore
+	std::function<RGB_Radiance(Ray const&,bool,float,unsigned,PrimBase const*)> L = [&](
+		Ray const& ray, bool last_was_delta, float last_pdf_w_i, unsigned depth, PrimBase const* ignore
 	) -> RGB_Radiance
 	#endif
 	{
@@ -155,39 +394,83 @@ lRGB_A_F32   Renderer::_render_sample(Math::RNG& rng, size_t i,size_t j)
 		#endif
 
 		HitRecord hitrec;
+		stats.num_prim_tests += scene->primitives.size() - (ignore!=nullptr?1u:0u);
 		if (scene->intersect( ray,&hitrec, ignore )) {
 			hit_anything = true;
+			path_length = depth + 1u;
 
 			//Emission
-			#ifdef EXPLICIT_LIGHT_SAMPLING
-			//Only add if could not have been sampled on previous)
-			if (last_was_delta&&(!options.indirect_only||depth>0u)) {
-			#endif
-				auto emitted_radiance = hitrec.prim->material->evaluate_emission( hitrec.st, SPECTRAL_ONLY(lambda_0 COMMA) -ray.dir );
-				radiance += emitted_radiance;
-			#ifdef EXPLICIT_LIGHT_SAMPLING
+			//	Direct lighting consists of paths of up to one bounce (depth up to one here).
+			if (hitrec.prim->is_light && (!options.indirect_only||depth>1u)) {
+				//	Weight for the emission, since (except after a δ function, or for the camera
+				//		ray) light sampling could also have found this light.
+				float weight;
+				if (last_was_delta) {
+					weight = 1.0f;
+				} else {
+					switch (options.light_sampling) {
+						case Options::LIGHT_SAMPLING::NONE:
+							weight = 1.0f;
+							break;
+						case Options::LIGHT_SAMPLING::EXPLICIT:
+							weight = 0.0f;
+							break;
+						case Options::LIGHT_SAMPLING::MIS:
+							weight = mis_weight(
+								last_pdf_w_i,
+								scene->get_pdf_toward_light( ray.orig, ray.dir, hitrec.prim )
+							);
+							break;
+						default:
+							assert(false);
+							weight = 0.0f;
+							break;
+					}
+				}
+
+				if (weight>0.0f) {
+					auto emitted_radiance = hitrec.prim->material->evaluate_emission( hitrec.st, SPECTRAL_ONLY(lambda_0 COMMA) -ray.dir );
+					radiance += emitted_radiance * weight;
+				}
 			}
-			#endif
 
 			//If more rays are allowed . . .
 			if (depth+1u<MAX_DEPTH) {
 				//Hit position of ray
 				Pos hit_pos = ray.at(hitrec.dist);
 
-				#ifdef EXPLICIT_LIGHT_SAMPLING
-				//Direct lighting
-				if (!options.indirect_only||depth>0u) {
+				//Random sample from BSDF
+				struct MaterialBase::BSDF_Interaction sampbsdf = {
+					hitrec.st, SPECTRAL_ONLY(lambda_0 COMMA)
+					-ray.dir, hitrec.normal, Dir(qNaN), qNaN, sampler,
+					{}
+				};
+				hitrec.prim->material->interact_bsdf(&sampbsdf);
+				size_t material_index = _get_material_index(hitrec.prim->material);
+				++stats.num_shading_calls[material_index];
+				//	Dirac δ function.  BSDFs that are δ functions are posed having an inverse geometry
+				//		term so that it cancels out in the rendering equation.  Instead of doing that,
+				//		it's more numerically precise to just ignore the geometry term entirely.
+				bool is_delta = !std::isfinite(sampbsdf.pdf_w_i);
+
+				//Direct lighting.  Note light sampling can never hit a δ function, so it isn't tried.
+				if (
+					options.light_sampling!=Options::LIGHT_SAMPLING::NONE && !is_delta &&
+					(!options.indirect_only||depth>0u)
+				) {
 					//Get random ray toward random light
 					Dir shad_ray_dir;
 					PrimBase const* light;
 					float shad_pdf;
-					scene->get_rand_toward_light( rng, hit_pos, &shad_ray_dir,&light,&shad_pdf );
+					scene->get_rand_toward_light( sampler, hit_pos, &shad_ray_dir,&light,&shad_pdf );
 
 					float n_dot_l = glm::dot(shad_ray_dir,hitrec.normal);
-					if (n_dot_l>0.0f) {
+					if (n_dot_l>0.0f && std::isfinite(shad_pdf)) {
 						//Cast the shadow ray
 						Ray ray_shad = { hit_pos, shad_ray_dir };
 						HitRecord hitrec_shad;
+						++stats.num_rays_shadow;
+						stats.num_prim_tests += scene->primitives.size() - 1u;
 						scene->intersect(ray_shad,&hitrec_shad,hitrec.prim);
 
 						if (hitrec_shad.prim == light) {
@@ -202,45 +485,42 @@ lRGB_A_F32   Renderer::_render_sample(Math::RNG& rng, size_t i,size_t j)
 							//	Evaluation of BSDF
 							struct MaterialBase::BSDF_Evaluation evalbsdf = {
 								hitrec.st, SPECTRAL_ONLY(lambda_0 COMMA)
-								-ray.dir, hitrec.normal, shad_ray_dir,
+								-ray.dir, hitrec.normal, shad_ray_dir, qNaN,
 								{}
 							};
 							hitrec.prim->material->evaluate_bsdf(&evalbsdf);
+							++stats.num_shading_calls[material_index];
+
+							//	Weight for the sample, since BSDF sampling could also have found it.
+							float weight = options.light_sampling==Options::LIGHT_SAMPLING::MIS ?
+								mis_weight( shad_pdf, evalbsdf.pdf_w_i ) : 1.0f;
 
 							//	Monte Carlo radiance estimate
-							radiance += emitted_radiance * n_dot_l * evalbsdf.f_s / shad_pdf;
+							radiance += emitted_radiance * n_dot_l * evalbsdf.f_s * (weight/shad_pdf);
 						}
 					}
 				}
-				#endif
 
 				//Indirect lighting
-				//	Random sample from BSDF
-				struct MaterialBase::BSDF_Interaction sampbsdf = {
-					hitrec.st, SPECTRAL_ONLY(lambda_0 COMMA)
-					-ray.dir, hitrec.normal, Dir(qNaN), qNaN, rng,
-					{}
-				};
-				hitrec.prim->material->interact_bsdf(&sampbsdf);
 				//	Recurse in sampled direction if BSDF is nonzero
 				if (glm::dot(sampbsdf.f_s,sampbsdf.f_s)>0.0f) {
 					//	And if the direction has nonzero contribution via the geometry term.
 					float n_dot_l;
-					if (std::isfinite(sampbsdf.pdf_w_i)) {
+					float pdf_w_i;
+					if (!is_delta) {
 						n_dot_l = glm::dot(sampbsdf.w_i,hitrec.normal);
+						pdf_w_i = sampbsdf.pdf_w_i;
 					} else {
-						//		Dirac δ function.  BSDFs that are δ functions are posed having an
-						//			inverse geometry term so that it cancels out in the rendering
-						//			equation.  Instead of doing that, it's more numerically precise
-						//			to just ignore the geometry term entirely.
+						//		See above.
 						n_dot_l = 1.0f;
-						sampbsdf.pdf_w_i = 1.0f;
+						pdf_w_i = 1.0f;
 					}
 					if (n_dot_l>0.0f) {
 						//Trace the ray recursively and use in Monte-Carlo estimate of rendering
 						//	equation.
 						Ray ray_next = { hit_pos, sampbsdf.w_i };
-						radiance += L(ray_next,false,depth+1u,hitrec.prim) * n_dot_l * sampbsdf.f_s / sampbsdf.pdf_w_i;
+						++stats.num_rays_indirect;
+						radiance += L(ray_next,is_delta,sampbsdf.pdf_w_i,depth+1u,hitrec.prim) * n_dot_l * sampbsdf.f_s / pdf_w_i;
 					}
 				}
 			}
@@ -249,20 +529,22 @@ lRGB_A_F32   Renderer::_render_sample(Math::RNG& rng, size_t i,size_t j)
 		return radiance;
 	};
 
-	Ray ray_camera = { scene->camera.pos, camera_ray_dir };
-	auto pixel_rad_est = L(ray_camera,true,0u,nullptr);
+	Ray ray_camera = { camera.pos, camera_ray_dir };
+	++stats.num_rays_camera;
+	auto pixel_rad_est = L(ray_camera,true,qNaN,0u,nullptr);
+	++stats.path_lengths[path_length];
 
 	//Value of Monte-Carlo estimator for the radiant flux incident on the pixel due to paths of any
 	//	length.
 	#ifdef FLAT_FIELD_CORRECTION
 		auto pixel_flux_est = pixel_rad_est;
 	#else
-		auto pixel_flux_est = pixel_rad_est * glm::dot( camera_ray_dir, scene->camera.dir );
+		auto pixel_flux_est = pixel_rad_est * glm::dot( camera_ray_dir, camera.dir );
 	#endif
 
 	#ifdef RENDER_MODE_SPECTRAL
 		//Convert each wavelength sample to CIE XYZ and average.
-		CIEXYZ_32F ciexyz_avg = Color::specradflux_to_ciexyz( pixel_flux_est, lambda_0 );
+		CIEXYZ_32F ciexyz_avg = Color::specradflux_to_ciexyz( pixel_flux_est, lambda_0,pdf_lambda_0 );
 
 		return CIEXYZ_A_32F( ciexyz_avg,     hit_anything?1.0f:0.0f );
 	#else
@@ -270,7 +552,18 @@ lRGB_A_F32   Renderer::_render_sample(Math::RNG& rng, size_t i,size_t j)
 		return lRGB_A_F32  ( pixel_flux_est, hit_anything?1.0f:0.0f );
 	#endif
 }
-void       Renderer::_render_pixel (Math::RNG& rng, size_t i,size_t j) {
+void       Renderer::_render_pixel (SamplerBase& sampler,_Stats& stats, size_t i,size_t j, size_t end) {
+	PixelSum& sum   = _pixel_sums  [ j*options.res[0] + i ];
+	uint32_t& count = _pixel_counts[ j*options.res[0] + i ];
+
+	//	A pixel can already be past the pass (e.g. it was resumed from a checkpoint that was written
+	//		partway through a pass, with different passes than now, because of `--snapshots`).
+	if (count<end); else return;
+
+	//	Note the time the samples take, for the cost map (see `Options::cost_path`), if it's kept.
+	std::chrono::steady_clock::time_point time_begin;
+	if (_pixel_costs!=nullptr) time_begin=std::chrono::steady_clock::now();
+
 	#ifdef RENDER_MODE_SPECTRAL
 		/*
 		Accumulate samples into CIE XYZ instead of a spectrum (probably `SpectralRadiantFlux`).
@@ -284,66 +577,561 @@ void       Renderer::_render_pixel (Math::RNG& rng, size_t i,size_t j) {
 		in a better range.
 		*/
 
-		CIEXYZ_A_64F avg( 0,0,0, 0 );
-		for (size_t k=0;k<options.spp;++k) {
-			avg += _render_sample(rng, i,j) * 0.001f;
+		//	The luminance moments (for `Options::exr_aovs`) are only computed if they're kept.
+		PixelSum pass_sum( 0,0,0, 0 );
+		glm::dvec3 pass_moments( 0.0 );
+		for (size_t k=count;k<end;++k) {
+			sampler.start_sample(i,j,k);
+			CIEXYZ_A_32F sample = _render_sample(sampler,stats, i,j);
+			pass_sum += sample * 0.001f;
+
+			if (_pixel_moments!=nullptr); else continue;
+			lRGB_F32 lrgb = Color::ciexyz_to_lrgb_output(CIEXYZ_32F(sample));
+			double y = static_cast<double>( 0.2126f*lrgb.r + 0.7152f*lrgb.g + 0.0722f*lrgb.b );
+			pass_moments += glm::dvec3( 1.0, y, y*y );
 		}
-		avg *= 1000.0 / static_cast<double>(options.spp);
+	#else
+		PixelSum pass_sum( 0,0,0, 0 );
+		glm::dvec3 pass_moments( 0.0 );
+		for (size_t k=count;k<end;++k) {
+			sampler.start_sample(i,j,k);
+			lRGB_A_F32 sample = _render_sample(sampler,stats, i,j);
+			pass_sum += sample;
 
-		framebuffer(i,j) = sRGB_A_F32( Color::ciexyz_to_srgb(CIEXYZ_32F(avg)), avg.a );
+			if (_pixel_moments!=nullptr); else continue;
+			double y = static_cast<double>( 0.2126f*sample.r + 0.7152f*sample.g + 0.0722f*sample.b );
+			pass_moments += glm::dvec3( 1.0, y, y*y );
+		}
+	#endif
+	sum  += pass_sum;
+	if (_pixel_moments!=nullptr) _pixel_moments[ j*options.res[0] + i ] += pass_moments;
+	if (_pixel_costs!=nullptr) {
+		_pixel_cost_counts[ j*options.res[0] + i ] += static_cast<uint32_t>(end) - count;
+		_pixel_costs      [ j*options.res[0] + i ] += static_cast<float>(
+			std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now()-time_begin).count()
+		) * 1.0e-9f;
+	}
+	count = static_cast<uint32_t>(end);
+}
+void       Renderer::_resolve_pixel(size_t i,size_t j) {
+	framebuffer(i,j) = resolve( _pixel_sums[j*options.res[0]+i], _pixel_counts[j*options.res[0]+i] );
+}
+void       Renderer::_resolve_tile (Framebuffer::Tile const& tile) {
+	for (size_t j=tile.pos[1];j<tile.pos[1]+tile.res[1];++j) {
+		size_t k = j*options.res[0] + tile.pos[0];
+		resolve( _pixel_sums+k,_pixel_counts+k, tile.res[0], &framebuffer(tile.pos[0],j) );
+	}
+	framebuffer.flush(tile);
+}
+lRGB_A_F32 Renderer::resolve(PixelSum const& sum, uint32_t count) {
+	#ifdef RENDER_MODE_SPECTRAL
+		//	See `._render_pixel(...)` for the scaling.
+		PixelSum avg = sum * ( 1000.0 / static_cast<double>(count) );
+		return lRGB_A_F32( Color::ciexyz_to_lrgb_output(CIEXYZ_32F(avg)), avg.a );
 	#else
-		lRGB_A_F64   avg( 0,0,0, 0 );
-		for (size_t k=0;k<options.spp;++k) {
-			avg += _render_sample(rng, i,j);
+		PixelSum avg = sum / static_cast<double>(count);
+		return lRGB_A_F32( avg );
+	#endif
+}
+void       Renderer::resolve(PixelSum const* sums, uint32_t const* counts, size_t num_pixels, lRGB_A_F32* pixels) {
+	for (size_t k=0;k<num_pixels;++k) pixels[k]=resolve( sums[k], counts[k] );
+}
+void Renderer::_record_convergence(bool final) {
+	std::chrono::steady_clock::time_point time_now = std::chrono::steady_clock::now();
+	double time_since_start = static_cast<double>(
+		std::chrono::duration_cast<std::chrono::nanoseconds>(time_now-_time_start).count()
+	) * 1.0e-9;
+	if (final || time_since_start>=_time_next_convergence); else return;
+
+	{
+		Trace::Scope trace_scope("measure convergence");
+		_convergence->record( framebuffer, time_since_start, _pass_end );
+	}
+	_convergence_spp = _pass_end;
+	double interval = static_cast<double>(options.convergence_interval);
+	_time_next_convergence = ( std::floor(time_since_start/interval) + 1.0 ) * interval;
+
+	//	Measuring isn't part of the render, so move the render's start later by the time it took
+	//		(which also keeps it out of the time limit, the progress, and the statistics).
+	_time_start += std::chrono::steady_clock::now() - time_now;
+}
+void Renderer::_take_snapshot() {
+	if (std::binary_search( options.snapshots.begin(),options.snapshots.end(), _pass_end )); else return;
+
+	Trace::Scope trace_scope("copy snapshot");
+	_Snapshot* snapshot = new _Snapshot;
+	snapshot->spp = _pass_end;
+	snapshot->time = static_cast<double>(
+		std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now()-_time_start).count()
+	) * 1.0e-9;
+	size_t num_pixels = options.res[0] * options.res[1];
+	snapshot->sums  .assign( _pixel_sums,   _pixel_sums  +num_pixels );
+	snapshot->counts.assign( _pixel_counts, _pixel_counts+num_pixels );
+	if (_pixel_moments!=nullptr) snapshot->moments.assign( _pixel_moments, _pixel_moments+num_pixels );
+
+	std::lock_guard<std::mutex> lock(_snapshots_mutex);
+	_snapshots.push_back(snapshot);
+	_snapshots_cv.notify_all();
+}
+void Renderer::_snapshot_threadwork() {
+	Trace::name_thread("snapshot writer");
+
+	std::unique_lock<std::mutex> lock(_snapshots_mutex);
+	while (true) {
+		if (!_snapshots.empty()) {
+			_Snapshot* snapshot = _snapshots.front();
+			_snapshots.pop_front();
+			lock.unlock();
+
+			//	Resolve the copy into a framebuffer of its own, and save it to the output path with
+			//		the sample count inserted before the extension.
+			{
+				Trace::Scope trace_scope( "save snapshot", { "spp", static_cast<int64_t>(snapshot->spp) } );
+
+				std::string path = options.output_path;
+				size_t dot = path.find_last_of('.');
+				if (dot!=std::string::npos && path.find('/',dot)==std::string::npos); else dot=path.size();
+				path.insert( dot, "-"+std::to_string(snapshot->spp)+"spp" );
+
+				if (Str::endswith(path,".partial")) {
+					Checkpoint::save( path, options, snapshot->sums.data(),snapshot->counts.data() );
+				} else {
+					Framebuffer snapshot_framebuffer(options.res);
+					for (size_t j=0;j<options.res[1];++j) {
+						for (size_t i=0;i<options.res[0];++i) {
+							size_t k = j*options.res[0] + i;
+							if (snapshot->counts[k]>0u) {
+								snapshot_framebuffer(i,j) = resolve( snapshot->sums[k], snapshot->counts[k] );
+							}
+						}
+					}
+					snapshot_framebuffer.save(
+						path, _get_metadata(std::to_string(snapshot->spp),snapshot->time),
+						options.exr, _get_aovs( snapshot->counts.data(), snapshot->moments.data() )
+					);
+				}
+			}
+			delete snapshot;
+
+			lock.lock();
+		} else if (!_snapshots_done) {
+			_snapshots_cv.wait(lock);
+		} else {
+			break;
 		}
-		avg /= static_cast<double>(options.spp);
+	}
+}
+size_t Renderer::_get_pass_end(size_t begin) const {
+	//	Double the sample count, up to `MAX_PASS_SPP` more; or, if measuring convergence, one more
+	//		(so measurements can be taken often).
+	size_t end;
+	if (_convergence!=nullptr) end=std::min( begin+1_zu, options.spp );
+	else                       end=std::min( begin + std::clamp(begin,1_zu,MAX_PASS_SPP), options.spp );
 
-		framebuffer(i,j) = sRGB_A_F32( Color::lrgb_to_srgb  (lRGB_F32  (avg)), avg.a );
-	#endif
+	//	End early at the next snapshot, if any.
+	auto iter = std::upper_bound( options.snapshots.begin(),options.snapshots.end(), begin );
+	if (iter!=options.snapshots.end() && *iter<end) end=*iter;
+
+	return end;
 }
-void Renderer::_render_threadwork() {
-	//Add ourself to the count of rendering threads
-	uint32_t thread_index = _num_rendering++;
+void Renderer::_start_pass(size_t begin) {
+	_pass_begin = begin;
+	if (begin<options.spp) {
+		_pass_end = _get_pass_end(begin);
+
+		//	If there's a time limit, estimate the cost of a sample per pixel from the passes so far
+		//		(on this run), and take only as many samples as fit in the remaining time.
+		if (options.time_limit>0 && begin>_spp_start) {
+			double time_since_start = static_cast<double>(
+				std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now()-_time_start).count()
+			) * 1.0e-9;
+			double time_per_spp = time_since_start / static_cast<double>(begin-_spp_start);
+			double time_remaining = static_cast<double>(options.time_limit) - time_since_start;
+			double fit = std::floor( std::max(time_remaining,0.0) / time_per_spp );
+			if (fit < static_cast<double>(_pass_end-begin)) {
+				_pass_end = begin + static_cast<size_t>(fit);
+			}
+		}
+	} else {
+		_pass_end = begin;
+	}
+
+	if (_pass_end>begin) {
+		_tiles = _tiles_all;
+	} else {
+		_pass_end = begin;
+		_tiles.clear();
+	}
+}
+std::pair<uint32_t,uint32_t> Renderer::_get_count_range() const {
+	std::pair<uint32_t,uint32_t> result = { ~0u, 0u };
+	Framebuffer::Tile const& crop = options.crop;
+	for (size_t j=crop.pos[1];j<crop.pos[1]+crop.res[1];++j) {
+		for (size_t i=crop.pos[0];i<crop.pos[0]+crop.res[0];++i) {
+			uint32_t count = _pixel_counts[ j*options.res[0] + i ];
+			result.first  = std::min( result.first,  count );
+			result.second = std::max( result.second, count );
+		}
+	}
+	return result;
+}
+std::vector<std::pair<std::string,std::string>> Renderer::_get_metadata() const {
+	//Sample count; a range if the render was stopped partway through a pass
+	std::pair<uint32_t,uint32_t> range = _get_count_range();
+	std::string samples = std::to_string(range.first);
+	if (range.second!=range.first) samples+="-"+std::to_string(range.second);
+
+	double time_since_start = static_cast<double>(
+		std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now()-_time_start).count()
+	) * 1.0e-9;
+
+	return _get_metadata( samples, time_since_start );
+}
+std::vector<std::pair<std::string,std::string>> Renderer::_get_metadata(std::string const& samples, double time) const {
+	char render_time[32];
+	snprintf(render_time,sizeof(render_time),"%.3f s",time);
+
+	return {
+		{ "Scene",           options.scene_name },
+		{ "SamplesPerPixel", samples            },
+		{ "RenderTime",      render_time        }
+	};
+}
+std::vector<Framebuffer::Aov> Renderer::_get_aovs(uint32_t const* counts, glm::dvec3 const* moments) const {
+	std::vector<Framebuffer::Aov> aovs;
+	if (options.exr_aovs); else return aovs;
+
+	//	The variance of a pixel's value (the mean of its samples) is that of its samples divided by
+	//		their count.  The samples' variance is estimated (without bias) from those whose moments
+	//		were kept, if there are at least two.
+	size_t num_pixels = options.res[0] * options.res[1];
+	Framebuffer::Aov variance = { "variance", options.exr.type,  std::vector<float>(num_pixels,0.0f) };
+	Framebuffer::Aov samples  = { "samples",  EXR::TYPE::UINT, std::vector<float>(num_pixels,0.0f) };
+	for (size_t k=0;k<num_pixels;++k) {
+		samples.values[k] = static_cast<float>(counts[k]);
+
+		glm::dvec3 const& moment = moments[k];
+		if (moment[0]>=2.0) {
+			double mean = moment[1] / moment[0];
+			double variance_samples = std::max( (moment[2]-moment[1]*mean)/(moment[0]-1.0), 0.0 );
+			variance.values[k] = static_cast<float>( variance_samples / static_cast<double>(counts[k]) );
+		}
+	}
+	aovs.push_back(std::move(variance));
+	aovs.push_back(std::move(samples ));
+	return aovs;
+}
+void Renderer::_save_output(ThreadPool* pool) const {
+	Trace::Scope trace_scope("save output");
+	if (Str::endswith(options.output_path,".partial")) {
+		Checkpoint::save( options.output_path, options, _pixel_sums,_pixel_counts );
+	} else {
+		framebuffer.save(
+			options.output_path, _get_metadata(),
+			options.exr, _get_aovs( _pixel_counts, _pixel_moments ), pool
+		);
+	}
+}
+void Renderer::_save_stats() const {
+	//Merge the threads' counters
+	_Stats total(_materials.size());
+	for (_Stats const& stats : _stats_threads) total+=stats;
+
+	double render_time = static_cast<double>(
+		std::chrono::duration_cast<std::chrono::nanoseconds>(_time_end-_time_start).count()
+	) * 1.0e-9;
+	uint64_t num_rays = total.num_rays_camera + total.num_rays_indirect + total.num_rays_shadow;
+
+	std::ofstream file(options.stats_path);
+	if (file.is_open()); else {
+		fprintf(stderr,"Could not open statistics file \"%s\" for writing!\n",options.stats_path.c_str());
+		return;
+	}
+	file << "{\n";
+	file << "\t\"scene\": \"" << Str::json_escape(options.scene_name) << "\",\n";
+	file << "\t\"completed\": " << (_render_completed?"true":"false") << ",\n";
+	file << "\t\"threads\": " << _stats_threads.size() << ",\n";
+	file << "\t\"render_time\": " << render_time << ",\n";
+	file << "\t\"samples\": " << total.num_rays_camera << ",\n";
+	file << "\t\"samples_per_second\": " << static_cast<double>(total.num_rays_camera)/render_time << ",\n";
+	file << "\t\"rays\": {\n";
+	file << "\t\t\"camera\": "     << total.num_rays_camera   << ",\n";
+	file << "\t\t\"indirect\": "   << total.num_rays_indirect << ",\n";
+	file << "\t\t\"shadow\": "     << total.num_rays_shadow   << ",\n";
+	file << "\t\t\"per_second\": " << static_cast<double>(num_rays)/render_time << "\n";
+	file << "\t},\n";
+	file << "\t\"primitive_tests\": " << total.num_prim_tests << ",\n";
+	//	Index is the number of surfaces hit (zero for camera rays that miss everything)
+	file << "\t\"path_lengths\": [";
+	for (size_t k=0;k<=MAX_DEPTH;++k) file << (k>0?", ":" ") << total.path_lengths[k];
+	file << " ],\n";
+	file << "\t\"shading_calls\": {\n";
+	{
+		size_t k = 0;
+		for (auto const& iter : scene->materials) {
+			file << "\t\t\"" << Str::json_escape(iter.first) << "\": " << total.num_shading_calls[k];
+			file << (++k<_materials.size()?",\n":"\n");
+		}
+	}
+	file << "\t},\n";
+	file << "\t\"tiles\": {\n";
+	file << "\t\t\"count\": "      << total.num_tiles       << ",\n";
+	file << "\t\t\"time_total\": " << total.tile_time_total << ",\n";
+	file << "\t\t\"time_mean\": "  << (total.num_tiles>0 ? total.tile_time_total/static_cast<double>(total.num_tiles) : 0.0) << ",\n";
+	file << "\t\t\"time_max\": "   << total.tile_time_max   << "\n";
+	file << "\t},\n";
+	//	Per thread, to show how evenly the work was spread
+	if (options.perf_counters) {
+		//	Absent if unavailable
+		bool available = _perf_save_available;
+		for (_Stats const& stats : _stats_threads) available&=stats.perf_available;
+		file << "\t\"hardware_counters\": ";
+		if (available) {
+			std::pair<char const*,PerfCounters::Values const*> phases[3] = {
+				{ "render", &total.perf_render }, { "resolve", &total.perf_resolve }, { "save", &_perf_save }
+			};
+			file << "{\n";
+			for (size_t k=0;k<3;++k) {
+				PerfCounters::Values const& values = *phases[k].second;
+				file << "\t\t\"" << phases[k].first << "\": { ";
+				for (size_t l=0;l<PerfCounters::NUM_EVENTS;++l) {
+					file << "\"" << PerfCounters::event_names[l] << "\": " << values.counts[l] << ", ";
+				}
+				file << "\"time\": " << values.time << " }" << (k<2?",\n":"\n");
+			}
+			file << "\t},\n";
+		} else {
+			file << "null,\n";
+		}
+	}
+	file << "\t\"per_thread\": [\n";
+	for (size_t k=0;k<_stats_threads.size();++k) {
+		_Stats const& stats = _stats_threads[k];
+		file << "\t\t{ \"samples\": " << stats.num_rays_camera << ", \"tiles\": " << stats.num_tiles;
+		file << ", \"busy_time\": " << stats.tile_time_total << " }";
+		file << (k+1<_stats_threads.size()?",\n":"\n");
+	}
+	file << "\t]\n";
+	file << "}\n";
+}
+void Renderer::_save_cost(ThreadPool* pool) const {
+	//Cost of each pixel, as microseconds per sample (zero for pixels without samples)
+	std::vector<float> costs( options.res[0]*options.res[1], 0.0f );
+	for (size_t k=0;k<costs.size();++k) {
+		if (_pixel_cost_counts[k]>0u) costs[k]=_pixel_costs[k]*1.0e6f/static_cast<float>(_pixel_cost_counts[k]);
+	}
+
+	//Save as a (single-channel) PFM image.  See `Framebuffer::save(...)` for the row order.
+	{
+		std::string path = options.cost_path + ".pfm";
+		FILE* file = fopen(path.c_str(),"wb");
+		if (file!=nullptr); else {
+			fprintf(stderr,"Could not open cost map \"%s\" for writing!\n",path.c_str());
+			return;
+		}
+		fprintf(file,
+			"Pf\n"
+			"%zu %zu\n"
+			"-1.0\n",
+			options.res[0], options.res[1]
+		);
+		for (size_t j=0;j<options.res[1];++j) {
+			fwrite( costs.data()+(options.res[1]-1-j)*options.res[0], sizeof(float),options.res[0], file );
+		}
+		fclose(file);
+	}
 
+	//Save color-mapped as a PNG image.  The top of the color map is the 99th percentile of the costs,
+	//	so that a few outliers (e.g. the very first samples, with cold caches) don't wash it out.
+	{
+		std::vector<float> sorted;
+		for (size_t k=0;k<costs.size();++k) if (_pixel_cost_counts[k]>0u) sorted.push_back(costs[k]);
+		float scale = 0.0f;
+		if (!sorted.empty()) {
+			std::vector<float>::iterator iter = sorted.begin() + static_cast<ptrdiff_t>( (sorted.size()-1)*99/100 );
+			std::nth_element( sorted.begin(), iter, sorted.end() );
+			scale = *iter;
+		}
+
+		//	"Turbo" color map, by its polynomial approximation
+		auto get_color = [](float t) -> sRGB_F32 {
+			return glm::clamp( sRGB_F32(
+				0.13572138f + t*(  4.61539260f + t*( -42.66032258f + t*( 132.13108234f + t*(-152.94239396f + t*59.28637943f)))),
+				0.09140261f + t*(  2.19418839f + t*(   4.84296658f + t*( -14.18503333f + t*(   4.27729857f + t* 2.82956604f)))),
+				0.10667330f + t*( 12.64194608f + t*( -60.58204836f + t*( 110.36276771f + t*( -89.90310912f + t*27.34824973f))))
+			), sRGB_F32(0.0f),sRGB_F32(1.0f) );
+		};
+
+		Framebuffer heatmap(options.res);
+		for (size_t j=0;j<options.res[1];++j) {
+			for (size_t i=0;i<options.res[0];++i) {
+				size_t k = j*options.res[0] + i;
+				if (_pixel_cost_counts[k]>0u) {
+					float t = scale>0.0f ? std::min( costs[k]/scale, 1.0f ) : 0.0f;
+					heatmap(i,j) = lRGB_A_F32( Color::srgb_to_lrgb(get_color(t)), 1.0f );
+				} else {
+					heatmap(i,j) = lRGB_A_F32( 0.0f,0.0f,0.0f, 1.0f );
+				}
+			}
+		}
+		char scale_str[32];
+		snprintf(scale_str,sizeof(scale_str),"%g us/sample",static_cast<double>(scale));
+		heatmap.save( options.cost_path+".png", {
+			{ "Scene",    options.scene_name },
+			{ "CostScale", scale_str         }
+		}, {}, {}, pool );
+	}
+}
+void Renderer::write_checkpoint() {
+	Trace::Scope trace_scope("write checkpoint");
+	if (Checkpoint::save( options.checkpoint_path, options, _pixel_sums,_pixel_counts )) {
+		_checkpoint_written = true;
+	}
+	_time_last_checkpoint = std::chrono::steady_clock::now();
+}
+void Renderer::_print_perf_counters() const {
+	bool available = _perf_save_available;
+	_Stats total(_materials.size());
+	for (_Stats const& stats : _stats_threads) {
+		total += stats;
+		available &= stats.perf_available;
+	}
+	if (available); else {
+		printf("Hardware performance counters are unavailable (see \"/proc/sys/kernel/perf_event_paranoid\").\n");
+		return;
+	}
+
+	//	Counts over all threads.  The "bandwidth" is only that of last-level cache misses (assuming
+	//		64-byte lines), per second of each thread's time in the phase.
+	printf("Hardware performance counters (user-space, all threads):\n");
+	printf("  phase          cycles    instructions   IPC   LLC miss   branch miss   LLC miss GB/s\n");
+	auto print_phase = [](char const* name, PerfCounters::Values const& values) -> void {
+		auto ratio = [](uint64_t num, uint64_t den) -> double {
+			return den>0 ? static_cast<double>(num)/static_cast<double>(den) : 0.0;
+		};
+		printf(
+			"  %-8s %14llu  %14llu  %5.2f  %8.2f%%  %11.2f%%  %14.3f\n", name,
+			static_cast<unsigned long long>(values.counts[PerfCounters::CYCLES      ]),
+			static_cast<unsigned long long>(values.counts[PerfCounters::INSTRUCTIONS]),
+			ratio( values.counts[PerfCounters::INSTRUCTIONS ], values.counts[PerfCounters::CYCLES          ] ),
+			ratio( values.counts[PerfCounters::CACHE_MISSES ], values.counts[PerfCounters::CACHE_REFERENCES] ) * 100.0,
+			ratio( values.counts[PerfCounters::BRANCH_MISSES], values.counts[PerfCounters::BRANCHES        ] ) * 100.0,
+			values.time>0.0 ? static_cast<double>(values.counts[PerfCounters::CACHE_MISSES])*64.0/values.time*1.0e-9 : 0.0
+		);
+	};
+	print_phase( "render",  total.perf_render  );
+	print_phase( "resolve", total.perf_resolve );
+	print_phase( "save",    _perf_save         );
+}
+void Renderer::save_result(bool completed, ThreadPool* pool/*=nullptr*/) {
+	//	Measure the save itself, if requested, including any threads it creates to encode images.
+	PerfCounters perf( options.perf_counters, true );
+	PerfCounters::Values perf_begin;
+	perf.read(&perf_begin);
+
+	ThreadPool* own_pool = nullptr;
+	if (pool==nullptr && _pool==nullptr) pool=own_pool=new ThreadPool(_threads.size());
+
+	if (completed) {
+		_save_output(pool);
+
+		//	The checkpoint is superseded by the image.
+		if (_checkpoint_written || options.resume_path==options.checkpoint_path) {
+			remove(options.checkpoint_path.c_str());
+		}
+	} else {
+		write_checkpoint();
+
+		_save_output(pool);
+	}
+	if (!options.cost_path.empty()) _save_cost(pool);
+
+	//	(Inherited counters include threads once they've exited.)
+	delete own_pool;
+	_perf_save_available = perf.is_available();
+	perf.read(&_perf_save);
+	_perf_save = _perf_save - perf_begin;
+
+	if (!options.stats_path.empty()) _save_stats();
+	if (options.perf_counters) _print_perf_counters();
+
+	if (!options.trace_path.empty()) Trace::save(options.trace_path);
+}
+SamplerBase* Renderer::create_sampler() const {
+	switch (options.sampler) {
+		case SamplerBase::TYPE::RANDOM: return new SamplerRandom(options.spp,options.seed            );
+		case SamplerBase::TYPE::SOBOL:  return new SamplerSobol (options.spp,options.seed            );
+		case SamplerBase::TYPE::PMJ02:  return new SamplerPMJ02 (options.spp,options.seed,_pmj02_sets);
+		default: assert(false); return nullptr;
+	}
+}
+void Renderer::render_region(SamplerBase& sampler, Framebuffer::Tile const& region) {
+	//	Statistics are not kept for parts of the image rendered this way.
+	_Stats stats(_materials.size());
+
+	for (size_t j=region.pos[1];j<region.pos[1]+region.res[1];++j) {
+		for (size_t i=region.pos[0];i<region.pos[0]+region.res[0];++i) {
+			_pixel_sums  [ j*options.res[0] + i ] = PixelSum(0);
+			_pixel_counts[ j*options.res[0] + i ] = 0u;
+			if (_pixel_moments!=nullptr) _pixel_moments[ j*options.res[0] + i ]=glm::dvec3(0.0);
+		}
+	}
+	for (size_t begin=0; begin<options.spp; begin=_get_pass_end(begin)) {
+		size_t end = _get_pass_end(begin);
+		for (size_t j=region.pos[1];j<region.pos[1]+region.res[1];++j) {
+			for (size_t i=region.pos[0];i<region.pos[0]+region.res[0];++i) {
+				_render_pixel(sampler,stats, i,j, end);
+			}
+		}
+	}
+	_resolve_tile(region);
+}
+void Renderer::get_region(Framebuffer::Tile const& region, PixelSum*       sums,uint32_t*       counts) const {
+	for (size_t j=0;j<region.res[1];++j) {
+		size_t src = (region.pos[1]+j)*options.res[0] + region.pos[0];
+		std::copy_n( _pixel_sums  +src, region.res[0], sums  +j*region.res[0] );
+		std::copy_n( _pixel_counts+src, region.res[0], counts+j*region.res[0] );
+	}
+}
+void Renderer::set_region(Framebuffer::Tile const& region, PixelSum const* sums,uint32_t const* counts) {
+	for (size_t j=0;j<region.res[1];++j) {
+		size_t dst = (region.pos[1]+j)*options.res[0] + region.pos[0];
+		std::copy_n( sums  +j*region.res[0], region.res[0], _pixel_sums  +dst );
+		std::copy_n( counts+j*region.res[0], region.res[0], _pixel_counts+dst );
+		for (size_t i=0;i<region.res[0];++i) {
+			if (counts[j*region.res[0]+i]>0u) _resolve_pixel( region.pos[0]+i, region.pos[1]+j );
+		}
+	}
+}
+void Renderer::_render_threadwork() {
 	/*
-	Random number generator for each thread.  Note that this must be per-thread data; making it
-	threadsafe and shared would be too slow, and making it simply shared (which is, unfortunately,
-	what many simplistic implementations do with e.g. `rand()`) risks producing bogus results due to
-	race conditions.
+	Sampler (source of random numbers) for each thread.  Note that this must be per-thread data;
+	making it threadsafe and shared would be too slow, and making it simply shared (which is,
+	unfortunately, what many simplistic implementations do with e.g. `rand()`) risks producing bogus
+	results due to race conditions.
 
 	There are several ways to make thread local variables (such as e.g. C++ `thread_local`), but
 	just making a local variable in the thread function is probably the clearest, if not the
 	cleanest.
+
+	The sampler's values depend only on the pixel, sample, and dimension (and seed), so which thread
+	renders which pixel does not affect the result.
 	*/
-	Math::RNG rng;
-	/*
-	Seed the RNG with some kind of data.  Since many RNGs will produce similar starting sequences
-	given similar seeds, and it is desirable for different threads to have different sequences, it
-	is desirable for seeds to vary substantially between threads.
-
-	A simple way to do this is to scramble the thread's index with a hash function, though on some
-	platforms `std::hash` is the identity so we have to implement this ourselves to ensure it
-	actually works.  Passing zero for the seed is also not allowed, so we choose `1` if that's the
-	case.  Note that that potential increment comes after the hashing, so it is not particularly
-	likely to result in two threads receiving the same seed.
-	*/
-	size_t seed = get_hashed(thread_index);
-	if (seed==0) ++seed;
-	rng.seed(static_cast<Math::RNG::result_type>(seed));
+	Trace::name_thread("render");
+	SamplerBase* sampler = create_sampler();
+	//	Likewise the counters of the work done, which are collected as the thread finishes.
+	_Stats stats(_materials.size());
+	PerfCounters perf(options.perf_counters);
+	stats.perf_available = perf.is_available();
 
 	//Main render thread loop
+	std::unique_lock<std::mutex> lock(_tiles_mutex);
 	while (_render_continue) {
-		//Atomically pull the next tile of un-rendered pixels off the list of un-rendered tiles.  If
-		//	there are none, terminate the loop.  Also print the progress (inside the mutex so that
-		//	it's threadsafe) every 10ms.
-
-		Framebuffer::Tile tile;
-
-		std::chrono::steady_clock::time_point time_now = std::chrono::steady_clock::now();
-
-		_tiles_mutex.lock();
-
+		//Pull the next tile of un-rendered pixels off the list of un-rendered tiles (the mutex is
+		//	held here).  Also print the progress (inside the mutex so that it's threadsafe) every
+		//	10ms.
 		if (!_tiles.empty()) {
+			std::chrono::steady_clock::time_point time_now = std::chrono::steady_clock::now();
 			float time_since_last_print = static_cast<float>(
 				std::chrono::duration_cast<std::chrono::nanoseconds>(time_now-_time_last_print).count()
 			) * 1.0e-9f;
@@ -352,74 +1140,140 @@ void Renderer::_render_threadwork() {
 				_time_last_print = time_now;
 			}
 
-			tile = _tiles.back();
+			Framebuffer::Tile tile = _tiles.back();
 			_tiles.pop_back();
+			size_t end = _pass_end;
+			++_num_busy;
 
-			_tiles_mutex.unlock();
-		} else {
-			_tiles_mutex.unlock();
-
-			//	Minor optimization
-			_render_continue = false;
+			lock.unlock();
 
-			break;
-		}
+			//Render each pixel of the tile, and then update them in the framebuffer
+			std::chrono::steady_clock::time_point time_tile = std::chrono::steady_clock::now();
+			PerfCounters::Values perf_begin, perf_rendered, perf_resolved;
+			perf.read(&perf_begin);
+			{
+				Trace::Scope trace_scope( "tile",
+					{ "x", static_cast<int64_t>(tile.pos[0]) },
+					{ "y", static_cast<int64_t>(tile.pos[1]) },
+					{ "spp", static_cast<int64_t>(end) }
+				);
+				for (size_t j=tile.pos[1];j<tile.pos[1]+tile.res[1];++j) {
+					for (size_t i=tile.pos[0];i<tile.pos[0]+tile.res[0];++i) {
+						_render_pixel(*sampler,stats, i,j, end);
+					}
+				}
+			}
+			perf.read(&perf_rendered);
+			_resolve_tile(tile);
+			perf.read(&perf_resolved);
+			stats.perf_render  += perf_rendered - perf_begin;
+			stats.perf_resolve += perf_resolved - perf_rendered;
+			double tile_time = static_cast<double>(
+				std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now()-time_tile).count()
+			) * 1.0e-9;
+			++stats.num_tiles;
+			stats.tile_time_total += tile_time;
+			stats.tile_time_max = std::max( stats.tile_time_max, tile_time );
+			if (tile_callback) tile_callback( tile, end );
 
-		//Render each pixel of the tile
-		for (size_t j=tile.pos[1];j<tile.pos[1]+tile.res[1];++j) {
-			for (size_t i=tile.pos[0];i<tile.pos[0]+tile.res[0];++i) {
-				_render_pixel(rng, i,j);
+			lock.lock();
+			--_num_busy;
+		} else if (_num_busy>0) {
+			//Other threads are still finishing the pass.  Wait for the next one.
+			Trace::Scope trace_scope("wait for pass");
+			_pass_cv.wait(lock);
+		} else if (_pass_end<options.spp && _pass_end>_pass_begin) {
+			//The pass is complete, and no thread is rendering.  Write a checkpoint if it's due, and
+			//	start the next pass (if there's time for it).
+			if (options.checkpoint_interval>0) {
+				std::chrono::steady_clock::time_point time_now = std::chrono::steady_clock::now();
+				if (time_now-_time_last_checkpoint >= std::chrono::seconds(options.checkpoint_interval)) {
+					write_checkpoint();
+				}
+			}
+			_take_snapshot();
+			if (_convergence!=nullptr) _record_convergence(false);
+			_start_pass(_pass_end);
+			_pass_cv.notify_all();
+		} else {
+			//The final pass is complete (or there's no time for another, in which case the last pass,
+			//	ending at `_pass_end`, was finished above; but its measurement might not have been
+			//	due, and the last one must be of the final image).
+			if (_pass_end>_pass_begin) _take_snapshot();
+			if (_convergence!=nullptr && _pass_end>_spp_start && _pass_end!=_convergence_spp) {
+				_record_convergence(true);
 			}
+			_render_completed = true;
+			_render_continue = false;
+			_pass_cv.notify_all();
 		}
 	}
+	_stats_threads.push_back(stats);
+	_time_end = std::chrono::steady_clock::now();
+	lock.unlock();
+
+	delete sampler;
 
 	//Remove ourself from the count of rendering threads
 	assert(_num_rendering>0u);
-	--_num_rendering;
+	uint32_t num_rendering = --_num_rendering;
 
 	//If we're the last thread to finish, no threads can be touching the image anymore.  We are
-	//	responsible for removing any un-rendered tiles (such as if the render was aborted) and
-	//	saving the image to disk.
-	if (_num_rendering==0u) {
-		_tiles.clear();
-
-		_print_progress();
-
-		framebuffer.save(options.output_path);
+	//	responsible for saving the image to disk, and if the render was stopped early, also a
+	//	checkpoint to resume it from.
+	if (num_rendering==0u) {
+		if (_render_completed) {
+			_print_progress();
+		} else {
+			if (options.checkpoint_path.empty()) printf("\nRender stopped.\n");
+			else printf("\nRender stopped; writing checkpoint \"%s\" and partial image.\n",options.checkpoint_path.c_str());
+		}
+		if (_pool==nullptr) save_result(_render_completed);
 	}
 }
 void Renderer::render_start() {
-	//Create the list of tiles of un-rendered pixels
-	assert(_tiles.empty());
-	for (size_t j=0;j<options.res[1];j+=TILE_SIZE) {
-		for (size_t i=0;i<options.res[0];i+=TILE_SIZE) {
-			_tiles.push_back({
-				{ i, j },
-				{ std::min(options.res[0]-i,TILE_SIZE), std::min(options.res[1]-j,TILE_SIZE) }
-			});
-		}
-	}
-	//	Rearrange so that the lower tiles are at the end of the list (and thereby are pulled off and
-	//		rendered first).
-	std::reverse(_tiles.begin(),_tiles.end());
+	_num_busy = 0;
+	_render_completed = false;
+	_checkpoint_written = false;
 
 	//Starting information for timing
-	_num_tiles_start = _tiles.size();
-	_time_start      = std::chrono::steady_clock::now();
-	_time_last_print = _time_start - std::chrono::seconds(1);
+	_spp_start            = _get_count_range().first;
+	_time_start           = std::chrono::steady_clock::now();
+	_time_last_print      = _time_start - std::chrono::seconds(1);
+	_time_last_checkpoint = _time_start;
+	_time_next_convergence = 0.0;
+	_convergence_spp       = 0;
+	_stats_threads.clear();
+
+	//Start from the pass containing the pixel with the fewest samples (which are all, unless
+	//	resuming from a checkpoint).
+	_start_pass(_spp_start);
 
 	//Create render threads (which also starts them working)
-	_num_rendering = 0u;
+	_num_rendering = static_cast<uint32_t>( _pool!=nullptr ? _pool_tasks.size() : _threads.size() );
 	_render_continue = true;
-	for (std::thread*& thread : _threads) {
-		thread = new std::thread( &Renderer::_render_threadwork, this );
+	if (_pool!=nullptr) {
+		for (std::future<void>& task : _pool_tasks) {
+			task = _pool->submit([this]() -> void { _render_threadwork(); });
+		}
+	} else {
+		for (std::thread*& thread : _threads) {
+			thread = new std::thread( &Renderer::_render_threadwork, this );
+		}
 	}
 }
+void Renderer::render_stop () {
+	//	Note the lock, so that threads waiting for the next pass can't miss the notification.
+	std::lock_guard<std::mutex> lock(_tiles_mutex);
+	_render_continue = false;
+	_pass_cv.notify_all();
+}
 void Renderer::render_wait () {
 	//Wait for each render thread to terminate and clean up
 	for (std::thread* thread : _threads) {
 		thread->join();
 		delete thread;
 	}
+	for (std::future<void>& task : _pool_tasks) task.wait();
 	assert(_num_rendering==0u);
 }
@@ -2,26 +2,129 @@
 
 #include "stdafx.hpp"
 
-#include "util/random.hpp"
+#include "sampler.hpp"
+
+#include "util/perf-counters.hpp"
 
 #include "framebuffer.hpp"
+#include "scene.hpp"
+#include "spectrum.hpp"
 
 
 
-class Scene;
+class Convergence;
+class ThreadPool;
 
 class Renderer final {
 	public:
+		//Sum of a pixel's samples.  Note this must be 64-bit to have adequate precision for high
+		//	sample counts.
+		#ifdef RENDER_MODE_SPECTRAL
+		typedef CIEXYZ_A_64F PixelSum;
+		#else
+		typedef lRGB_A_F64   PixelSum;
+		#endif
+
 		//Render options
 		class Options final { public:
 			std::string scene_name;
 
 			size_t res[2]; //Resolution of image
-			size_t spp;    //Samples per pixel
+
+			//Region of the image to render (in framebuffer coordinates, so from the bottom left).
+			//	Usually the whole image, but a render split across machines gives each a part.
+			Framebuffer::Tile crop;
+			size_t spp;    //Samples per pixel (the maximum, if there is a time limit)
+
+			//Wall-clock time (in seconds) after which no more passes are started, or zero for no
+			//	limit.  Passes are never cut short, so every pixel ends with the same sample count.
+			size_t time_limit;
+
+			//Overrides for the scene's camera: position, view direction, up direction, and
+			//	vertical field of view (°).  Those that are NaN keep the scene's.
+			Pos   camera_pos;
+			Dir   camera_dir;
+			Dir   camera_up;
+			float camera_vfov_deg;
 
 			bool indirect_only; //Whether only indirect illumination should be rendered
 
+			//How paths find light sources.  Either only by sampling the BSDF and hoping to hit one
+			//	(`NONE`), by sampling the lights explicitly for direct lighting (`EXPLICIT`), or by
+			//	doing both and combining them with multiple importance sampling (`MIS`).  The latter
+			//	converges well on all scenes, while the others are each good only on some.
+			enum class LIGHT_SAMPLING { NONE, EXPLICIT, MIS } light_sampling;
+
+			//Where the samples' random numbers come from, and the seed for them.  The image depends
+			//	only on these (and the other options), not on the number of threads.
+			SamplerBase::TYPE sampler;
+			uint32_t seed;
+
+			//Number of worker threads (zero for one per hardware thread)
+			size_t num_threads;
+
+			#ifdef RENDER_MODE_SPECTRAL
+			//How hero wavelengths are importance-sampled: uniformly (`UNIFORM`), proportional to the
+			//	observer's luminance response "ȳ" (`Y`) or total response "x̄+ȳ+z̄" (`XYZ`), or
+			//	proportional to the total response times the scene's light sources' emission
+			//	(`XYZ_EMITTERS`).
+			enum class WAVELENGTH_SAMPLING { UNIFORM, Y, XYZ, XYZ_EMITTERS } wavelength_sampling;
+			#endif
+
+			//Where the image is saved.  If it ends with ".partial", a partial image (i.e., a
+			//	checkpoint) is saved instead, for merging with others (see `Checkpoint::merge(...)`).
 			std::string output_path;
+			//	How it's stored, if it's an EXR image, and whether it has extra channels: the
+			//		variance of each pixel's luminance (of the mean of its samples, estimated from
+			//		their spread), and its sample count.
+			EXR::Settings exr;
+			bool exr_aovs;
+
+			//Where the framebuffer is kept, if it's not in memory (for images too large for it): a
+			//	TIFF image (see `Framebuffer`), which tiles are written to as they're rendered and
+			//	which can be read at any time.  The accumulation buffer is then kept in a temporary
+			//	file too ("<path>.accumulation", deleted right away where the OS allows it), so only
+			//	the pixels being rendered need be in memory.
+			std::string out_of_core_path;
+
+			//Where checkpoints (the render's progress, from which it can be resumed) are written,
+			//	and how often (in seconds; zero to write them only when the render is stopped early).
+			//	Also, the checkpoint to resume from, if any.
+			std::string checkpoint_path;
+			size_t checkpoint_interval;
+			std::string resume_path;
+
+			//Sample counts at which the image is also saved (in ascending order), as it is then.
+			//	Each is saved to `output_path` with "-<samples>spp" before the extension, by a
+			//	background thread, from a copy of the accumulation buffer.  Passes end at these.
+			std::vector<size_t> snapshots;
+
+			//Where statistics of the render (rays cast, intersection tests, path lengths, shading
+			//	calls per material, and timings) are saved as JSON, if anywhere.
+			std::string stats_path;
+
+			//Where the cost of each pixel (the time its samples took) is saved, if anywhere: as
+			//	microseconds per sample in "<path>.pfm", and color-mapped in "<path>.png".
+			std::string cost_path;
+
+			//Whether to measure hardware performance counters (cycles, instructions, cache and
+			//	branch misses) of each phase (rendering tiles, resolving pixels, and saving).  They
+			//	are printed at the end, and saved with the statistics (see `stats_path`).
+			bool perf_counters;
+
+			//Where the render's convergence is recorded, if anywhere: its error against the reference
+			//	image `convergence_reference` (a PFM), as CSV rows of the render time, samples per
+			//	pixel, and RMSE, relMSE, and FLIP errors.  A row is written at the end of the first
+			//	pass after each `convergence_interval` (s) of rendering, and passes are of one sample
+			//	per pixel.  The time spent measuring is not counted as rendering.
+			std::string convergence_path;
+			std::string convergence_reference;
+			float convergence_interval;
+
+			//Where a timeline of the render's phases and each thread's tiles is saved (in the
+			//	Chrome trace-event format), if anywhere.  Recording must be enabled beforehand with
+			//	`Trace::enable()`.
+			std::string trace_path;
 
 			#ifdef SUPPORT_WINDOWED
 			bool open_window;
@@ -32,51 +135,247 @@ class Renderer final {
 		Framebuffer framebuffer;
 
 		Scene* scene;
+		//The scene's camera, with `options`' overrides applied
+		Scene::Camera camera;
 
 	private:
-		//Concurrent list of pixel tiles in the framebuffer that remain to be rendered
+		//Counters of the work a thread does, for `Options::stats_path`.  Each thread counts into its
+		//	own, so the hot path needs no synchronization, and they are collected as threads finish.
+		class _Stats final { public:
+			//Rays cast: from the camera, continuing paths, and toward lights
+			uint64_t num_rays_camera;
+			uint64_t num_rays_indirect;
+			uint64_t num_rays_shadow;
+			//Ray-primitive intersection tests.  There is no acceleration structure, so each ray
+			//	tests every primitive.
+			uint64_t num_prim_tests;
+			//Number of paths of each length (surfaces hit, up to `MAX_DEPTH`)
+			uint64_t path_lengths[MAX_DEPTH+1u];
+			//BSDF samples and evaluations for each material (in the order of `_materials`)
+			std::vector<uint64_t> num_shading_calls;
+			//Tiles rendered, and the total and longest time (s) for one
+			uint64_t num_tiles;
+			double tile_time_total;
+			double tile_time_max;
+			//Hardware performance counters (if `Options::perf_counters`) while rendering tiles'
+			//	samples, and resolving their pixels
+			bool perf_available;
+			PerfCounters::Values perf_render;
+			PerfCounters::Values perf_resolve;
+
+			explicit _Stats(size_t num_materials);
+
+			_Stats& operator+=(_Stats const& other);
+		};
+
+		//Whether `scene` is the renderer's own (i.e., was not given to it)
+		bool _owns_scene;
+
+		//The scene's materials (in the order of `Scene::materials`), for counting shading calls
+		std::vector<MaterialBase const*> _materials;
+
+		//Point sets shared by the threads' samplers, if using `SamplerBase::TYPE::PMJ02`
+		SamplerPMJ02::Sets* _pmj02_sets;
+
+		#ifdef RENDER_MODE_SPECTRAL
+		//Distribution hero wavelengths are drawn from
+		HeroWavelengthDistribution* _lambda_0_distr;
+		#endif
+
+		//Linear accumulation buffer: for each pixel, the sum of its samples so far and their count.
+		//	Each pixel has taken samples [0,count), and so continues from sample `count`.
+		PixelSum* _pixel_sums;
+		uint32_t* _pixel_counts;
+		//	Also, if `Options::cost_path`, the time (s) each pixel's samples took, and how many samples
+		//		that was (only those taken by this renderer, not ones resumed from a checkpoint; or
+		//		null).
+		float*    _pixel_costs;
+		uint32_t* _pixel_cost_counts;
+		//	Also, if `Options::exr_aovs`, the count, sum, and sum of squares of the luminance of each
+		//		pixel's samples (again only those taken by this renderer), for its variance (or null).
+		glm::dvec3* _pixel_moments;
+		//	The buffers share one allocation, in memory or (if `Options::out_of_core_path`) in a
+		//		temporary file, which the OS pages in and out as they're used.
+		uint8_t* _accumulation;
+		MappedFile* _accumulation_file;
+
+		//Tiles covering the crop region
+		std::vector<Framebuffer::Tile> _tiles_all;
+
+		//Concurrent list of pixel tiles in the framebuffer that remain to be rendered in the current
+		//	pass, and the number of threads still rendering one.  Every pixel is brought up to
+		//	`_pass_end` samples in the pass.  When the pass is complete, the thread that notices
+		//	starts the next one (writing a checkpoint first, if it's due) while the others wait.
 		std::mutex _tiles_mutex;
+		std::condition_variable _pass_cv;
 		std::vector<Framebuffer::Tile> _tiles;
+		size_t _num_busy;
+		size_t _pass_begin;
+		size_t _pass_end;
 
-		//Worker threads
+		//Whether all samples have been taken
+		bool _render_completed;
+
+		//When the last checkpoint was written, and whether one has been written
+		std::chrono::steady_clock::time_point _time_last_checkpoint;
+		bool _checkpoint_written;
+
+		//Worker threads, or if rendering on a pool, the tasks running on it
+		ThreadPool* _pool;
 		std::vector<std::thread*> _threads;
+		std::vector<std::future<void>> _pool_tasks;
 		//Number of threads currently rendering
 		std::atomic<uint32_t> _num_rendering;
 
 		//Internal data used for calculating statistics
-		size_t _num_tiles_start;
+		size_t _spp_start;
 		std::chrono::steady_clock::time_point _time_start;
 		std::chrono::steady_clock::time_point _time_last_print;
+		std::chrono::steady_clock::time_point _time_end;
+		//	Counters of each thread that has finished rendering, and hardware performance counters
+		//		of the last save (its thread's, and those of any threads it created to encode the
+		//		images)
+		std::vector<_Stats> _stats_threads;
+		bool _perf_save_available;
+		PerfCounters::Values _perf_save;
+
+		//Copies of the accumulation buffer to be saved as snapshots (see `Options::snapshots`), and
+		//	the thread that saves them (if there are any snapshots).  It runs until the renderer is
+		//	destroyed, which waits for it to save any snapshots remaining.
+		class _Snapshot final { public:
+			size_t spp;
+			double time;
+			std::vector<PixelSum> sums;
+			std::vector<uint32_t> counts;
+			std::vector<glm::dvec3> moments;
+		};
+		std::mutex _snapshots_mutex;
+		std::condition_variable _snapshots_cv;
+		std::deque<_Snapshot*> _snapshots;
+		bool _snapshots_done;
+		std::thread* _snapshot_writer;
+
+		//Measurement of convergence (if `Options::convergence_path`), the render time (s) after
+		//	which the next is due, and the sample count of the last
+		Convergence* _convergence;
+		double _time_next_convergence;
+		size_t _convergence_spp;
 
 		//Whether the render should continue
 		bool volatile _render_continue;
 
 	public:
-		explicit Renderer(Options const& options);
+		//Set up a render.  If `pool` is given, its threads render (instead of threads created for
+		//	the purpose), and the result is not saved automatically: call `.save_result(...)` after
+		//	`.render_wait()`.  That way, the next render on the pool can start while this one saves.
+		//	If `shared_scene` is given, it is rendered instead of loading `options.scene_name`.  It is
+		//	not modified, so several renderers can share it, but it must outlive them.
+		explicit Renderer(Options const& options, ThreadPool* pool=nullptr, Scene* shared_scene=nullptr);
 		~Renderer();
 
 	private:
 		//Prints the status of an ongoing render.
 		void _print_progress() const;
 
-		//Calculate a single sample for pixel (`i`,`j`).
+		//Set up the pass that brings every pixel up from `begin` samples, filling the list of tiles.
+		//	The pass is shortened (or skipped entirely) if it would exceed the time limit.
+		void _start_pass(size_t begin);
+
+		//Fewest and most samples of any pixel in the crop region
+		std::pair<uint32_t,uint32_t> _get_count_range() const;
+
+		//Textual metadata for the saved image, or for one with the given sample count(s) and render
+		//	time (s)
+		std::vector<std::pair<std::string,std::string>> _get_metadata() const;
+		std::vector<std::pair<std::string,std::string>> _get_metadata(std::string const& samples, double time) const;
+		//Extra channels for the saved image (see `Options::exr_aovs`), from pixels' sample counts and
+		//	luminance moments
+		std::vector<Framebuffer::Aov> _get_aovs(uint32_t const* counts, glm::dvec3 const* moments) const;
+
+		//Save the image (or partial image) to `options.output_path`, encoding it on `pool` (see
+		//	`Framebuffer::save(...)`).
+		void _save_output(ThreadPool* pool) const;
+		//Save the threads' counters, merged, to `options.stats_path`.
+		void _save_stats() const;
+		//Save the pixels' costs to `options.cost_path`, likewise.
+		void _save_cost(ThreadPool* pool) const;
+		//Print the hardware performance counters of each phase.
+		void _print_perf_counters() const;
+
+		//Record the convergence so far, if it's due (or if `final`).  Called between passes.
+		void _record_convergence(bool final);
+
+		//Copy the accumulation buffer for the writer thread to save, if a snapshot is due at the
+		//	end of the pass just completed.  Called between passes.
+		void _take_snapshot();
+		//Member function called by the thread saving snapshots
+		void _snapshot_threadwork();
+
+		//Sample count at the end of the pass that starts at `begin` samples (before any time limit)
+		size_t _get_pass_end(size_t begin) const;
+
+		//Update the framebuffer's pixel (`i`,`j`), or the pixels of `tile` (which all have samples),
+		//	from their samples so far.
+		void _resolve_pixel(size_t i,size_t j);
+		void _resolve_tile (Framebuffer::Tile const& tile);
+
+		//Index of `material` in `_materials`
+		size_t _get_material_index(MaterialBase const* material) const;
+
+		//Calculate a single sample for pixel (`i`,`j`), counting the work into `stats`.
 		#ifdef RENDER_MODE_SPECTRAL
-		CIEXYZ_A_32F _render_sample(Math::RNG& rng, size_t i,size_t j);
+		CIEXYZ_A_32F _render_sample(SamplerBase& sampler,_Stats& stats, size_t i,size_t j);
 		#else
-		lRGB_A_F32   _render_sample(Math::RNG& rng, size_t i,size_t j);
+		lRGB_A_F32   _render_sample(SamplerBase& sampler,_Stats& stats, size_t i,size_t j);
 		#endif
-		//Calculate all samples for pixel (`i`,`j`) and store the reconstructed value into the
-		//	framebuffer.  Called internally by the thread worker.
-		void       _render_pixel (Math::RNG& rng, size_t i,size_t j);
+		//Calculate the samples for pixel (`i`,`j`) up to sample `end`, adding them to the
+		//	accumulation buffer.  The caller then updates the framebuffer with `._resolve_pixel(...)`.
+		void       _render_pixel (SamplerBase& sampler,_Stats& stats, size_t i,size_t j, size_t end);
 		//Member function called by each thread
 		void _render_threadwork();
 	public:
 		//Creates the worker threads and sets them rendering
 		void render_start();
-		//Tells the worker threads to abort the render
-		void render_stop () { _render_continue=false; }
+		//Tells the worker threads to abort the render.  They finish the tiles they are working on,
+		//	and then a checkpoint and the partial image are written.
+		void render_stop ();
 		//Waits for the worker threads to terminate
 		void render_wait ();
 
 		bool is_rendering() const { return _num_rendering>0u; }
+		//Whether all samples were taken (i.e., the render was not stopped early)
+		bool is_completed() const { return _render_completed; }
+
+		//If set, called (from the render threads, concurrently) after each tile is rendered in a
+		//	pass, with the tile and the pass's sample count.  The tile's pixels can be read with
+		//	`.get_region(...)` until the next pass.  Set it before `.render_start()`.
+		std::function<void(Framebuffer::Tile const&,size_t)> tile_callback;
+
+		//Save the result of the render: if `completed`, the image (removing the checkpoint, which it
+		//	supersedes), or otherwise a checkpoint and the partial image.  Threads must not be
+		//	rendering.  Called automatically at the end of a render.  Images are encoded on `pool`'s
+		//	threads, if given.  Otherwise, a render with threads of its own encodes on as many new
+		//	ones (its own having finished), and one on a pool encodes on the calling thread alone
+		//	(since the pool may be busy with the next render).
+		void save_result(bool completed, ThreadPool* pool=nullptr);
+		//Write a checkpoint to `options.checkpoint_path`.  Threads must not be rendering.
+		void write_checkpoint();
+
+		//For rendering parts of the image by other means (see "distributed.hpp").
+		//	Create a sampler for the render's options.  Each thread needs its own.
+		SamplerBase* create_sampler() const;
+		//	Render all samples of the pixels in `region` from scratch, in the same passes the render
+		//		takes them (so the result is identical).  Different threads can render different
+		//		regions at the same time.
+		void render_region(SamplerBase& sampler, Framebuffer::Tile const& region);
+		//	Copy the sums and counts of the pixels in `region` out of, or into, the accumulation
+		//		buffer (row by row from the bottom, `region.res[0]` pixels per row).  Setting them also
+		//		updates the framebuffer.
+		void get_region(Framebuffer::Tile const& region, PixelSum*       sums,uint32_t*       counts) const;
+		void set_region(Framebuffer::Tile const& region, PixelSum const* sums,uint32_t const* counts);
+
+		//Reconstructed (linear) value of a pixel from the sum of its `count` (nonzero) samples, or of
+		//	`num_pixels` pixels at once
+		static lRGB_A_F32 resolve(PixelSum const& sum, uint32_t count);
+		static void       resolve(PixelSum const* sums, uint32_t const* counts, size_t num_pixels, lRGB_A_F32* pixels);
 };
@@ -0,0 +1,233 @@
+#include "sampler.hpp"
+
+
+
+SamplerBase::SamplerBase(TYPE type, size_t spp, uint32_t seed) :
+	type(type), spp(spp), seed(seed),
+	_pixel{0u,0u}, _pixel_seed(0u), _sample_index(0u), _dimension(0u)
+{}
+
+void SamplerBase::start_sample(size_t i,size_t j, size_t sample_index) {
+	_pixel[0]     = static_cast<uint32_t>(i);
+	_pixel[1]     = static_cast<uint32_t>(j);
+	_pixel_seed   = Math::hash_u32( _pixel[1], Math::hash_u32(_pixel[0],seed) );
+	_sample_index = static_cast<uint32_t>(sample_index);
+	_dimension    = 0u;
+}
+
+inline static uint32_t _reverse_bits(uint32_t x) {
+	x = ( (x&0x55555555u) <<  1u ) | ( (x>> 1u) & 0x55555555u );
+	x = ( (x&0x33333333u) <<  2u ) | ( (x>> 2u) & 0x33333333u );
+	x = ( (x&0x0F0F0F0Fu) <<  4u ) | ( (x>> 4u) & 0x0F0F0F0Fu );
+	x = ( (x&0x00FF00FFu) <<  8u ) | ( (x>> 8u) & 0x00FF00FFu );
+	x = (  x              << 16u ) | (  x>>16u                );
+	return x;
+}
+//Owen scrambling (a random permutation of each level of the binary interval hierarchy), by
+//	hashing.  The Laine-Karras hash only lets bits affect higher bits; reversing them first makes
+//	the higher bits of `x` affect the lower bits instead, which is what Owen scrambling requires.
+inline static uint32_t _nested_uniform_scramble(uint32_t x, uint32_t seed) {
+	x = _reverse_bits(x);
+	x += seed;
+	x ^= x * 0x6C50B47Cu;
+	x ^= x * 0xB82F1E52u;
+	x ^= x * 0xC7AFE638u;
+	x ^= x * 0x8D22F6E6u;
+	return _reverse_bits(x);
+}
+
+float SamplerBase::get_1f_stratified() {
+	uint32_t seed = Math::hash_u32( _dimension++, ~_pixel_seed );
+
+	//The scrambled van der Corput point of the sample index.  Every aligned power-of-two block of
+	//	samples has one point in each interval of its size, so each pass of a progressive render is
+	//	stratified by itself, as is every power-of-two prefix (however many samples are taken in the
+	//	end; e.g., with a time limit).
+	return Math::u32_to_1f(_nested_uniform_scramble( _reverse_bits(_sample_index), seed ));
+}
+
+
+float     SamplerRandom::get_1f() /*override*/ {
+	return Math::u32_to_1f(_get_next()[0]);
+}
+glm::vec2 SamplerRandom::get_2f() /*override*/ {
+	std::array<uint32_t,4> bits = _get_next();
+	return glm::vec2( Math::u32_to_1f(bits[0]), Math::u32_to_1f(bits[1]) );
+}
+
+
+//First two dimensions of Sobol's sequence.  The first is the van der Corput sequence, and the
+//	second has generator matrix columns "vᵢ = vᵢ₋₁ ^ (vᵢ₋₁>>1)".
+inline static uint32_t _sobol_dim0(uint32_t index) {
+	return _reverse_bits(index);
+}
+inline static uint32_t _sobol_dim1(uint32_t index) {
+	uint32_t result = 0u;
+	for (uint32_t v=0x80000000u; index!=0u; index>>=1u,v^=v>>1u) {
+		if (index&1u) result^=v;
+	}
+	return result;
+}
+
+float     SamplerSobol::get_1f() /*override*/ {
+	uint32_t seed = Math::hash_u32( _dimension++, _pixel_seed );
+
+	uint32_t index = _nested_uniform_scramble( _sample_index, seed );
+	uint32_t x = _nested_uniform_scramble( _sobol_dim0(index), Math::hash_u32(seed,0u) );
+	return Math::u32_to_1f(x);
+}
+glm::vec2 SamplerSobol::get_2f() /*override*/ {
+	uint32_t seed = Math::hash_u32( _dimension++, _pixel_seed );
+
+	uint32_t index = _nested_uniform_scramble( _sample_index, seed );
+	uint32_t x = _nested_uniform_scramble( _sobol_dim0(index), Math::hash_u32(seed,0u) );
+	uint32_t y = _nested_uniform_scramble( _sobol_dim1(index), Math::hash_u32(seed,1u) );
+	return glm::vec2( Math::u32_to_1f(x), Math::u32_to_1f(y) );
+}
+
+
+SamplerPMJ02::Sets::Sets(size_t spp) :
+	length([&]() -> size_t {
+		//Sets much larger than this are slow to generate and not particularly useful.
+		size_t result = 1;
+		while (result<spp && result<4096) result*=2;
+		return result;
+	}())
+{
+	_points.resize( count * length );
+
+	/*
+	Each set is built up by repeatedly doubling the number of points.  When the points are a (0,2)-
+	net of 4ᵏ points, each cell of a 2ᵏ⨯2ᵏ grid contains one.  The next 4ᵏ points are each put into
+	the subcell (quadrant of a cell) diagonally opposite an existing one.  Then the next 2⋅4ᵏ fill
+	the remaining two subcells in each cell.  Within its subcell, each new point is placed in a
+	random position that is not in any occupied elementary interval (a "2ᵃ⨯2ᵇ" stratum with "2ᵃ⁺ᵇ"
+	equal to the new number of points), which makes each power-of-two prefix a (0,2)-net.
+
+	Placement could in principle fail (no free position left in the subcell).  In practice it does
+	not, but if it did we would simply try again.
+	*/
+	Math::RNG rng;
+	for (size_t set=0;set<count;++set) {
+		std::array<uint32_t,2>* points = _points.data() + set*length;
+
+		rng.seed( static_cast<Math::RNG::result_type>(set+1u) );
+
+		//Which elementary intervals are occupied, for the current target number of points 2ᵐ.
+		//	Entry `a` is for the intervals 2⁻ᵃ wide and 2⁻⁽ᵐ⁻ᵃ⁾ tall.
+		unsigned m;
+		std::vector<std::vector<bool>> occupied;
+		auto get_interval = [&](unsigned a, uint32_t xs,uint32_t ys) -> size_t {
+			//(`xs`,`ys`) is the finest (2⁻ᵐ⨯2⁻ᵐ) cell, which determines the intervals of every shape.
+			return ( static_cast<size_t>(ys>>a) << a ) | static_cast<size_t>( xs >> (m-a) );
+		};
+		auto get_cell = [&](std::array<uint32_t,2> const& point, unsigned log2_res) -> glm::uvec2 {
+			return glm::uvec2( point[0]>>(32u-log2_res), point[1]>>(32u-log2_res) );
+		};
+		auto mark = [&](std::array<uint32_t,2> const& point) -> void {
+			glm::uvec2 cell = get_cell(point,m);
+			for (unsigned a=0;a<=m;++a) occupied[a][get_interval(a,cell.x,cell.y)]=true;
+		};
+		auto set_target = [&](unsigned log2_count, size_t num_points) -> void {
+			m = log2_count;
+			occupied.assign( m+1u, std::vector<bool>(1_zu<<m,false) );
+			for (size_t i=0;i<num_points;++i) mark(points[i]);
+		};
+		//Place a new point into the subcell `subcell` of a grid with "2ʳ" subcells per side.
+		std::vector<uint32_t> candidates_x, candidates_y;
+		auto place = [&](unsigned r, glm::uvec2 const& subcell, std::array<uint32_t,2>* point) -> bool {
+			//Candidate finest columns and rows: those not already occupied.
+			uint32_t per_subcell = 1u << (m-r);
+			candidates_x.clear(); candidates_y.clear();
+			for (uint32_t k=0;k<per_subcell;++k) {
+				uint32_t xs = subcell.x*per_subcell + k;
+				uint32_t ys = subcell.y*per_subcell + k;
+				if (!occupied[m][get_interval(m,xs,0u)]) candidates_x.push_back(xs);
+				if (!occupied[0][get_interval(0,0u,ys)]) candidates_y.push_back(ys);
+			}
+			std::shuffle( candidates_x.begin(),candidates_x.end(), rng );
+			std::shuffle( candidates_y.begin(),candidates_y.end(), rng );
+
+			for (uint32_t xs : candidates_x) {
+				for (uint32_t ys : candidates_y) {
+					bool free = true;
+					for (unsigned a=1;a<m;++a) {
+						if (occupied[a][get_interval(a,xs,ys)]) { free=false; break; }
+					}
+					if (free) {
+						//Random position within the finest cell
+						(*point)[0] = ( xs << (32u-m) ) | ( rng() >> m );
+						(*point)[1] = ( ys << (32u-m) ) | ( rng() >> m );
+						mark(*point);
+						return true;
+					}
+				}
+			}
+			return false;
+		};
+
+		RETRY:
+		points[0] = { rng(), rng() };
+		for (unsigned log2_num=0; (1_zu<<log2_num)<length; log2_num+=2u) {
+			size_t num = 1_zu << log2_num;
+			unsigned k = log2_num / 2u; //Grid has "2ᵏ" cells per side
+
+			//Diagonally opposite subcells
+			set_target( log2_num+1u, num );
+			for (size_t i=0;i<num;++i) {
+				glm::uvec2 subcell = get_cell(points[i],k+1u) ^ glm::uvec2(1u);
+				if (!place( k+1u, subcell, points+num+i )) goto RETRY;
+			}
+			if (2*num>=length) break;
+
+			//Remaining subcells, split randomly between the two existing points
+			set_target( log2_num+2u, 2*num );
+			for (size_t i=0;i<num;++i) {
+				glm::uvec2 subcell = get_cell(points[i],k+1u);
+				glm::uvec2 subcell0 = subcell ^ ( rng()&1u ? glm::uvec2(1u,0u) : glm::uvec2(0u,1u) );
+				glm::uvec2 subcell1 = subcell0 ^ glm::uvec2(1u);
+				if (!place( k+1u, subcell0, points+2*num+i )) goto RETRY;
+				if (!place( k+1u, subcell1, points+3*num+i )) goto RETRY;
+			}
+		}
+	}
+}
+
+SamplerPMJ02::SamplerPMJ02(size_t spp, uint32_t seed, Sets const* sets) :
+	SamplerBase(TYPE::PMJ02,spp,seed),
+	_sets(sets)
+{}
+
+std::array<uint32_t,2> SamplerPMJ02::_get_next() {
+	uint32_t seed = Math::hash_u32( _dimension++, _pixel_seed );
+
+	//Visit the pixel's samples in a random order, but only within each power-of-two range
+	//	[2ᵏ,2ᵏ⁺¹) of a set.  Every power-of-two prefix of the samples then uses a prefix of the set,
+	//	which is a (0,2)-net, so it's only which dimensions go together that is randomized.  This is
+	//	independent of the sample count, so the image is stratified at the end of each doubling
+	//	pass, however many samples are eventually taken (e.g. with a time limit).
+	uint32_t length = static_cast<uint32_t>(_sets->length);
+	uint32_t block = _sample_index / length;
+	uint32_t block_seed = Math::hash_u32( block, seed );
+	uint32_t index = _sample_index % length;
+	if (index>1u) {
+		uint32_t range = 1u;
+		while (range<=index>>1u) range<<=1u;
+		index = range + Math::permute( index-range, range, Math::hash_u32(range,block_seed) );
+	}
+	std::array<uint32_t,2> point = (*_sets)( block_seed%Sets::count, index );
+
+	//Digital shift (XOR with a random constant).  Elementary intervals map to elementary intervals
+	//	of the same shape, so this preserves the stratification.
+	point[0] ^= Math::hash_u32( block_seed, 0u );
+	point[1] ^= Math::hash_u32( block_seed, 1u );
+	return point;
+}
+float     SamplerPMJ02::get_1f() /*override*/ {
+	//A (0,2)-net's projection onto either axis is stratified in one dimension too.
+	return Math::u32_to_1f(_get_next()[0]);
+}
+glm::vec2 SamplerPMJ02::get_2f() /*override*/ {
+	std::array<uint32_t,2> point = _get_next();
+	return glm::vec2( Math::u32_to_1f(point[0]), Math::u32_to_1f(point[1]) );
+}
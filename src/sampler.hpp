@@ -0,0 +1,138 @@
+#pragma once
+
+#include "stdafx.hpp"
+
+#include "util/random.hpp"
+
+
+
+//Source of the random numbers that make up each sample.  A sample is a point in a high-dimensional
+//	unit hypercube, and each random decision along its path (pixel jitter, hero wavelength, BSDF
+//	direction, light choice, . . .) consumes the next one or two of its dimensions.  Every value is a
+//	function of only the pixel, the sample index, the dimension, and the seed, so results do not
+//	depend on how pixels are scheduled onto threads, and any sample can be recomputed in isolation.
+//	Each thread needs its own sampler.
+class SamplerBase {
+	public:
+		enum class TYPE { RANDOM, SOBOL, PMJ02 };
+		TYPE const type;
+
+		//Number of samples per pixel.  Stratified samplers distribute their points over this many.
+		size_t const spp;
+
+		//Seed for the whole render.  Different seeds give different (independent) noise.
+		uint32_t const seed;
+
+	protected:
+		//Current pixel, a seed combining it with `.seed`, the index of the current sample within
+		//	the pixel, and the index of the next dimension to be handed out.
+		uint32_t _pixel[2];
+		uint32_t _pixel_seed;
+		uint32_t _sample_index;
+		uint32_t _dimension;
+
+		SamplerBase(TYPE type, size_t spp, uint32_t seed);
+	public:
+		virtual ~SamplerBase() = default;
+
+		//Begin sample `sample_index` of pixel (`i`,`j`), handing out dimensions from the first.
+		virtual void start_sample(size_t i,size_t j, size_t sample_index);
+
+		//Get the next dimension, or the next two dimensions, of the current sample.  Values are in
+		//	[0,1).  Two dimensions taken together are stratified jointly, not just individually, so
+		//	use `.get_2f()` for 2D decisions.
+		virtual float     get_1f() = 0;
+		virtual glm::vec2 get_2f() = 0;
+
+		//Get the next dimension, explicitly stratified over each power-of-two block of the pixel's
+		//	samples (so over each pass, whatever `spp` turns out to be).  This is for dimensions
+		//	that matter a lot by themselves, and so should be stratified even when the sampler
+		//	doesn't stratify.
+		float get_1f_stratified();
+
+		//Choose an index in [0,`length`) using the next dimension.
+		size_t get_choice(size_t length) {
+			size_t index = static_cast<size_t>( get_1f() * static_cast<float>(length) );
+			return std::min( index, length-1 );
+		}
+};
+
+//Independent uniform random numbers (no stratification).  Each dimension is computed directly by a
+//	counter-based RNG (Philox), with the pixel, sample index, and dimension as the counter and the
+//	seed as the key.
+class SamplerRandom final : public SamplerBase {
+	public:
+		SamplerRandom(size_t spp, uint32_t seed) : SamplerBase(TYPE::RANDOM,spp,seed) {}
+		virtual ~SamplerRandom() = default;
+
+		virtual float     get_1f() override;
+		virtual glm::vec2 get_2f() override;
+
+	private:
+		std::array<uint32_t,4> _get_next() {
+			return Math::philox4x32(
+				{ _pixel[0], _pixel[1], _sample_index, _dimension++ },
+				{ seed, 0x5350454Bu }
+			);
+		}
+};
+
+//Owen-scrambled Sobol sequence.  Each dimension (pair) is the first two dimensions of Sobol's
+//	sequence (a (0,2)-sequence), with its own hashed nested-uniform scrambling of both the index and
+//	the values, as in "Practical Hash-based Owen Scrambling" by Brent Burley:
+//		https://jcgt.org/published/0009/04/01/paper.pdf
+//	Every power-of-two prefix of the samples in a pixel is stratified, so any sample count works.
+class SamplerSobol final : public SamplerBase {
+	public:
+		SamplerSobol(size_t spp, uint32_t seed) : SamplerBase(TYPE::SOBOL,spp,seed) {}
+		virtual ~SamplerSobol() = default;
+
+		virtual float     get_1f() override;
+		virtual glm::vec2 get_2f() override;
+};
+
+//Progressive multi-jittered (0,2) sequences, from "Progressive Multi-Jittered Sample Sequences" by
+//	Christensen et al.:
+//		https://graphics.pixar.com/library/ProgressiveMultiJitteredSampling/paper.pdf
+//	Each dimension (pair) of each pixel draws from a randomly chosen point set, visiting its points
+//	in a random order, with a random digital shift (which preserves the stratification).
+class SamplerPMJ02 final : public SamplerBase {
+	public:
+		//The point sets.  These are expensive to generate, so they are generated once and shared by
+		//	all threads' samplers.
+		class Sets final {
+			public:
+				//Number of sets
+				static constexpr size_t count = 8;
+
+				//Number of points in each set.  A power of two, so that every set is stratified as
+				//	a whole.  Samples past the end continue in another set.
+				size_t const length;
+
+			private:
+				//Points, as 32-bit fixed point, stored set after set
+				std::vector<std::array<uint32_t,2>> _points;
+
+			public:
+				explicit Sets(size_t spp);
+				~Sets() = default;
+
+				std::array<uint32_t,2> const& operator()(size_t set,size_t index) const {
+					return _points[ set*length + index ];
+				}
+		};
+
+	private:
+		Sets const*const _sets;
+
+	public:
+		SamplerPMJ02(size_t spp, uint32_t seed, Sets const* sets);
+		virtual ~SamplerPMJ02() = default;
+
+		virtual float     get_1f() override;
+		virtual glm::vec2 get_2f() override;
+
+	private:
+		//The point for the current sample in the next dimension (pair), as 32-bit fixed point.
+		std::array<uint32_t,2> _get_next();
+};
@@ -13,15 +13,19 @@ Scene::~Scene() {
 	for (PrimBase const* iter : primitives) delete iter;
 }
 
+void Scene::Camera::update_matrices() {
+	matr_P = glm::perspectiveFov(
+		glm::radians(vfov_deg),
+		static_cast<float>(res[0]), static_cast<float>(res[1]),
+		near, far
+	);
+	matr_V = glm::lookAt( pos, pos+dir, up );
+	matr_PV_inv = glm::inverse( matr_P * matr_V );
+}
+
 void Scene::_init() {
 	//Compute camera matrices.
-	camera.matr_P = glm::perspectiveFov(
-		glm::radians(camera.vfov_deg),
-		static_cast<float>(camera.res[0]), static_cast<float>(camera.res[1]),
-		camera.near, camera.far
-	);
-	camera.matr_V = glm::lookAt( camera.pos, camera.pos+camera.dir, camera.up );
-	camera.matr_PV_inv = glm::inverse( camera.matr_P * camera.matr_V );
+	camera.update_matrices();
 
 	//Make a list of all the lights so that we can sample them later.
 	for (PrimBase* prim : primitives) {
@@ -29,6 +33,13 @@ void Scene::_init() {
 	}
 	assert(!lights.empty());
 }
+Scene* Scene::get_new(std::string const& name) {
+	if      (name=="cornell"          ) return get_new_cornell     (    );
+	else if (name=="cornell-srgb"     ) return get_new_cornell_srgb(    );
+	else if (name=="plane-srgb"       ) return get_new_plane_srgb  (    );
+	else if (name=="plane-srgb-mirror") return get_new_plane_srgb  (true);
+	else                                return nullptr;
+}
 Scene* Scene::get_new_cornell     () {
 	//http://www.graphics.cornell.edu/online/box/data.html
 	Scene* result = new Scene;
@@ -316,7 +327,7 @@ Scene* Scene::get_new_cornell_srgb() {
 
 	return result;
 }
-Scene* Scene::get_new_plane_srgb  () {
+Scene* Scene::get_new_plane_srgb  (bool mirror/*=false*/) {
 	Scene* result = new Scene;
 
 	{
@@ -342,22 +353,18 @@ Scene* Scene::get_new_plane_srgb  () {
 		#endif
 		result->materials["light"] = mtl_light;
 
-		MaterialSimpleAlbedoBase* mtl_tex = new
-			#ifdef EXPLICIT_LIGHT_SAMPLING
-			MaterialLambertian(
-			#else
-			//Both `MaterialLambertian` and `MaterialMirror` converge to the same render (as long as
-			//	explicit light sampling isn't used; light sampling will never hit a delta BRDF).
-			//	However, the mirror material converges much faster because the ray direction is not
-			//	a random variable.
-			MaterialMirror(
-			#endif
-				#if 1 //Lizard texture
-				"data/scenes/crystal-lizard-4096.png"
-				#else //A helpful 64⨯64 test image I made
-				"data/scenes/test-img.png"
-				#endif
-			);
+		//Both `MaterialLambertian` and `MaterialMirror` converge to the same render.  However, the
+		//	mirror material converges much faster because the ray direction is not a random
+		//	variable.  (Light sampling never hits a delta BRDF, so with the mirror, all the light
+		//	comes through BSDF sampling.)
+		#if 1 //Lizard texture
+		std::string path = "data/scenes/crystal-lizard-4096.png";
+		#else //A helpful 64⨯64 test image I made
+		std::string path = "data/scenes/test-img.png";
+		#endif
+		MaterialSimpleAlbedoBase* mtl_tex;
+		if (mirror) mtl_tex=new MaterialMirror    (path);
+		else        mtl_tex=new MaterialLambertian(path);
 		result->materials["tex"] = mtl_tex;
 	}
 
@@ -413,21 +420,25 @@ Scene* Scene::get_new_plane_srgb  () {
 	return result;
 }
 
-void Scene::get_rand_toward_light(Math::RNG& rng, Pos const& from, Dir* dir,PrimBase const** light,float* pdf ) {
-	*light = lights[ rand_choice(rng,lights.size()) ];
+void Scene::get_rand_toward_light(SamplerBase& sampler, Pos const& from, Dir* dir,PrimBase const** light,float* pdf ) {
+	*light = lights[ sampler.get_choice(lights.size()) ];
 
 	#if 0 //Sample the bounding sphere of the light
 		SphereBound bound = (*light)->get_bound();
 
 		Dir vec_to_sph_cen = bound.center - from;
 
-		*dir = Math::rand_toward_sphere( rng, vec_to_sph_cen,bound.radius, pdf );
+		*dir = Math::rand_toward_sphere( sampler.get_2f(), vec_to_sph_cen,bound.radius, pdf );
 	#else //Sample the primitive directly
-		(*light)->get_rand_toward( rng, from, dir,pdf );
+		(*light)->get_rand_toward( sampler, from, dir,pdf );
 	#endif
 
 	*pdf /= static_cast<float>(lights.size());
 }
+float Scene::get_pdf_toward_light(Pos const& from, Dir const& dir,PrimBase const* light) const {
+	assert(light->is_light);
+	return light->get_pdf_toward( from, dir ) / static_cast<float>(lights.size());
+}
 
 bool Scene::intersect(Ray const& ray, HitRecord* hitrec, PrimBase const* ignore/*=nullptr*/) const {
 	hitrec->prim = nullptr;
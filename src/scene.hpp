@@ -2,7 +2,7 @@
 
 #include "stdafx.hpp"
 
-#include "util/random.hpp"
+#include "sampler.hpp"
 
 
 
@@ -13,7 +13,7 @@ class Scene final {
 	public:
 		//Camera parameters.  A simple pinhole camera projection model is used, similar to classic
 		//	OpenGL.
-		struct {
+		struct Camera final {
 			//Position, look-at, and up vectors (same meaning as `gluLookat(...)`).
 			Pos pos;
 			Dir dir;
@@ -30,6 +30,9 @@ class Scene final {
 			glm::mat4x4 matr_P;
 			glm::mat4x4 matr_V;
 			glm::mat4x4 matr_PV_inv;
+
+			//Recompute the matrices from the parameters (after changing them).
+			void update_matrices();
 		} camera;
 
 		//Backing store of materials.  Map of their names onto the materials themselves.
@@ -49,17 +52,25 @@ class Scene final {
 		//Common method to precompute some scene data.
 		void _init();
 	public:
+		//Construct a new scene by name ("cornell", "cornell-srgb", "plane-srgb", or
+		//	"plane-srgb-mirror"), or return null if there is no such scene.
+		static Scene* get_new(std::string const& name);
 		//Construct new scenes from hard-coded parameters.
 		//	Cornell box with original data
 		static Scene* get_new_cornell     ();
 		//	Cornell box with some walls replaced by white and others by textures
 		static Scene* get_new_cornell_srgb();
-		//	Camera exactly looking at plane in white environment box
-		static Scene* get_new_plane_srgb  ();
+		//	Camera exactly looking at plane in white environment box.  The plane is Lambertian, or if
+		//	`mirror`, a (textured) mirror, which gets all its light by BSDF sampling (a test of how
+		//	light sampling handles delta BSDFs).
+		static Scene* get_new_plane_srgb  (bool mirror=false);
 
 		//Get a random direction `dir` from `from` to a randomly chosen light returned in `light`.
 		//	The probability density of choosing this direction is returned in `pdf`.
-		void get_rand_toward_light(Math::RNG& rng, Pos const& from, Dir* dir,PrimBase const** light,float* pdf );
+		void get_rand_toward_light(SamplerBase& sampler, Pos const& from, Dir* dir,PrimBase const** light,float* pdf );
+		//Get the probability density with which `.get_rand_toward_light(...)` would choose the
+		//	direction `dir` from `from`, which is known to hit the light `light`.
+		float get_pdf_toward_light(Pos const& from, Dir const& dir,PrimBase const* light) const;
 
 		//Intersect ray `ray` with the scene.  Returns whether anything was hit, with data in
 		//	`hitrec`.  `ignore` can be passed to ignore hits from that primitive.
@@ -174,6 +174,62 @@ float _Spectrum::integrate(_Spectrum const& spec0, _Spectrum const& spec1) {
 
 
 
+HeroWavelengthDistribution::HeroWavelengthDistribution(
+	std::function<SpectrumUnspecified::HeroSample(nm)> const& target
+) {
+	nm bin_width = LAMBDA_STEP / static_cast<float>(_num_bins);
+
+	//Average value of the (hero-summed) target over each piece.
+	std::vector<double> weights(_num_bins,0.0);
+	double total = 0.0;
+	if (target) {
+		for (size_t i=0;i<_num_bins;++i) {
+			for (size_t k=0;k<4;++k) {
+				nm lambda_0 = LAMBDA_MIN + bin_width*( static_cast<float>(i) + (static_cast<float>(k)+0.5f)*0.25f );
+				SpectrumUnspecified::HeroSample values = target(lambda_0);
+				for (size_t j=0;j<SAMPLE_WAVELENGTHS;++j) {
+					assert(values[j]>=0.0f);
+					weights[i] += static_cast<double>(values[j]);
+				}
+			}
+			total += weights[i];
+		}
+	}
+
+	//Mix with the uniform distribution.  This bounds the estimator's weight (by the reciprocal of
+	//	the uniform fraction), and keeps wavelengths where the target is zero (but where there may
+	//	still be a contribution) from being missed completely.
+	double const uniform_fraction = 0.1;
+	_pdf.resize(_num_bins  );
+	_cdf.resize(_num_bins+1);
+	_cdf[0] = 0.0f;
+	double cdf = 0.0;
+	for (size_t i=0;i<_num_bins;++i) {
+		double prob = 1.0 / static_cast<double>(_num_bins);
+		if (total>0.0) {
+			prob = uniform_fraction*prob + (1.0-uniform_fraction)*weights[i]/total;
+		}
+		_pdf[i] = static_cast<float>( prob / static_cast<double>(bin_width) );
+		cdf += prob;
+		_cdf[i+1] = static_cast<float>(cdf);
+	}
+	_cdf.back() = 1.0f;
+}
+
+nm HeroWavelengthDistribution::sample(float u, float* pdf) const {
+	//Find the piece containing `u`, then where within it by linear interpolation.
+	size_t i = static_cast<size_t>( std::upper_bound(_cdf.cbegin()+1,_cdf.cend(),u) - (_cdf.cbegin()+1) );
+	i = std::min( i, _num_bins-1 );
+	float frac = ( u - _cdf[i] ) / ( _cdf[i+1] - _cdf[i] );
+	frac = glm::clamp( frac, 0.0f,1.0f );
+
+	*pdf = _pdf[i];
+	nm lambda_0 = LAMBDA_MIN + ( static_cast<float>(i) + frac ) * ( LAMBDA_STEP / static_cast<float>(_num_bins) );
+	return std::min( lambda_0, std::nextafter(LAMBDA_MIN+LAMBDA_STEP,LAMBDA_MIN) );
+}
+
+
+
 std::vector<std::vector<float>> load_spectral_data(std::string const& csv_path) {
 	std::ifstream file(csv_path);
 	if (file.good()); else {
@@ -76,6 +76,35 @@ typedef _Spectrum SpectrumUnspecified;
 
 
 
+//Distribution of the hero wavelength "λ₀" over [λₘᵢₙ,λₘᵢₙ+Δλ), importance-sampling a nonnegative
+//	target function.  Since a hero wavelength stands for all its "λᵢ = λ₀ + i Δλ", the density is
+//	proportional to the target summed over them.  The distribution is piecewise-constant, and is
+//	mixed with a uniform distribution, so that wavelengths the target misses still get sampled.
+class HeroWavelengthDistribution final {
+	private:
+		//Number of pieces
+		static constexpr size_t _num_bins = 256;
+
+		//Probability density of each piece, and cumulative probability at the start of each piece
+		//	(plus a last entry for the end).
+		std::vector<float> _pdf;
+		std::vector<float> _cdf;
+
+	public:
+		//Distribution for the target `target`.  Given "λ₀", it returns the target's values at each
+		//	"λᵢ".  If empty, or the target is zero, the distribution is uniform.
+		explicit HeroWavelengthDistribution(
+			std::function<SpectrumUnspecified::HeroSample(nm)> const& target=nullptr
+		);
+		~HeroWavelengthDistribution() = default;
+
+		//Choose a hero wavelength "λ₀" by inverting the CDF at `u` (in [0,1)), also returning its
+		//	probability density.  A stratified `u` gives stratified wavelengths.
+		nm sample(float u, float* pdf) const;
+};
+
+
+
 //Loads spectral data from a CSV file.  The data is in rows, and is therefore returned as a list of
 //	column vectors.
 std::vector<std::vector<float>> load_spectral_data(std::string const& csv_path);
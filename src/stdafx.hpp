@@ -6,16 +6,23 @@
 
 //	C Standard Library
 #include <cassert>
+#include <csignal>
 #include <cstdio>
 
 //	C++ Standard Library
 #include <algorithm>
 #include <array>
 #include <atomic>
+#include <charconv>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <functional>
 #include <fstream>
+#include <future>
 #include <map>
 #include <mutex>
+#include <queue>
 #include <random>
 #include <set>
 #include <sstream>
@@ -39,15 +46,17 @@
 
 //	(Note also usage of user-defined literals, defined below.)
 
-//	Use explicit light sampling (ELS) when path tracing.
-#define EXPLICIT_LIGHT_SAMPLING
-
 //	Maximum depth of path trace integrator (including shadow rays).
 #define MAX_DEPTH 10u
 
 //	Work items during the path trace are square tiles of pixels.  This is their width and height.
 #define TILE_SIZE 4_zu
 
+//	The render takes its samples in progressive passes over the whole image, each taking as many
+//		samples per pixel as all the passes before it (so that the image is always at a power-of-two
+//		sample count between passes), but no more than this.  Checkpoints are written between passes.
+#define MAX_PASS_SPP 64_zu
+
 //	If enabled, compensates for the cosine-factor falloff due to viewing rays leaving the camera
 //		sensor at an angle by brightening those areas by an inverse factor.  This is quite typical
 //		for real-world cameras (indeed, many people don't know this is even necessary).
@@ -58,11 +67,14 @@
 
 //	Whether to use spectral rendering (correct), and if so which variant to use (our paper, the work
 //		by Meng et al. 2015, or the work by Jakob and Hanika 2019) or RGB mode (what many people do
-//		instead).
-#if 1
+//		instead).  The build can also choose, by defining `RENDER_MODE_RGB` or
+//		`RENDER_MODE_SPECTRAL_ALGNUM` (as the benchmark's renderers do; see "CMakeLists.txt").
+#ifndef RENDER_MODE_RGB
 	#define RENDER_MODE_SPECTRAL
 
+	#ifndef RENDER_MODE_SPECTRAL_ALGNUM
 	#define RENDER_MODE_SPECTRAL_ALGNUM 1
+	#endif
 	#if    RENDER_MODE_SPECTRAL_ALGNUM == 1
 		#define RENDER_MODE_SPECTRAL_OURS
 	#elif  RENDER_MODE_SPECTRAL_ALGNUM == 2
@@ -87,8 +99,6 @@
 	//		Number of wavelengths sampled by a single sample.  When more than one is used, hero
 	//			wavelength sampling is done.
 	#define SAMPLE_WAVELENGTHS 4_zu
-#else
-	#define RENDER_MODE_RGB
 #endif
 
 #ifdef SUPPORT_WINDOWED
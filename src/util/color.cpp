@@ -1,5 +1,7 @@
 ﻿#include "color.hpp"
 
+#include <cstring>
+
 #if   defined RENDER_MODE_SPECTRAL_MENG
 	#include "../meng-et-al.-2015/spectrum_grid.h"
 #elif defined RENDER_MODE_SPECTRAL_JH
@@ -154,7 +156,8 @@ void   init() {
 }
 void deinit() {
 	#ifdef RENDER_MODE_SPECTRAL_JH
-	rgb2spec_free(data->model_jh2019);
+	//	Note the model is null if its data could not be loaded.
+	if (data->model_jh2019!=nullptr) rgb2spec_free(data->model_jh2019);
 	#endif
 
 	delete data;
@@ -234,14 +237,11 @@ SpectralReflectance::HeroSample lrgb_to_specrefl(lRGB_F32 const& lrgb, nm lambda
 #endif
 
 #if   defined RENDER_MODE_SPECTRAL_OURS || defined RENDER_MODE_SPECTRAL_JH
-sRGB_F32 ciexyz_to_srgb(CIEXYZ_32F const& xyz) {
-	lRGB_F32 lrgb = ciexyz_to_lrgb(xyz);
-	sRGB_F32 srgb = lrgb_to_srgb(lrgb);
-	sRGB_F32 srgb255 = 255.0f*srgb;
-	return lrgb_to_srgb(lrgb);
+lRGB_F32 ciexyz_to_lrgb_output(CIEXYZ_32F const& xyz) {
+	return ciexyz_to_lrgb(xyz);
 }
 #elif defined RENDER_MODE_SPECTRAL_MENG
-sRGB_F32 ciexyz_to_srgb(CIEXYZ_32F const& xyz) {
+lRGB_F32 ciexyz_to_lrgb_output(CIEXYZ_32F const& xyz) {
 	//This is the inverse matrix Meng et al. use in their code.  We again preserve it, for
 	//	consistency.  See also comments in `lrgb_to_specrefl(...)`.
 	CIEXYZ_32F xyz_rel = xyz / data->D65_rad_XYZ.y;
@@ -250,11 +250,14 @@ sRGB_F32 ciexyz_to_srgb(CIEXYZ_32F const& xyz) {
 		-0.96920119f,  1.87588535f,  0.04155324f,
 		 0.05562416f, -0.20395525f,  1.05685902f
 	)) * xyz_rel;
-	return lrgb_to_srgb(lrgb);
+	return lrgb;
 }
 #else
 	#error
 #endif
+sRGB_F32 ciexyz_to_srgb(CIEXYZ_32F const& xyz) {
+	return lrgb_to_srgb(ciexyz_to_lrgb_output(xyz));
+}
 
 #ifdef RENDER_MODE_SPECTRAL_OURS
 lRGB_F32 round_trip_lrgb(lRGB_F32 const& lrgb) {
@@ -301,4 +304,56 @@ sRGB_F32 round_trip_srgb(sRGB_F32 const& srgb) {
 
 
 
+//	Table for `lrgb_to_srgb8(...)`.  A value's range (given by its exponent and top eight bits of
+//		mantissa) indexes the 8-bit value at the bottom of the range.  The ranges are narrow enough
+//		that at most one rounding threshold (the linear value at which the 8-bit value goes up by
+//		one) falls in each, so the result is that or the next value.  Values below 2⁻¹³ all round
+//		to zero.
+class _SRGB8Table final { public:
+	static uint32_t const bits_min = 0x39000000u; //2⁻¹³
+	static uint32_t const shift = 15;
+
+	uint8_t bottoms[ (0x3F800000u-bits_min) >> shift ];
+	float thresholds[256];
+
+	_SRGB8Table() {
+		//	(The smallest float at or above each threshold)
+		for (size_t k=0;k<255;++k) {
+			double srgb = (static_cast<double>(k)+0.5) / 255.0;
+			double threshold = srgb<0.04045 ? srgb/12.92 : std::pow((srgb+0.055)/1.055,2.4);
+			thresholds[k] = static_cast<float>(threshold);
+			if (static_cast<double>(thresholds[k])<threshold) thresholds[k]=std::nextafter(thresholds[k],2.0f);
+		}
+		thresholds[255] = std::numeric_limits<float>::infinity();
+
+		size_t k = 0;
+		for (uint32_t index=0;index<sizeof(bottoms);++index) {
+			uint32_t bits = bits_min + (index<<shift);
+			float value; memcpy(&value,&bits,4);
+			while (value>=thresholds[k]) ++k;
+			bottoms[index] = static_cast<uint8_t>(k);
+		}
+	}
+};
+
+void lrgb_to_srgb8(glm::vec4 const* lrgba, size_t count, uint8_t* srgba8) {
+	static _SRGB8Table const table;
+	float const min = 1.0f / 8192.0f;
+	float const max = 0.99999994f;
+	for (size_t k=0;k<count;++k) {
+		for (int c=0;c<3;++c) {
+			float value = lrgba[k][c];
+			value = value>min ? value : min; //(NaN becomes `min`)
+			value = value<max ? value : max;
+			uint32_t bits; memcpy(&bits,&value,4);
+			uint32_t srgb = table.bottoms[ (bits-_SRGB8Table::bits_min) >> _SRGB8Table::shift ];
+			srgb += value>=table.thresholds[srgb] ? 1u : 0u;
+			srgba8[4*k+static_cast<size_t>(c)] = static_cast<uint8_t>(srgb);
+		}
+		srgba8[4*k+3] = static_cast<uint8_t>(std::round( 255.0f*glm::clamp(lrgba[k].a,0.0f,1.0f) ));
+	}
+}
+
+
+
 }
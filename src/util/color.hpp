@@ -95,6 +95,10 @@ inline lRGB_F32 srgb_to_lrgb(sRGB_F32 const& srgb) {
 		srgb.b<0.04045f ? srgb.b/12.92f : std::pow((srgb.b+0.055f)/1.055f,2.4f)
 	);
 }
+//	Conversion of `count` ℓRGBA values (e.g. a row of pixels) to 8-bit sRGBA, as for display:
+//		clipped, with the gamma applied to RGB (not alpha), and rounded to nearest.  This uses a
+//		lookup table instead of `std::pow(...)`, and gives exactly the rounded result.
+void lrgb_to_srgb8(glm::vec4 const* lrgba, size_t count, uint8_t* srgba8);
 
 
 
@@ -110,9 +114,10 @@ inline CIEXYZ_32F specradflux_to_ciexyz(SpectralRadiantFlux             const& s
 	return CIEXYZ_32F(X,Y,Z);
 }
 //Calculate the estimated CIE XYZ tristimulus value for the given hero-wavelength sample of spectral
-//	radiant flux `spec_rad_flux` with hero wavelength `lambda_0`.  As-above, note that the eye is
-//	sensitive to radiant flux.
-inline CIEXYZ_32F specradflux_to_ciexyz(SpectralRadiantFlux::HeroSample const& spec_rad_flux, nm lambda_0) {
+//	radiant flux `spec_rad_flux` with hero wavelength `lambda_0`, which was chosen with probability
+//	density `pdf_lambda_0` (for uniform sampling, "1/Δλ").  As-above, note that the eye is sensitive
+//	to radiant flux.
+inline CIEXYZ_32F specradflux_to_ciexyz(SpectralRadiantFlux::HeroSample const& spec_rad_flux, nm lambda_0,float pdf_lambda_0) {
 	//TODO: optimize with hardware-supported dot products
 
 	//The hero samples times the corresponding CIE standard observer function values give a sample
@@ -122,10 +127,12 @@ inline CIEXYZ_32F specradflux_to_ciexyz(SpectralRadiantFlux::HeroSample const& s
 	SpectrumUnspecified::HeroSample value_sample_ybar_times_flux = data->std_obs_ybar[lambda_0] * spec_rad_flux;
 	SpectrumUnspecified::HeroSample value_sample_zbar_times_flux = data->std_obs_zbar[lambda_0] * spec_rad_flux;
 
-	//Monte Carlo estimate of the integral of that product over each wavelength band.
-	SpectrumUnspecified::HeroSample value_montecarlo_est_subintegrals_X = value_sample_xbar_times_flux * LAMBDA_STEP;
-	SpectrumUnspecified::HeroSample value_montecarlo_est_subintegrals_Y = value_sample_ybar_times_flux * LAMBDA_STEP;
-	SpectrumUnspecified::HeroSample value_montecarlo_est_subintegrals_Z = value_sample_zbar_times_flux * LAMBDA_STEP;
+	//Monte Carlo estimate of the integral of that product over each wavelength band.  Each "λᵢ" has
+	//	the same density as "λ₀" within its own band.
+	float pdf_recip = 1.0f / pdf_lambda_0;
+	SpectrumUnspecified::HeroSample value_montecarlo_est_subintegrals_X = value_sample_xbar_times_flux * pdf_recip;
+	SpectrumUnspecified::HeroSample value_montecarlo_est_subintegrals_Y = value_sample_ybar_times_flux * pdf_recip;
+	SpectrumUnspecified::HeroSample value_montecarlo_est_subintegrals_Z = value_sample_zbar_times_flux * pdf_recip;
 
 	//Summing them gives the Monte Carlo estimate of the integral of that product over the whole
 	//	spectrum.  That is, this is the Monte Carlo estimate of the product of the notional spectrum
@@ -154,8 +161,11 @@ inline CIEXYZ_32F lrgb_to_ciexyz(lRGB_F32   const& lrgb) {
 	return data->matr_lrgb_to_xyz * lrgb;
 }
 
-//Direct conversion from CIE XYZ to post-gamma, normalized BT.709 RGB (i.e. sRGB).
-sRGB_F32 ciexyz_to_srgb(CIEXYZ_32F const& xyz);
+//Conversion from CIE XYZ to the ℓRGB that images are output in (the same as `ciexyz_to_lrgb(...)`,
+//	except in Meng et al.'s mode, which keeps their matrix), and directly on to post-gamma,
+//	normalized BT.709 RGB (i.e. sRGB).
+lRGB_F32 ciexyz_to_lrgb_output(CIEXYZ_32F const& xyz);
+sRGB_F32 ciexyz_to_srgb       (CIEXYZ_32F const& xyz);
 
 #ifdef RENDER_MODE_SPECTRAL_OURS
 //Round-trip functions, for testing/demonstration purposes.  Note that this is computed in 32-bit
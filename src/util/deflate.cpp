@@ -0,0 +1,366 @@
+#include "deflate.hpp"
+
+
+
+namespace Deflate {
+
+
+
+//LZ77 parameters: hash table size, matches tried per position, and a length good enough to stop at
+#define DEFLATE_HASH_BITS 15
+#define DEFLATE_MAX_CHAIN 32_zu
+#define DEFLATE_NICE_LEN  128_zu
+//	Symbols per block (each block gets its own Huffman codes)
+#define DEFLATE_BLOCK_SYMBOLS 65536_zu
+
+
+
+//	Output of bits, least-significant first (as deflate packs them)
+class _BitWriter final {
+	public:
+		std::vector<uint8_t> bytes;
+	private:
+		uint64_t _bits;
+		size_t _num_bits;
+
+	public:
+		_BitWriter() : _bits(0), _num_bits(0) {}
+
+		//Write the low `count` (at most 32) bits of `value`
+		void write(uint32_t value, size_t count) {
+			_bits |= static_cast<uint64_t>(value) << _num_bits;
+			_num_bits += count;
+			while (_num_bits>=8) {
+				bytes.push_back(static_cast<uint8_t>(_bits));
+				_bits >>= 8;
+				_num_bits -= 8;
+			}
+		}
+		//Pad with zero bits to a byte boundary
+		void align() {
+			if (_num_bits>0) write( 0u, 8-_num_bits );
+		}
+};
+
+//	Lengths 3–258 and distances 1–32768 are coded as a symbol (by range) and extra bits
+static uint16_t const _length_bases[29] = {
+	3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,43,51,59,67,83,99,115,131,163,195,227,258
+};
+static uint8_t const _length_extra[29] = {
+	0,0,0,0,0,0,0,0,1,1,1,1,2,2,2,2,3,3,3,3,4,4,4,4,5,5,5,5,0
+};
+static uint16_t const _dist_bases[30] = {
+	1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,257,385,513,769,1025,1537,2049,3073,4097,6145,8193,
+	12289,16385,24577
+};
+static uint8_t const _dist_extra[30] = {
+	0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13
+};
+static size_t _get_length_code(size_t length) {
+	return static_cast<size_t>( std::upper_bound(_length_bases,_length_bases+29,length) - _length_bases ) - 1;
+}
+static size_t _get_dist_code  (size_t dist  ) {
+	return static_cast<size_t>( std::upper_bound(_dist_bases,  _dist_bases  +30,dist  ) - _dist_bases   ) - 1;
+}
+
+//	Huffman code lengths (at most `max_length` bits) for symbols with frequencies `freqs`.  At least
+//		two symbols get codes, so that the code is complete.  If the optimal code is too long, the
+//		frequencies are flattened (halved) until it isn't.
+static std::vector<uint8_t> _get_code_lengths(std::vector<uint32_t> freqs, size_t max_length) {
+	size_t num_used = 0;
+	for (uint32_t freq : freqs) if (freq>0) ++num_used;
+	for (size_t k=0; num_used<2&&k<freqs.size(); ++k) {
+		if (freqs[k]==0) { freqs[k]=1; ++num_used; }
+	}
+
+	std::vector<uint8_t> lengths(freqs.size());
+	while (true) {
+		//	Build the tree bottom-up; nodes are leaves (in symbol order), then internal nodes.
+		typedef std::pair<uint64_t,size_t> Entry;
+		std::priority_queue<Entry,std::vector<Entry>,std::greater<Entry>> queue;
+		std::vector<size_t> parents;
+		std::vector<size_t> leaves;
+		for (size_t k=0;k<freqs.size();++k) {
+			if (freqs[k]>0) {
+				queue.emplace( freqs[k], parents.size() );
+				parents.push_back(0);
+				leaves.push_back(k);
+			}
+		}
+		while (queue.size()>1) {
+			Entry a=queue.top(); queue.pop();
+			Entry b=queue.top(); queue.pop();
+			parents[a.second] = parents[b.second] = parents.size();
+			queue.emplace( a.first+b.first, parents.size() );
+			parents.push_back(0);
+		}
+
+		//	Depths, from the root (the last node) down
+		std::vector<size_t> depths(parents.size());
+		depths.back() = 0;
+		for (size_t k=parents.size()-1;k-->0;) depths[k]=depths[parents[k]]+1;
+
+		size_t longest = 0;
+		std::fill( lengths.begin(),lengths.end(), static_cast<uint8_t>(0) );
+		for (size_t k=0;k<leaves.size();++k) {
+			lengths[leaves[k]] = static_cast<uint8_t>(depths[k]);
+			longest = std::max( longest, depths[k] );
+		}
+		if (longest<=max_length) return lengths;
+
+		for (uint32_t& freq : freqs) freq=(freq+1)/2;
+	}
+}
+//	Canonical codes for the code lengths, bit-reversed (since Huffman codes are packed starting
+//		from their most-significant bit)
+static std::vector<uint16_t> _get_codes(std::vector<uint8_t> const& lengths) {
+	size_t counts[16] = {};
+	for (uint8_t length : lengths) ++counts[length];
+	counts[0] = 0;
+	uint32_t next[16] = {};
+	uint32_t code = 0;
+	for (size_t bits=1;bits<16;++bits) {
+		code = ( code + static_cast<uint32_t>(counts[bits-1]) ) << 1;
+		next[bits] = code;
+	}
+
+	std::vector<uint16_t> codes(lengths.size());
+	for (size_t k=0;k<lengths.size();++k) {
+		if (lengths[k]>0) {
+			uint32_t value = next[lengths[k]]++;
+			uint32_t reversed = 0;
+			for (size_t l=0;l<lengths[k];++l) reversed|=( (value>>l)&1u ) << (lengths[k]-1-l);
+			codes[k] = static_cast<uint16_t>(reversed);
+		}
+	}
+	return codes;
+}
+
+//	A literal byte (`dist` zero), or a match of `length` bytes `dist` back
+class _Symbol final { public:
+	uint16_t length;
+	uint16_t dist;
+};
+
+//	Write `symbols` as one block with dynamic Huffman codes
+static void _write_block(std::vector<_Symbol> const& symbols, bool final, _BitWriter* out) {
+	std::vector<uint32_t> freqs_ll(286,0u), freqs_dist(30,0u);
+	for (_Symbol const& symbol : symbols) {
+		if (symbol.dist==0) {
+			++freqs_ll[symbol.length];
+		} else {
+			++freqs_ll[ 257 + _get_length_code(symbol.length) ];
+			++freqs_dist[ _get_dist_code(symbol.dist) ];
+		}
+	}
+	freqs_ll[256] = 1; //End of block
+
+	std::vector<uint8_t> lengths_ll   = _get_code_lengths( freqs_ll,   15 );
+	std::vector<uint8_t> lengths_dist = _get_code_lengths( freqs_dist, 15 );
+	std::vector<uint16_t> codes_ll   = _get_codes(lengths_ll  );
+	std::vector<uint16_t> codes_dist = _get_codes(lengths_dist);
+
+	//Code lengths, themselves run-length and Huffman coded.  The runs are of repeats of the previous
+	//	length (16), or of zeros (17 and 18).
+	size_t num_ll=286, num_dist=30;
+	while (num_ll  >257 && lengths_ll  [num_ll  -1]==0) --num_ll;
+	while (num_dist>1   && lengths_dist[num_dist-1]==0) --num_dist;
+	std::vector<uint8_t> lengths( lengths_ll.begin(), lengths_ll.begin()+static_cast<ptrdiff_t>(num_ll) );
+	lengths.insert( lengths.end(), lengths_dist.begin(), lengths_dist.begin()+static_cast<ptrdiff_t>(num_dist) );
+
+	std::vector<std::pair<uint8_t,uint8_t>> runs; //Symbol and its extra bits' value
+	for (size_t k=0;k<lengths.size();) {
+		uint8_t length = lengths[k];
+		size_t count = 1;
+		while (k+count<lengths.size() && lengths[k+count]==length) ++count;
+		k += count;
+
+		if (length==0) {
+			while (count>=11) {
+				size_t run = std::min(count,138_zu);
+				runs.emplace_back( 18, static_cast<uint8_t>(run-11) );
+				count -= run;
+			}
+			if (count>=3) {
+				runs.emplace_back( 17, static_cast<uint8_t>(count-3) );
+				count = 0;
+			}
+		} else {
+			runs.emplace_back( length, 0 );
+			--count;
+			while (count>=3) {
+				size_t run = std::min(count,6_zu);
+				runs.emplace_back( 16, static_cast<uint8_t>(run-3) );
+				count -= run;
+			}
+		}
+		for (;count>0;--count) runs.emplace_back( length, 0 );
+	}
+	std::vector<uint32_t> freqs_cl(19,0u);
+	for (std::pair<uint8_t,uint8_t> const& run : runs) ++freqs_cl[run.first];
+	std::vector<uint8_t> lengths_cl = _get_code_lengths( freqs_cl, 7 );
+	std::vector<uint16_t> codes_cl = _get_codes(lengths_cl);
+
+	static size_t const order[19] = { 16,17,18,0,8,7,9,6,10,5,11,4,12,3,13,2,14,1,15 };
+	size_t num_cl = 19;
+	while (num_cl>4 && lengths_cl[order[num_cl-1]]==0) --num_cl;
+
+	//Header
+	out->write( final?1u:0u, 1 );
+	out->write( 2u, 2 ); //Dynamic Huffman codes
+	out->write( static_cast<uint32_t>(num_ll  -257), 5 );
+	out->write( static_cast<uint32_t>(num_dist-  1), 5 );
+	out->write( static_cast<uint32_t>(num_cl  -  4), 4 );
+	for (size_t k=0;k<num_cl;++k) out->write( lengths_cl[order[k]], 3 );
+	for (std::pair<uint8_t,uint8_t> const& run : runs) {
+		out->write( codes_cl[run.first], lengths_cl[run.first] );
+		if      (run.first==16) out->write( run.second, 2 );
+		else if (run.first==17) out->write( run.second, 3 );
+		else if (run.first==18) out->write( run.second, 7 );
+	}
+
+	//Data
+	for (_Symbol const& symbol : symbols) {
+		if (symbol.dist==0) {
+			out->write( codes_ll[symbol.length], lengths_ll[symbol.length] );
+		} else {
+			size_t lc = _get_length_code(symbol.length);
+			out->write( codes_ll[257+lc], lengths_ll[257+lc] );
+			out->write( static_cast<uint32_t>(symbol.length-_length_bases[lc]), _length_extra[lc] );
+			size_t dc = _get_dist_code(symbol.dist);
+			out->write( codes_dist[dc], lengths_dist[dc] );
+			out->write( static_cast<uint32_t>(symbol.dist-_dist_bases[dc]), _dist_extra[dc] );
+		}
+	}
+	out->write( codes_ll[256], lengths_ll[256] );
+}
+
+//	Compress `data[dict_size,size)`, which may refer back into `data[0,dict_size)` (the stream's
+//		preceding data).  Unless `final`, the output ends with an empty stored block, so that it ends
+//		on a byte boundary and more can follow it.
+static void _deflate(uint8_t const* data, size_t dict_size, size_t size, bool final, _BitWriter* out) {
+	size_t const hash_size = 1_zu << DEFLATE_HASH_BITS;
+	std::vector<int64_t> heads(hash_size,-1), prevs(DEFLATE_WINDOW,-1);
+	auto hash = [&](size_t pos) -> size_t {
+		uint32_t value = static_cast<uint32_t>(data[pos]) | static_cast<uint32_t>(data[pos+1])<<8 | static_cast<uint32_t>(data[pos+2])<<16;
+		return ( value * 2654435761u ) >> (32-DEFLATE_HASH_BITS);
+	};
+	auto insert = [&](size_t pos) -> void {
+		if (pos+3<=size) {
+			size_t h = hash(pos);
+			prevs[ pos%DEFLATE_WINDOW ] = heads[h];
+			heads[h] = static_cast<int64_t>(pos);
+		}
+	};
+	//	Longest match for the bytes at `pos`, as (length, distance); the length is zero if none
+	auto find = [&](size_t pos) -> std::pair<size_t,size_t> {
+		size_t max_length = std::min( size-pos, 258_zu );
+		if (max_length>=3); else return { 0, 0 };
+		size_t best=2, best_dist=0;
+		int64_t candidate = heads[hash(pos)];
+		for (size_t chain=0; candidate>=0&&chain<DEFLATE_MAX_CHAIN; ++chain) {
+			size_t cand = static_cast<size_t>(candidate);
+			if (pos-cand<=DEFLATE_WINDOW); else break;
+			if (data[cand+best]==data[pos+best]) {
+				size_t length = 0;
+				while (length<max_length && data[cand+length]==data[pos+length]) ++length;
+				if (length>best) {
+					best=length; best_dist=pos-cand;
+					if (length>=DEFLATE_NICE_LEN || length==max_length) break;
+				}
+			}
+			int64_t next = prevs[ cand%DEFLATE_WINDOW ];
+			if (next<candidate); else break; //Overwritten by a newer position
+			candidate = next;
+		}
+		if (best>=3) return { best, best_dist };
+		return { 0, 0 };
+	};
+
+	for (size_t pos=dict_size>DEFLATE_WINDOW?dict_size-DEFLATE_WINDOW:0; pos<dict_size; ++pos) insert(pos);
+
+	std::vector<_Symbol> symbols;
+	symbols.reserve(DEFLATE_BLOCK_SYMBOLS);
+	auto emit = [&](uint16_t length, uint16_t dist) -> void {
+		symbols.push_back({ length, dist });
+		if (symbols.size()>=DEFLATE_BLOCK_SYMBOLS) {
+			_write_block( symbols, false, out );
+			symbols.clear();
+		}
+	};
+
+	//	Lazy matching: a match is only taken if the next position doesn't start a longer one.
+	size_t prev_length=0, prev_dist=0;
+	bool prev_pending = false;
+	size_t pos = dict_size;
+	while (pos<size) {
+		std::pair<size_t,size_t> match = { 0, 0 };
+		if (!prev_pending || prev_length<DEFLATE_NICE_LEN) match=find(pos);
+		insert(pos);
+
+		if (prev_pending && prev_length>=3 && prev_length>=match.first) {
+			emit( static_cast<uint16_t>(prev_length), static_cast<uint16_t>(prev_dist) );
+			size_t end = pos - 1 + prev_length;
+			for (size_t k=pos+1;k<end;++k) insert(k);
+			pos = end;
+			prev_pending = false;
+		} else {
+			if (prev_pending) emit( data[pos-1], 0 );
+			prev_length=match.first; prev_dist=match.second;
+			prev_pending = true;
+			++pos;
+		}
+	}
+	if (prev_pending) {
+		if (prev_length>=3) emit( static_cast<uint16_t>(prev_length), static_cast<uint16_t>(prev_dist) );
+		else                emit( data[pos-1], 0 );
+	}
+
+	if (!symbols.empty() || final) _write_block( symbols, final, out );
+	if (!final) {
+		//	Empty stored block
+		out->write( 0u, 3 );
+		out->align();
+		out->write( 0x0000u, 16 );
+		out->write( 0xFFFFu, 16 );
+	}
+	out->align();
+}
+
+void compress(uint8_t const* data, size_t dict_size, size_t size, bool final, std::vector<uint8_t>* out) {
+	_BitWriter writer;
+	_deflate( data, dict_size, size, final, &writer );
+	out->insert( out->end(), writer.bytes.begin(),writer.bytes.end() );
+}
+
+std::vector<uint8_t> zlib_compress(uint8_t const* data, size_t size) {
+	std::vector<uint8_t> result = { 0x78, 0x9C }; //Header: deflate with a 32 KiB window
+	compress( data, 0, size, true, &result );
+	uint32_t adler = adler32( data, size );
+	for (int shift=24;shift>=0;shift-=8) result.push_back(static_cast<uint8_t>( adler>>shift ));
+	return result;
+}
+
+static uint32_t const _ADLER_BASE = 65521u;
+uint32_t adler32(uint8_t const* data, size_t size) {
+	uint32_t a=1u, b=0u;
+	while (size>0) {
+		//	The sums can't overflow in this many bytes before being reduced.
+		size_t count = std::min(size,5552_zu);
+		for (size_t k=0;k<count;++k) { a+=data[k]; b+=a; }
+		a%=_ADLER_BASE; b%=_ADLER_BASE;
+		data+=count; size-=count;
+	}
+	return (b<<16) | a;
+}
+uint32_t adler32_combine(uint32_t adler0, uint32_t adler1, size_t size1) {
+	uint64_t rem = size1 % _ADLER_BASE;
+	uint64_t a0=adler0&0xFFFFu, b0=adler0>>16, a1=adler1&0xFFFFu, b1=adler1>>16;
+	uint64_t a = ( a0 + a1 + _ADLER_BASE - 1 ) % _ADLER_BASE;
+	uint64_t b = ( rem*a0 + b0 + b1 + _ADLER_BASE - rem ) % _ADLER_BASE;
+	return static_cast<uint32_t>( (b<<16) | a );
+}
+
+
+
+}
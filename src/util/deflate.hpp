@@ -0,0 +1,32 @@
+#pragma once
+
+#include "../stdafx.hpp"
+
+
+
+//Deflate (RFC 1951) compression, and zlib (RFC 1950) streams of it.  Data can be compressed in
+//	independent pieces that join into one stream (see `compress(...)`), so large data can be
+//	compressed in parallel.
+namespace Deflate {
+
+
+
+//How far back compressed data can refer
+#define DEFLATE_WINDOW 32768_zu
+
+//Compress `data[dict_size,size)`, appending it to `out`.  It may refer back into `data[0,dict_size)`,
+//	which must be the stream's preceding data (if any).  Unless `final`, the output ends on a byte
+//	boundary (with an empty stored block), so that more can follow it in the stream.
+void compress(uint8_t const* data, size_t dict_size, size_t size, bool final, std::vector<uint8_t>* out);
+
+//Compress `data[0,size)` as a complete zlib stream
+std::vector<uint8_t> zlib_compress(uint8_t const* data, size_t size);
+
+//Adler-32 checksum (as ends a zlib stream) of `data[0,size)`, and the checksum of the concatenation
+//	of data with checksum `adler0` and data of size `size1` with checksum `adler1`
+uint32_t adler32(uint8_t const* data, size_t size);
+uint32_t adler32_combine(uint32_t adler0, uint32_t adler1, size_t size1);
+
+
+
+}
@@ -0,0 +1,331 @@
+#include "exr.hpp"
+
+#include "deflate.hpp"
+#include "thread-pool.hpp"
+
+#include <cstring>
+
+
+
+namespace EXR {
+
+
+
+//Values, stored little-endian
+
+static void _write_u32(std::vector<uint8_t>* data, uint32_t value) {
+	for (int shift=0;shift<32;shift+=8) data->push_back(static_cast<uint8_t>( value>>shift ));
+}
+static void _write_u64(std::vector<uint8_t>* data, uint64_t value) {
+	for (int shift=0;shift<64;shift+=8) data->push_back(static_cast<uint8_t>( value>>shift ));
+}
+static void _write_f32(std::vector<uint8_t>* data, float value) {
+	uint32_t bits; memcpy(&bits,&value,4);
+	_write_u32( data, bits );
+}
+
+//	Nearest half-precision value (rounding ties to even), as its bits.  Values too large become
+//		infinity, and ones too small denormals or zero.
+static uint16_t _to_half(float value) {
+	uint32_t bits; memcpy(&bits,&value,4);
+	uint32_t sign      = (bits>>16) & 0x8000u;
+	uint32_t magnitude =  bits      & 0x7FFFFFFFu;
+
+	if (magnitude>=0x7F800000u) { //Infinity or NaN (keeping NaN a NaN)
+		return static_cast<uint16_t>( sign | 0x7C00u | (magnitude>0x7F800000u ? 0x0200u|((magnitude>>13)&0x03FFu) : 0u) );
+	}
+	if (magnitude>=0x477FF000u) return static_cast<uint16_t>( sign | 0x7C00u ); //Rounds to at least 65536
+
+	uint32_t half;
+	uint32_t rest, tie;
+	if (magnitude>=0x38800000u) { //Normal: rebias the exponent and drop 13 bits of mantissa
+		half = (magnitude-0x38000000u) >> 13;
+		rest = magnitude & 0x1FFFu;
+		tie  = 0x1000u;
+	} else { //Denormal (multiple of 2⁻²⁴), or zero
+		if (magnitude<0x33000000u) return static_cast<uint16_t>(sign);
+		uint32_t shift = 126u - (magnitude>>23);
+		uint32_t mantissa = (magnitude&0x007FFFFFu) | 0x00800000u;
+		half = mantissa >> shift;
+		rest = mantissa & ((1u<<shift)-1u);
+		tie  = 1u << (shift-1u);
+	}
+	if (rest>tie || (rest==tie && (half&1u))) ++half; //(Carries into the exponent as needed)
+	return static_cast<uint16_t>( sign | half );
+}
+
+static void _write_value(std::vector<uint8_t>* data, TYPE type, float value) {
+	switch (type) {
+		case TYPE::UINT:
+			_write_u32( data, value>0.0f ? static_cast<uint32_t>(std::min( std::round(value), 4294967040.0f )) : 0u );
+			break;
+		case TYPE::HALF: {
+			uint16_t half = _to_half(value);
+			data->push_back(static_cast<uint8_t>( half    ));
+			data->push_back(static_cast<uint8_t>( half>>8 ));
+			break;
+		}
+		case TYPE::FLOAT:
+			_write_f32( data, value );
+			break;
+	}
+}
+
+
+
+
+//Compressing chunks
+
+//	Prepare `data` for compression as OpenEXR does: the bytes at even and odd offsets are
+//		separated into two halves (so that the more-significant bytes of values tend to be
+//		together), and each byte is replaced by its difference from the previous one.
+static std::vector<uint8_t> _predict(std::vector<uint8_t> const& data) {
+	std::vector<uint8_t> result(data.size());
+	size_t half = (data.size()+1) / 2;
+	for (size_t k=0;k<data.size();++k) result[ k%2==0 ? k/2 : half+k/2 ] = data[k];
+
+	int prev = result.empty() ? 0 : result[0];
+	for (size_t k=1;k<result.size();++k) {
+		int value = result[k];
+		result[k] = static_cast<uint8_t>( value - prev + (128+256) );
+		prev = value;
+	}
+	return result;
+}
+
+//	Run-length encode `data` as OpenEXR does: runs of 3–128 equal bytes as the length minus one and
+//		the byte, and other bytes as (minus) how many there are (up to 127) and the bytes.
+static std::vector<uint8_t> _rle(std::vector<uint8_t> const& data) {
+	size_t const min_run = 3, max_run = 127;
+	std::vector<uint8_t> result;
+	size_t size = data.size();
+	size_t begin=0, end=1;
+	while (begin<size) {
+		while (end<size && data[end]==data[begin] && end-begin-1<max_run) ++end;
+		if (end-begin>=min_run) {
+			result.push_back(static_cast<uint8_t>( end-begin-1 ));
+			result.push_back(data[begin]);
+			begin = end;
+		} else {
+			//	Literal bytes, until a run of three starts
+			while (
+				end<size &&
+				( end+1>=size || data[end]!=data[end+1] || end+2>=size || data[end+1]!=data[end+2] ) &&
+				end-begin<max_run
+			) ++end;
+			result.push_back(static_cast<uint8_t>( -static_cast<int>(end-begin) ));
+			result.insert( result.end(), data.begin()+static_cast<ptrdiff_t>(begin),data.begin()+static_cast<ptrdiff_t>(end) );
+			begin = end;
+		}
+		++end;
+	}
+	return result;
+}
+
+//	A chunk of the image: the pixels [`x0`,`x1`)×[`y0`,`y1`) (from the top left), stored
+class _Chunk final { public:
+	size_t x0,y0, x1,y1;
+	std::vector<uint8_t> data;
+};
+
+//	Convert and compress `chunk`'s pixels.  They are stored row by row, and within each row channel
+//		by channel (in the order `order`).  If compressing doesn't make them smaller, they are
+//		stored uncompressed (which readers tell by the size).
+static void _encode_chunk(
+	std::vector<Channel> const& channels, std::vector<size_t> const& order,
+	std::function<void(size_t,size_t,size_t,float*)> const& get_pixels, COMPRESSION compression,
+	_Chunk* chunk
+) {
+	size_t count = chunk->x1 - chunk->x0;
+	std::vector<float> values( count*channels.size() );
+	std::vector<uint8_t> raw;
+	for (size_t y=chunk->y0;y<chunk->y1;++y) {
+		get_pixels( y, chunk->x0, count, values.data() );
+		for (size_t c : order) {
+			for (size_t x=0;x<count;++x) _write_value( &raw, channels[c].type, values[x*channels.size()+c] );
+		}
+	}
+
+	std::vector<uint8_t> compressed;
+	switch (compression) {
+		case COMPRESSION::NONE:
+			chunk->data = std::move(raw);
+			return;
+		case COMPRESSION::RLE:
+			compressed = _rle(_predict(raw));
+			break;
+		case COMPRESSION::ZIPS:
+		case COMPRESSION::ZIP: {
+			std::vector<uint8_t> predicted = _predict(raw);
+			compressed = Deflate::zlib_compress( predicted.data(), predicted.size() );
+			break;
+		}
+	}
+	chunk->data = compressed.size()<raw.size() ? std::move(compressed) : std::move(raw);
+}
+
+
+
+//Writing the file
+
+static void _write_attribute(
+	std::vector<uint8_t>* header, std::string const& name, char const* type, std::vector<uint8_t> const& value
+) {
+	header->insert( header->end(), name.begin(),name.end() );
+	header->push_back(0);
+	header->insert( header->end(), type,type+strlen(type) );
+	header->push_back(0);
+	_write_u32( header, static_cast<uint32_t>(value.size()) );
+	header->insert( header->end(), value.begin(),value.end() );
+}
+
+bool save(
+	std::string const& path, size_t width,size_t height,
+	std::vector<Channel> const& channels,
+	std::function<void(size_t,size_t,size_t,float*)> const& get_pixels,
+	Settings const& settings/*={}*/,
+	std::vector<std::pair<std::string,std::string>> const& metadata/*={}*/, ThreadPool* pool/*=nullptr*/
+) {
+	FILE* file = fopen(path.c_str(),"wb");
+	if (file!=nullptr); else {
+		fprintf(stderr,"Could not open image \"%s\" for writing!\n",path.c_str());
+		return false;
+	}
+
+	//Channels are stored in order of name
+	std::vector<size_t> order;
+	for (size_t c=0;c<channels.size();++c) order.push_back(c);
+	std::stable_sort( order.begin(),order.end(), [&channels](size_t c0, size_t c1) -> bool {
+		return channels[c0].name < channels[c1].name;
+	});
+
+	//Chunks: tiles, or blocks of scanlines
+	bool tiled = settings.tile_size>0;
+	size_t chunk_res[2];
+	if (tiled) {
+		chunk_res[0] = settings.tile_size;
+		chunk_res[1] = settings.tile_size;
+	} else {
+		chunk_res[0] = width;
+		chunk_res[1] = settings.compression==COMPRESSION::ZIP ? 16 : 1;
+	}
+	size_t num_chunks_x = (width +chunk_res[0]-1) / chunk_res[0];
+	size_t num_chunks_y = (height+chunk_res[1]-1) / chunk_res[1];
+	size_t num_chunks = num_chunks_x * num_chunks_y;
+
+	//Header: magic number, version (with flags for tiles and names longer than 31 bytes), and
+	//	attributes (the required ones, then metadata as strings)
+	std::vector<uint8_t> header = { 0x76, 0x2F, 0x31, 0x01 };
+	bool long_names = false;
+	for (Channel const& channel : channels) long_names|=channel.name.size()>31;
+	for (auto const& entry : metadata) long_names|=entry.first.size()>31;
+	_write_u32( &header, 2u | (tiled?0x200u:0u) | (long_names?0x400u:0u) );
+	{
+		std::vector<uint8_t> value;
+		for (size_t c : order) {
+			value.insert( value.end(), channels[c].name.begin(),channels[c].name.end() );
+			value.push_back(0);
+			_write_u32( &value, static_cast<uint32_t>(channels[c].type) );
+			value.insert( value.end(), { 0, 0,0,0 } ); //Not perceptually linear; reserved
+			_write_u32( &value, 1u ); _write_u32( &value, 1u ); //Not subsampled
+		}
+		value.push_back(0);
+		_write_attribute( &header, "channels", "chlist", value );
+	}
+	_write_attribute( &header, "compression", "compression", { static_cast<uint8_t>(settings.compression) } );
+	{
+		std::vector<uint8_t> value;
+		_write_u32( &value, 0u ); _write_u32( &value, 0u );
+		_write_u32( &value, static_cast<uint32_t>(width-1) ); _write_u32( &value, static_cast<uint32_t>(height-1) );
+		_write_attribute( &header, "dataWindow",    "box2i", value );
+		_write_attribute( &header, "displayWindow", "box2i", value );
+	}
+	_write_attribute( &header, "lineOrder", "lineOrder", { 0 } ); //Increasing y
+	{
+		std::vector<uint8_t> value;
+		_write_f32( &value, 1.0f );
+		_write_attribute( &header, "pixelAspectRatio", "float", value );
+		_write_attribute( &header, "screenWindowWidth", "float", value );
+		value.clear();
+		_write_f32( &value, 0.0f ); _write_f32( &value, 0.0f );
+		_write_attribute( &header, "screenWindowCenter", "v2f", value );
+	}
+	if (tiled) {
+		std::vector<uint8_t> value;
+		_write_u32( &value, static_cast<uint32_t>(chunk_res[0]) ); _write_u32( &value, static_cast<uint32_t>(chunk_res[1]) );
+		value.push_back(0); //One level
+		_write_attribute( &header, "tiles", "tiledesc", value );
+	}
+	for (auto const& entry : metadata) {
+		_write_attribute( &header, entry.first, "string", std::vector<uint8_t>(entry.second.begin(),entry.second.end()) );
+	}
+	header.push_back(0);
+	fwrite( header.data(), 1,header.size(), file );
+
+	//Offsets of the chunks in the file, filled in once they're written
+	std::vector<uint64_t> offsets(num_chunks);
+	fwrite( offsets.data(), sizeof(uint64_t),num_chunks, file );
+	uint64_t offset = header.size() + sizeof(uint64_t)*num_chunks;
+
+	//Chunks, in order (left to right, then top to bottom).  They are converted and compressed in
+	//	parallel (on `pool`), a bounded number ahead of the one being written.
+	size_t num_ahead = pool!=nullptr ? 2*pool->get_num_threads() : 1;
+
+	std::deque<std::pair<std::future<void>,_Chunk*>> pending;
+	size_t next_chunk = 0;
+	for (size_t k=0;k<num_chunks;++k) {
+		while (next_chunk<num_chunks && next_chunk<k+num_ahead) {
+			_Chunk* chunk = new _Chunk;
+			chunk->x0 = (next_chunk%num_chunks_x) * chunk_res[0];
+			chunk->y0 = (next_chunk/num_chunks_x) * chunk_res[1];
+			chunk->x1 = std::min( chunk->x0+chunk_res[0], width  );
+			chunk->y1 = std::min( chunk->y0+chunk_res[1], height );
+			pending.emplace_back(
+				ThreadPool::submit( pool, [&channels,&order,&get_pixels,&settings,chunk]() -> void {
+					_encode_chunk( channels, order, get_pixels, settings.compression, chunk );
+				} ),
+				chunk
+			);
+			++next_chunk;
+		}
+
+		pending.front().first.wait();
+		_Chunk* chunk = pending.front().second;
+		pending.pop_front();
+
+		//	Chunk's position (tile coordinates and level, or first scanline), and its data
+		std::vector<uint8_t> prefix;
+		if (tiled) {
+			_write_u32( &prefix, static_cast<uint32_t>(k%num_chunks_x) );
+			_write_u32( &prefix, static_cast<uint32_t>(k/num_chunks_x) );
+			_write_u32( &prefix, 0u ); _write_u32( &prefix, 0u );
+		} else {
+			_write_u32( &prefix, static_cast<uint32_t>(chunk->y0) );
+		}
+		_write_u32( &prefix, static_cast<uint32_t>(chunk->data.size()) );
+		fwrite( prefix     .data(), 1,prefix     .size(), file );
+		fwrite( chunk->data.data(), 1,chunk->data.size(), file );
+
+		offsets[k] = offset;
+		offset += prefix.size() + chunk->data.size();
+
+		delete chunk;
+	}
+
+	//Go back and fill in the offsets
+	std::vector<uint8_t> table;
+	for (uint64_t chunk_offset : offsets) _write_u64( &table, chunk_offset );
+	fseek( file, static_cast<long>(header.size()), SEEK_SET );
+	fwrite( table.data(), 1,table.size(), file );
+
+	bool success = ferror(file)==0;
+	fclose(file);
+	if (success); else {
+		fprintf(stderr,"Could not write image \"%s\"!\n",path.c_str());
+	}
+	return success;
+}
+
+
+
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "../stdafx.hpp"
+
+class ThreadPool;
+
+
+
+//Writing of OpenEXR images, in parallel.  The image is stored in chunks (blocks of scanlines, or
+//	tiles), which are converted and compressed on separate threads and written in order as they
+//	complete, so the whole image is never held in memory.  Of the standard compression methods,
+//	those that are lossless and need nothing beyond deflate are supported.
+namespace EXR {
+
+
+
+//Type of a channel's values
+enum class TYPE { UINT=0, HALF=1, FLOAT=2 };
+
+//How chunks are compressed: not at all, run-length encoded, or deflated in blocks of one
+//	scanline (`ZIPS`) or sixteen (`ZIP`; usually smaller).  Tiles are compressed whole.
+enum class COMPRESSION { NONE=0, RLE=1, ZIPS=2, ZIP=3 };
+
+//How an image is stored
+class Settings final { public:
+	//Type of the color (and alpha) channels
+	TYPE type = TYPE::HALF;
+
+	COMPRESSION compression = COMPRESSION::ZIP;
+
+	//Size of the (square) tiles, or zero to store scanlines
+	size_t tile_size = 0;
+};
+
+//Channel of an image
+class Channel final { public:
+	std::string name;
+	TYPE type;
+};
+
+//Save a `width`×`height` image with the given channels to `path`, along with textual metadata
+//	(key-value pairs).  The pixels are provided by `get_pixels(y,x,count,values)`, which fills
+//	`count` pixels of row `y` (from the top), starting at column `x`, with their values (pixel by
+//	pixel, in the order of `channels`); it is called from `pool`'s threads at once (or only from the
+//	calling thread, if `pool` is null).  Returns whether the write succeeded.
+bool save(
+	std::string const& path, size_t width,size_t height,
+	std::vector<Channel> const& channels,
+	std::function<void(size_t,size_t,size_t,float*)> const& get_pixels,
+	Settings const& settings={},
+	std::vector<std::pair<std::string,std::string>> const& metadata={}, ThreadPool* pool=nullptr
+);
+
+
+
+}
@@ -0,0 +1,75 @@
+#include "mapped-file.hpp"
+
+#ifdef _WIN32
+	#define NOMINMAX
+	#include <windows.h>
+#else
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <unistd.h>
+#endif
+
+
+
+MappedFile::MappedFile(std::string const& path, size_t size, bool temporary/*=false*/) :
+	_data(nullptr), _size(size)
+{
+	auto fail = [&](char const* what) -> void {
+		fprintf(stderr,"Could not %s file \"%s\" (%zu bytes)!\n",what,path.c_str(),size);
+		throw -1;
+	};
+
+	#ifdef _WIN32
+		_mapping = nullptr;
+		_file = CreateFileA(
+			path.c_str(), GENERIC_READ|GENERIC_WRITE, FILE_SHARE_READ|FILE_SHARE_DELETE, nullptr, CREATE_ALWAYS,
+			temporary ? FILE_ATTRIBUTE_TEMPORARY|FILE_FLAG_DELETE_ON_CLOSE : FILE_ATTRIBUTE_NORMAL, nullptr
+		);
+		if (_file!=INVALID_HANDLE_VALUE); else fail("create");
+		if (size==0) return;
+
+		//	Mapping the file extends it to the size.
+		_mapping = CreateFileMappingA(
+			_file, nullptr, PAGE_READWRITE,
+			static_cast<DWORD>(static_cast<uint64_t>(size)>>32), static_cast<DWORD>(size), nullptr
+		);
+		if (_mapping!=nullptr); else { CloseHandle(_file); fail("map"); }
+		_data = static_cast<uint8_t*>(MapViewOfFile( _mapping, FILE_MAP_ALL_ACCESS, 0,0, size ));
+		if (_data!=nullptr); else { CloseHandle(_mapping); CloseHandle(_file); fail("map"); }
+	#else
+		_fd = open( path.c_str(), O_RDWR|O_CREAT|O_TRUNC, 0644 );
+		if (_fd>=0); else fail("create");
+		if (temporary) unlink(path.c_str());
+		if (size==0) return;
+
+		//	The file is extended sparsely, so pages that are never written take no space.
+		if (ftruncate( _fd, static_cast<off_t>(size) )==0); else { close(_fd); fail("allocate"); }
+		void* data = mmap( nullptr, size, PROT_READ|PROT_WRITE, MAP_SHARED, _fd, 0 );
+		if (data!=MAP_FAILED); else { close(_fd); fail("map"); }
+		_data = static_cast<uint8_t*>(data);
+	#endif
+}
+MappedFile::~MappedFile() {
+	#ifdef _WIN32
+		if (_data   !=nullptr) UnmapViewOfFile(_data);
+		if (_mapping!=nullptr) CloseHandle(_mapping);
+		CloseHandle(_file);
+	#else
+		if (_data!=nullptr) munmap( _data, _size );
+		close(_fd);
+	#endif
+}
+
+void MappedFile::flush(size_t offset, size_t size) const {
+	if (size>0); else return;
+	assert(offset+size<=_size);
+
+	#ifdef _WIN32
+		FlushViewOfFile( _data+offset, size );
+	#else
+		//	The range must start on a page.
+		static size_t const page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+		size_t begin = offset / page_size * page_size;
+		msync( _data+begin, offset+size-begin, MS_ASYNC );
+	#endif
+}
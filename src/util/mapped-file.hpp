@@ -0,0 +1,35 @@
+#pragma once
+
+#include "../stdafx.hpp"
+
+
+
+//A file mapped into memory, so that the OS pages its contents in and out as they're used, rather
+//	than all of them being held in memory.  Writes to the memory are visible to other processes
+//	reading the file right away, and reach the disk in the background (or when flushed).
+class MappedFile final {
+	private:
+		#ifdef _WIN32
+		void* _file;
+		void* _mapping;
+		#else
+		int _fd;
+		#endif
+
+		uint8_t* _data;
+		size_t _size;
+
+	public:
+		//Create (or replace) the file at `path` with `size` bytes (zeros), and map it.  If
+		//	`temporary`, it's deleted when closed (or right away, where the OS allows it), which
+		//	makes it just backing for the memory.
+		MappedFile(std::string const& path, size_t size, bool temporary=false);
+		~MappedFile();
+
+		uint8_t* get_data() const { return _data; }
+		size_t   get_size() const { return _size; }
+
+		//Start writing the bytes [`offset`,`offset+size`) to the disk, if they've changed (without
+		//	waiting for them).
+		void flush(size_t offset, size_t size) const;
+};
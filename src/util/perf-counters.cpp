@@ -0,0 +1,112 @@
+#include "perf-counters.hpp"
+
+#include <cstring>
+
+#ifdef __linux__
+	#include <linux/perf_event.h>
+	#include <sys/ioctl.h>
+	#include <sys/syscall.h>
+	#include <unistd.h>
+#endif
+
+
+
+char const*const PerfCounters::event_names[NUM_EVENTS] = {
+	"cycles", "instructions", "cache_references", "cache_misses", "branches", "branch_misses"
+};
+
+PerfCounters::Values  PerfCounters::Values::operator- (Values const& other) const {
+	Values result;
+	for (size_t k=0;k<NUM_EVENTS;++k) result.counts[k]=counts[k]-other.counts[k];
+	result.time = time - other.time;
+	return result;
+}
+PerfCounters::Values& PerfCounters::Values::operator+=(Values const& other) {
+	for (size_t k=0;k<NUM_EVENTS;++k) counts[k]+=other.counts[k];
+	time += other.time;
+	return *this;
+}
+
+PerfCounters::PerfCounters(bool enable, bool inherit/*=false*/) :
+	_inherit(inherit), _available(false)
+{
+	for (int& fd : _fds) fd=-1;
+	if (enable); else return;
+
+	#ifdef __linux__
+	static uint64_t const configs[NUM_EVENTS] = {
+		PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+		PERF_COUNT_HW_CACHE_REFERENCES, PERF_COUNT_HW_CACHE_MISSES,
+		PERF_COUNT_HW_BRANCH_INSTRUCTIONS, PERF_COUNT_HW_BRANCH_MISSES
+	};
+	for (size_t k=0;k<NUM_EVENTS;++k) {
+		struct perf_event_attr attr;
+		memset(&attr,0,sizeof(attr));
+		attr.size           = sizeof(attr);
+		attr.type           = PERF_TYPE_HARDWARE;
+		attr.config         = configs[k];
+		attr.disabled       = k==0||inherit ? 1 : 0; //The group starts when its leader is enabled
+		attr.inherit        = inherit ? 1 : 0;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv     = 1;
+		attr.read_format    = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+		if (!inherit) attr.read_format|=PERF_FORMAT_GROUP;
+
+		//	Calling thread, any CPU
+		_fds[k] = static_cast<int>(syscall( SYS_perf_event_open, &attr, 0,-1, k==0||inherit?-1:_fds[0], 0ul ));
+		if (_fds[k]>=0); else {
+			for (size_t l=0;l<k;++l) close(_fds[l]);
+			for (int& fd : _fds) fd=-1;
+			return;
+		}
+	}
+	if (inherit) {
+		for (int fd : _fds) {
+			ioctl( fd, PERF_EVENT_IOC_RESET,  0 );
+			ioctl( fd, PERF_EVENT_IOC_ENABLE, 0 );
+		}
+	} else {
+		ioctl( _fds[0], PERF_EVENT_IOC_RESET,  PERF_IOC_FLAG_GROUP );
+		ioctl( _fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP );
+	}
+	_available = true;
+	#endif
+}
+PerfCounters::~PerfCounters() {
+	#ifdef __linux__
+	for (int fd : _fds) {
+		if (fd>=0) close(fd);
+	}
+	#endif
+}
+
+void PerfCounters::read(Values* values) const {
+	values->time = static_cast<double>(
+		std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count()
+	) * 1.0e-9;
+	for (uint64_t& count : values->counts) count=0;
+
+	#ifdef __linux__
+	if (_available); else return;
+
+	//	Each event alone: its count, time enabled, and time running.
+	if (_inherit) {
+		for (size_t k=0;k<NUM_EVENTS;++k) {
+			uint64_t data[3];
+			if (::read( _fds[k], data, sizeof(data) ) == static_cast<ssize_t>(sizeof(data))); else continue;
+			double scale = data[2]>0 ? static_cast<double>(data[1])/static_cast<double>(data[2]) : 0.0;
+			values->counts[k] = static_cast<uint64_t>( static_cast<double>(data[0]) * scale );
+		}
+		return;
+	}
+
+	//	Layout given by `PERF_FORMAT_GROUP` and the time formats: count, time enabled, time running,
+	//		then the values.
+	uint64_t data[ 3 + NUM_EVENTS ];
+	if (::read( _fds[0], data, sizeof(data) ) == static_cast<ssize_t>(sizeof(data))); else return;
+	double scale = data[2]>0 ? static_cast<double>(data[1])/static_cast<double>(data[2]) : 0.0;
+	for (size_t k=0;k<NUM_EVENTS;++k) {
+		values->counts[k] = static_cast<uint64_t>( static_cast<double>(data[3+k]) * scale );
+	}
+	#endif
+}
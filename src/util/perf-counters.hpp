@@ -0,0 +1,52 @@
+#pragma once
+
+#include "../stdafx.hpp"
+
+
+
+//Hardware performance counters of the calling thread (and optionally of the threads it creates;
+//	user-space only), through Linux's `perf_event_open(...)`.  Where they are unavailable (other
+//	platforms, or where the kernel forbids it, as in many containers), the counters read as zero and
+//	`.is_available()` is false.
+class PerfCounters final {
+	public:
+		enum EVENT {
+			CYCLES, INSTRUCTIONS,
+			CACHE_REFERENCES, CACHE_MISSES, //Last-level cache
+			BRANCHES, BRANCH_MISSES,
+			NUM_EVENTS
+		};
+		static char const*const event_names[NUM_EVENTS];
+
+		//Counts (and the wall-clock time, in seconds) over some span, or a sum of them
+		class Values final { public:
+			uint64_t counts[NUM_EVENTS];
+			double time;
+
+			Values() : counts{}, time(0.0) {}
+
+			Values  operator- (Values const& other) const;
+			Values& operator+=(Values const& other);
+		};
+
+	private:
+		//File descriptors of the events (the first leads the group, so they're read together, unless
+		//	`_inherit`)
+		int _fds[NUM_EVENTS];
+		bool _inherit;
+		bool _available;
+
+	public:
+		//Open the counters for the calling thread (if `enable`; otherwise they're just unavailable).
+		//	If `inherit`, threads it creates afterward are counted too, once they have exited (e.g.
+		//	a thread pool's, after it's destroyed).  The kernel can't read inherited events as a
+		//	group, so they're then read one at a time.
+		explicit PerfCounters(bool enable, bool inherit=false);
+		~PerfCounters();
+
+		bool is_available() const { return _available; }
+
+		//The counts since the counters were opened, and the current time.  Counts are scaled up if
+		//	the kernel had to share the hardware counters with other events.
+		void read(Values* values) const;
+};
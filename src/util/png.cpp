@@ -0,0 +1,215 @@
+#include "png.hpp"
+
+#include "deflate.hpp"
+#include "thread-pool.hpp"
+
+
+
+namespace PNG {
+
+
+
+//Uncompressed size of each band (roughly; bands are whole rows)
+#define PNG_BAND_SIZE (1_zu<<20)
+
+
+
+//Checksums
+
+static uint32_t _crc32(uint32_t crc, uint8_t const* data, size_t size) {
+	static std::array<uint32_t,256> const table = []() -> std::array<uint32_t,256> {
+		std::array<uint32_t,256> result;
+		for (uint32_t k=0;k<256;++k) {
+			uint32_t value = k;
+			for (size_t l=0;l<8;++l) value = value&1u ? 0xEDB88320u^(value>>1) : value>>1;
+			result[k] = value;
+		}
+		return result;
+	}();
+	crc = ~crc;
+	for (size_t k=0;k<size;++k) crc = table[ (crc^data[k]) & 0xFFu ] ^ (crc>>8);
+	return ~crc;
+}
+
+
+
+
+//Filtering and compressing bands of rows
+
+//	A band of rows [`y0`,`y1`), compressed
+class _Band final { public:
+	size_t y0, y1;
+	std::vector<uint8_t> compressed;
+	uint32_t adler; //Checksum of the filtered (uncompressed) data
+	size_t size;    //Size of the filtered data
+};
+
+//	Filter row `cur` (with the previous row `prev`, or zeros) into `out` (a filter type byte and
+//		the filtered bytes), choosing the filter with the smallest sum of absolute (signed) values
+static void _filter_row(uint8_t const* cur, uint8_t const* prev, size_t row_size, uint8_t* out, uint8_t* scratch) {
+	size_t const bpp = 4;
+	auto paeth = [](int a, int b, int c) -> int {
+		int p=a+b-c, pa=std::abs(p-a), pb=std::abs(p-b), pc=std::abs(p-c);
+		if (pa<=pb && pa<=pc) return a;
+		if (pb<=pc) return b;
+		return c;
+	};
+
+	//	Each filter predicts a byte from those to its left (`a`), above (`b`), and above-left (`c`).
+	auto apply = [&](uint8_t type, auto const& predict) -> size_t {
+		size_t sum = 0;
+		for (size_t k=0;k<row_size;++k) {
+			int a = k>=bpp ? cur[k-bpp] : 0;
+			int b = prev!=nullptr ? prev[k] : 0;
+			int c = k>=bpp&&prev!=nullptr ? prev[k-bpp] : 0;
+			uint8_t value = static_cast<uint8_t>( cur[k] - predict(a,b,c) );
+			scratch[k] = value;
+			sum += type==0 ? value : static_cast<size_t>(std::abs(static_cast<int>(static_cast<int8_t>(value))));
+		}
+		return sum;
+	};
+
+	size_t best_sum = ~0_zu;
+	for (uint8_t type=0;type<5;++type) {
+		size_t sum;
+		switch (type) {
+			case 0:  sum=apply( type, [](int  ,int  ,int  ) -> int { return 0;           } ); break;
+			case 1:  sum=apply( type, [](int a,int  ,int  ) -> int { return a;           } ); break;
+			case 2:  sum=apply( type, [](int  ,int b,int  ) -> int { return b;           } ); break;
+			case 3:  sum=apply( type, [](int a,int b,int  ) -> int { return (a+b)/2;     } ); break;
+			default: sum=apply( type, [&](int a,int b,int c) -> int { return paeth(a,b,c); } ); break;
+		}
+		if (sum<best_sum) {
+			best_sum = sum;
+			out[0] = type;
+			std::copy_n( scratch, row_size, out+1 );
+		}
+	}
+}
+
+//	Filter and compress `band` (whose rows are set).  The preceding rows are filtered too, to serve
+//		as the dictionary.
+static void _compress_band(
+	size_t width,size_t height, std::function<void(size_t,uint8_t*)> const& get_row, _Band* band
+) {
+	size_t row_size = 4 * width;
+	size_t dict_rows = std::min( (DEFLATE_WINDOW+row_size)/(row_size+1), band->y0 );
+	size_t y_begin = band->y0 - dict_rows;
+
+	std::vector<uint8_t> rows[2] = { std::vector<uint8_t>(row_size), std::vector<uint8_t>(row_size) };
+	std::vector<uint8_t> scratch(row_size);
+	std::vector<uint8_t> filtered( (band->y1-y_begin)*(row_size+1) );
+	bool has_prev = y_begin>0;
+	if (has_prev) get_row( y_begin-1, rows[(y_begin+1)%2].data() );
+	for (size_t y=y_begin;y<band->y1;++y) {
+		std::vector<uint8_t>& cur  = rows[  y   %2 ];
+		std::vector<uint8_t>& prev = rows[ (y+1)%2 ];
+		get_row( y, cur.data() );
+		_filter_row( cur.data(), has_prev?prev.data():nullptr, row_size, filtered.data()+(y-y_begin)*(row_size+1), scratch.data() );
+		has_prev = true;
+	}
+
+	size_t dict_size = dict_rows * (row_size+1);
+	band->size = filtered.size() - dict_size;
+	band->adler = Deflate::adler32( filtered.data()+dict_size, band->size );
+
+	Deflate::compress( filtered.data(), dict_size, filtered.size(), band->y1==height, &band->compressed );
+}
+
+
+
+//Writing the file
+
+static void _write_u32(std::vector<uint8_t>* data, uint32_t value) {
+	for (int shift=24;shift>=0;shift-=8) data->push_back(static_cast<uint8_t>( value>>shift ));
+}
+static void _write_chunk(FILE* file, char const type[4], std::vector<uint8_t> const& data) {
+	std::vector<uint8_t> header;
+	_write_u32( &header, static_cast<uint32_t>(data.size()) );
+	header.insert( header.end(), type,type+4 );
+	uint32_t crc = _crc32( 0u, header.data()+4, 4 );
+	crc = _crc32( crc, data.data(), data.size() );
+	std::vector<uint8_t> footer;
+	_write_u32( &footer, crc );
+
+	fwrite( header.data(), 1,header.size(), file );
+	fwrite( data  .data(), 1,data  .size(), file );
+	fwrite( footer.data(), 1,footer.size(), file );
+}
+
+bool save(
+	std::string const& path, size_t width,size_t height,
+	std::function<void(size_t,uint8_t*)> const& get_row,
+	std::vector<std::pair<std::string,std::string>> const& metadata/*={}*/, ThreadPool* pool/*=nullptr*/
+) {
+	FILE* file = fopen(path.c_str(),"wb");
+	if (file!=nullptr); else {
+		fprintf(stderr,"Could not open image \"%s\" for writing!\n",path.c_str());
+		return false;
+	}
+
+	//Signature, header (8-bit RGBA, not interlaced), and metadata
+	uint8_t const signature[8] = { 0x89,'P','N','G','\r','\n',0x1A,'\n' };
+	fwrite( signature, 1,8, file );
+	{
+		std::vector<uint8_t> data;
+		_write_u32( &data, static_cast<uint32_t>(width ) );
+		_write_u32( &data, static_cast<uint32_t>(height) );
+		data.insert( data.end(), { 8, 6, 0, 0, 0 } );
+		_write_chunk( file, "IHDR", data );
+	}
+	for (auto const& entry : metadata) {
+		std::vector<uint8_t> data( entry.first.begin(), entry.first.end() );
+		data.push_back(0);
+		data.insert( data.end(), entry.second.begin(), entry.second.end() );
+		_write_chunk( file, "tEXt", data );
+	}
+
+	//Image data: one zlib stream, written as an "IDAT" chunk per band.  Bands are compressed in
+	//	parallel (on `pool`), a bounded number ahead of the one being written.
+	size_t rows_per_band = std::max( PNG_BAND_SIZE/(4*width+1), 1_zu );
+	size_t num_bands = (height+rows_per_band-1) / rows_per_band;
+	size_t num_ahead = pool!=nullptr ? 2*pool->get_num_threads() : 1;
+
+	std::deque<std::pair<std::future<void>,_Band*>> pending;
+	size_t next_band = 0;
+	uint32_t adler = 1u;
+	for (size_t k=0;k<num_bands;++k) {
+		while (next_band<num_bands && next_band<k+num_ahead) {
+			_Band* band = new _Band;
+			band->y0 =          next_band   *rows_per_band;
+			band->y1 = std::min((next_band+1)*rows_per_band, height);
+			pending.emplace_back(
+				ThreadPool::submit( pool, [width,height,&get_row,band]() -> void { _compress_band( width,height, get_row, band ); } ),
+				band
+			);
+			++next_band;
+		}
+
+		pending.front().first.wait();
+		_Band* band = pending.front().second;
+		pending.pop_front();
+
+		adler = Deflate::adler32_combine( adler, band->adler, band->size );
+		std::vector<uint8_t> data;
+		if (k==0) data.insert( data.end(), { 0x78, 0x9C } ); //zlib header: deflate with a 32 KiB window
+		data.insert( data.end(), band->compressed.begin(),band->compressed.end() );
+		if (k==num_bands-1) _write_u32( &data, adler );
+		_write_chunk( file, "IDAT", data );
+
+		delete band;
+	}
+
+	_write_chunk( file, "IEND", {} );
+
+	bool success = ferror(file)==0;
+	fclose(file);
+	if (success); else {
+		fprintf(stderr,"Could not write image \"%s\"!\n",path.c_str());
+	}
+	return success;
+}
+
+
+
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include "../stdafx.hpp"
+
+class ThreadPool;
+
+
+
+//Writing of (8-bit RGBA) PNG images, in parallel.  The image is split into bands of rows, which are
+//	filtered and compressed on separate threads and written in order as they complete, so the whole
+//	image is never held in memory.  As in pigz, each band is compressed with the end of the previous
+//	band as its dictionary, and ends on a byte boundary (with an empty stored block), so the bands
+//	join into a single zlib stream that compresses nearly as well as a serial one.
+namespace PNG {
+
+
+
+//Save a `width`×`height` image to `path`, along with textual metadata (key-value pairs).  The rows
+//	are provided by `get_row(y,row)`, which fills row `y` (from the top) as `width` RGBA pixels; it
+//	is called from `pool`'s threads at once (or only from the calling thread, if `pool` is null).
+//	Returns whether the write succeeded.
+bool save(
+	std::string const& path, size_t width,size_t height,
+	std::function<void(size_t,uint8_t*)> const& get_row,
+	std::vector<std::pair<std::string,std::string>> const& metadata={}, ThreadPool* pool=nullptr
+);
+
+
+
+}
@@ -8,17 +8,42 @@ namespace Math {
 
 
 
-Dir rand_sphere(RNG& rng, float* pdf) {
+uint32_t permute(uint32_t i, uint32_t length, uint32_t seed) {
+	//Kensler's hash is a bijection on the smallest power-of-two range containing `length`, so
+	//	"cycle-walk" until the result lands inside.  This takes fewer than two iterations on average.
+	assert(i<length);
+	uint32_t w = length - 1u;
+	w |= w >>  1u;
+	w |= w >>  2u;
+	w |= w >>  4u;
+	w |= w >>  8u;
+	w |= w >> 16u;
+	do {
+		i ^= seed;            i *= 0xE170893Du;
+		i ^= seed >> 16u;     i ^= (i&w) >>  4u;
+		i ^= seed >>  8u;     i *= 0x0929EB3Fu;
+		i ^= seed >> 23u;     i ^= (i&w) >>  1u;
+		i *= 1u|(seed>>27u);  i *= 0x6935FA69u;
+		i ^= (i&w) >> 11u;    i *= 0x74DCB303u;
+		i ^= (i&w) >>  2u;    i *= 0x9E501CC3u;
+		i ^= (i&w) >>  2u;    i *= 0xC860A3DFu;
+		i &= w;
+		i ^= i >> 5u;
+	} while (i>=length);
+	return (i+seed) % length;
+}
+
+Dir rand_sphere(glm::vec2 const& u, float* pdf) {
 	*pdf = static_cast<float>( 1.0 / (4.0*Constants::pi<double>) );
 
 	//Pick a random z-coordinate, then pick a random point on the circle.  This works out to be
 	//	evenly sampled.
 
-	float z = 2.0f*rand_1f(rng) - 1.0f;
+	float z = 2.0f*u[0] - 1.0f;
 	assert(z>=-1.0f&&z<=1.0f);
 	float radius_circle = std::sqrt( 1.0f - z*z );
 
-	radians angle = rand_1f(rng) * static_cast<float>(2.0*Constants::pi<double>);
+	radians angle = u[1] * static_cast<float>(2.0*Constants::pi<double>);
 
 	float c = std::cos(angle);
 	float s = std::sin(angle);
@@ -26,36 +51,35 @@ Dir rand_sphere(RNG& rng, float* pdf) {
 	return Dir(radius_circle*c,radius_circle*s,z);
 }
 
-Dir rand_coshemi(RNG& rng, float* pdf) {
-	Dir result;
-	do {
-		radians angle = rand_1f(rng) * (2.0f*Constants::pi<float>);
-		float c = std::cos(angle);
-		float s = std::sin(angle);
+Dir rand_coshemi(glm::vec2 const& u, float* pdf) {
+	radians angle = u[0] * (2.0f*Constants::pi<float>);
+	float c = std::cos(angle);
+	float s = std::sin(angle);
 
-		float radius_sq = rand_1f(rng);
-		float radius = std::sqrt(radius_sq);
+	//Directions within `EPS` of the horizon are avoided (they have almost no contribution and an
+	//	almost-zero PDF).  Rescaling the radius to exclude them draws from exactly the distribution
+	//	that rejecting them would, but keeps the map from `u` one-to-one (and so, stratified).
+	float radius_sq = u[1] * ( 1.0f - EPS*EPS );
+	float radius = std::sqrt(radius_sq);
 
-		result = Dir(
-			radius * c,
-			std::sqrt( 1 - radius_sq ),
-			radius * s
-		);
-		*pdf = result[1];
-	} while (*pdf<=EPS);
-	*pdf *= 1.0f / Constants::pi<float>;
+	Dir result = Dir(
+		radius * c,
+		std::sqrt( 1 - radius_sq ),
+		radius * s
+	);
+	*pdf = result[1] * ( 1.0f / Constants::pi<float> );
 
 	return result;
 }
 
-Dir rand_toward_sphere(RNG& rng, Dir const& vec_to_sph_cen,float sph_radius, float*__restrict pdf) {
+Dir rand_toward_sphere(glm::vec2 const& u, Dir const& vec_to_sph_cen,float sph_radius, float*__restrict pdf) {
 	//Note: needs to be at least double-precision.
 
 	double l = glm::length(glm::dvec3(vec_to_sph_cen));
 	if (l<static_cast<double>(sph_radius)) {
 		//We're starting inside the sphere.  Every direction hits.
 
-		return rand_sphere(rng,pdf);
+		return rand_sphere(u,pdf);
 	} else {
 		//We're outside or on the sphere.
 
@@ -82,9 +106,9 @@ Dir rand_toward_sphere(RNG& rng, Dir const& vec_to_sph_cen,float sph_radius, flo
 
 		//Generate random vector within cone.  This can be computed in `float`, but we might as well
 		//	continue with `double` since we have a lot of the stuff we need already . . .
-		double y = rand_1d(rng)*(1.0-cos_theta) + cos_theta;
+		double y = static_cast<double>(u[0])*(1.0-cos_theta) + cos_theta;
 		assert(y>=cos_theta&&y<=1.0);
-		double phi = rand_1d(rng) * (2.0*Constants::pi<double>);
+		double phi = static_cast<double>(u[1]) * (2.0*Constants::pi<double>);
 		double radius = std::sqrt( 1.0 - y*y );
 
 		double c = std::cos(phi);
@@ -98,12 +122,12 @@ Dir rand_toward_sphere(RNG& rng, Dir const& vec_to_sph_cen,float sph_radius, flo
 	}
 }
 
-Dir rand_toward_sphericaltri(RNG& rng, SphericalTriangle const& tri) {
+Dir rand_toward_sphericaltri(glm::vec2 const& u, SphericalTriangle const& tri) {
 	//From "Stratified sampling of spherical triangles" by James Arvo:
 	//	http://www.graphics.cornell.edu/pubs/1995/Arv95c.pdf
 
-	float r0 = rand_1f(rng);
-	float r1 = rand_1f(rng);
+	float r0 = u[0];
+	float r1 = u[1];
 
 	float sin_alpha = std::sin(tri.alpha);
 	assert(sin_alpha>=0);
@@ -153,6 +177,48 @@ Dir rand_toward_sphericaltri(RNG& rng, SphericalTriangle const& tri) {
 	return result;
 }
 
+Dir rand_toward_sphericalrect(glm::vec2 const& u, SphericalRectangle const& rect) {
+	//From "An Area-Preserving Parametrization for Spherical Rectangles" by Ureña et al.:
+	//	https://www.arnoldrenderer.com/research/egsr2013_spherical_rectangle.pdf
+
+	if (rect.surface_area>0.0f); else {
+		//Degenerate (seen edge-on).  Any direction toward the rectangle is as good as another.
+		Pos center = Pos(
+			0.5f*(rect.x0+rect.x1),
+			0.5f*(rect.y0+rect.y1),
+			rect.z0
+		);
+		return glm::normalize( center.x*rect.x + center.y*rect.y + center.z*rect.z );
+	}
+
+	float r0 = u[0];
+	float r1 = u[1];
+
+	//Compute the "x" coordinate of the sample by inverting the (analytic) CDF of the area of the
+	//	spherical rectangle to the left of the line "x=xu".
+	radians au = r0*rect.surface_area + rect.k;
+	float fu = ( std::cos(au)*rect.b0 - rect.b1 ) / std::sin(au);
+	float cu = std::copysign( 1.0f, fu ) / std::sqrt( fu*fu + rect.b0*rect.b0 );
+	cu = glm::clamp( cu, -1.0f,1.0f ); //Numerical issues
+	float xu = -(cu*rect.z0) / std::sqrt(std::max( 1.0f-cu*cu, 0.0f ));
+	xu = glm::clamp( xu, rect.x0,rect.x1 ); //Numerical issues (also catches the ±∞ from `cu=±1`)
+
+	//Compute the "y" coordinate of the sample by (linearly) interpolating the heights of the
+	//	corresponding points on the edges, as projected onto the sphere.
+	float d_sq = xu*xu + rect.z0*rect.z0;
+	float d = std::sqrt(d_sq);
+	float h0 = rect.y0 / std::sqrt( d_sq + rect.y0*rect.y0 );
+	float h1 = rect.y1 / std::sqrt( d_sq + rect.y1*rect.y1 );
+	float hv = h0 + r1*(h1-h0);
+	float hv_sq = hv * hv;
+	float yv = hv_sq<1.0f-1.0e-6f ? (hv*d)/std::sqrt(1.0f-hv_sq) : rect.y1;
+
+	Dir result = glm::normalize( xu*rect.x + yv*rect.y + rect.z0*rect.z );
+	assert(!std::isnan(result.x)&&!std::isnan(result.y)&&!std::isnan(result.z));
+	return result;
+}
+
+
 
 
 }
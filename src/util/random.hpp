@@ -2,6 +2,7 @@
 
 #include "../stdafx.hpp"
 
+#include "spherical-rect.hpp"
 #include "spherical-tri.hpp"
 
 
@@ -64,9 +65,34 @@ class RNG {
 };
 
 
+//Philox-4⨯32-10, a counter-based RNG.  It has no state: it maps a 128-bit counter and 64-bit key
+//	to 128 random bits, so any value in the sequence can be computed directly, in any order, on any
+//	thread.  From "Parallel Random Numbers: As Easy as 1, 2, 3" by Salmon et al.:
+//		https://www.thesalmons.org/john/random123/papers/random123sc11.pdf
+inline std::array<uint32_t,4> philox4x32(std::array<uint32_t,4> counter, std::array<uint32_t,2> key) {
+	for (int round=0;round<10;++round) {
+		uint64_t prod0 = static_cast<uint64_t>(0xD2511F53u) * counter[0];
+		uint64_t prod1 = static_cast<uint64_t>(0xCD9E8D57u) * counter[2];
+		counter = {
+			static_cast<uint32_t>(prod1>>32u) ^ counter[1] ^ key[0], static_cast<uint32_t>(prod1),
+			static_cast<uint32_t>(prod0>>32u) ^ counter[3] ^ key[1], static_cast<uint32_t>(prod0)
+		};
+		key[0] += 0x9E3779B9u;
+		key[1] += 0xBB67AE85u;
+	}
+	return counter;
+}
+
+
+
+//Converts 32 random bits to a float in [0,1).  Only the high 24 bits fit in the mantissa; using
+//	exactly those means every result is exactly representable and `1` can never be produced.
+inline float u32_to_1f(uint32_t bits) {
+	return static_cast<float>( bits >> 8u ) * 0x1p-24f;
+}
 
 inline float  rand_1f(RNG& rng) {
-	return std::uniform_real_distribution<float >()(rng);
+	return u32_to_1f(rng());
 }
 inline double rand_1d(RNG& rng) {
 	return std::uniform_real_distribution<double>()(rng);
@@ -77,13 +103,42 @@ inline size_t rand_choice(RNG& rng, size_t length) {
 	return dist(rng);
 }
 
-Dir rand_sphere(RNG& rng, float* pdf);
 
-Dir rand_coshemi(RNG& rng, float* pdf);
 
-Dir rand_toward_sphere(RNG& rng, Dir const& vec_to_sph_cen,float sph_radius, float*__restrict pdf);
+//Integer hash with good avalanche behavior ("lowbias32"):
+//	https://nullprogram.com/blog/2018/07/31/
+inline uint32_t hash_u32(uint32_t x                ) {
+	x ^= x >> 16u;
+	x *= 0x7FEB352Du;
+	x ^= x >> 15u;
+	x *= 0x846CA68Bu;
+	x ^= x >> 16u;
+	return x;
+}
+inline uint32_t hash_u32(uint32_t x, uint32_t seed) {
+	return hash_u32( x ^ hash_u32(seed+0x9E3779B9u) );
+}
+
+//Element `i` of a random permutation of [0,`length`) selected by `seed`, computed without storing
+//	the permutation.  From "Correlated Multi-Jittered Sampling" by Andrew Kensler:
+//		https://graphics.pixar.com/library/MultiJitteredSampling/paper.pdf
+uint32_t permute(uint32_t i, uint32_t length, uint32_t seed);
+
+
+
+//Warps from the unit square to the given domains.  The argument `u` is a point in [0,1)², which
+//	should come from a random source or sampler.  If it is well-stratified, so are the results.
+
+Dir rand_sphere(glm::vec2 const& u, float* pdf);
+
+Dir rand_coshemi(glm::vec2 const& u, float* pdf);
+
+Dir rand_toward_sphere(glm::vec2 const& u, Dir const& vec_to_sph_cen,float sph_radius, float*__restrict pdf);
+
+Dir rand_toward_sphericaltri (glm::vec2 const& u, SphericalTriangle  const& tri );
+
+Dir rand_toward_sphericalrect(glm::vec2 const& u, SphericalRectangle const& rect);
 
-Dir rand_toward_sphericaltri(RNG& rng, SphericalTriangle const& tri);
 
 
 
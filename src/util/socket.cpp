@@ -0,0 +1,294 @@
+#include "socket.hpp"
+
+#include "string.hpp"
+
+#ifdef _WIN32
+	#include <winsock2.h>
+	#include <ws2tcpip.h>
+	#include <afunix.h>
+#else
+	#include <netdb.h>
+	#include <netinet/in.h>
+	#include <netinet/tcp.h>
+	#include <poll.h>
+	#include <sys/socket.h>
+	#include <sys/stat.h>
+	#include <sys/un.h>
+	#include <unistd.h>
+#endif
+
+
+
+namespace Net {
+
+
+
+#ifdef _WIN32
+	static void _close(Handle handle) { closesocket(static_cast<SOCKET>(handle)); }
+	static Handle const _invalid = static_cast<Handle>(INVALID_SOCKET);
+	typedef int _ssize;
+#else
+	static void _close(Handle handle) { close(handle); }
+	static Handle const _invalid = -1;
+	typedef ssize_t _ssize;
+#endif
+
+//Sending on a connection the other end has closed must fail, not raise `SIGPIPE`.
+#ifdef MSG_NOSIGNAL
+	static int const _send_flags = MSG_NOSIGNAL;
+#else
+	static int const _send_flags = 0;
+#endif
+static void _setup(Handle handle, bool tcp) {
+	int one = 1;
+	#ifdef SO_NOSIGPIPE
+		setsockopt( handle, SOL_SOCKET,SO_NOSIGPIPE, &one,sizeof(one) );
+	#endif
+	//	Messages are small and latency matters more than throughput.  (Unix-domain sockets don't
+	//		batch small writes in the first place.)
+	if (tcp) setsockopt( handle, IPPROTO_TCP,TCP_NODELAY, reinterpret_cast<char const*>(&one),sizeof(one) );
+}
+
+//Address of the Unix-domain socket at `path`.  Prints an error and throws if the path is too long.
+static sockaddr_un _get_local_address(std::string const& path) {
+	sockaddr_un addr = {};
+	addr.sun_family = AF_UNIX;
+	if (path.size()<sizeof(addr.sun_path)); else {
+		fprintf(stderr,"Socket path \"%s\" is too long!\n",path.c_str());
+		throw -1;
+	}
+	memcpy( addr.sun_path, path.c_str(), path.size()+1 );
+	return addr;
+}
+
+//Resolve `host`:`port` (empty host for every interface, when listening)
+static addrinfo* _resolve(std::string const& host, uint16_t port, bool passive) {
+	addrinfo hints = {};
+	hints.ai_family   = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags    = passive ? AI_PASSIVE : 0;
+	addrinfo* result;
+	std::string port_str = std::to_string(port);
+	if (getaddrinfo( host.empty()?nullptr:host.c_str(), port_str.c_str(), &hints, &result )==0); else {
+		fprintf(stderr,"Could not resolve address \"%s:%u\"!\n",host.c_str(),static_cast<unsigned>(port));
+		throw -1;
+	}
+	return result;
+}
+
+
+
+void init  () {
+	#ifdef _WIN32
+		WSADATA data;
+		WSAStartup( MAKEWORD(2,2), &data );
+	#endif
+}
+void deinit() {
+	#ifdef _WIN32
+		WSACleanup();
+	#endif
+}
+
+
+
+Socket::~Socket() {
+	_close(_handle);
+}
+
+Socket* Socket::connect(std::string const& host, uint16_t port) {
+	addrinfo* addresses = _resolve( host,port, false );
+	Handle handle = _invalid;
+	for (addrinfo* addr=addresses; addr!=nullptr; addr=addr->ai_next) {
+		handle = static_cast<Handle>(socket( addr->ai_family, addr->ai_socktype, addr->ai_protocol ));
+		if (handle==_invalid) continue;
+		if (::connect( handle, addr->ai_addr, static_cast<int>(addr->ai_addrlen) )==0) break;
+		_close(handle);
+		handle = _invalid;
+	}
+	freeaddrinfo(addresses);
+
+	if (handle!=_invalid); else {
+		fprintf(stderr,"Could not connect to \"%s:%u\"!\n",host.c_str(),static_cast<unsigned>(port));
+		throw -2;
+	}
+	_setup( handle, true );
+	return new Socket(handle);
+}
+
+Socket* Socket::connect_local(std::string const& path) {
+	sockaddr_un addr = _get_local_address(path);
+	Handle handle = static_cast<Handle>(socket( AF_UNIX, SOCK_STREAM, 0 ));
+	if (handle!=_invalid); else {
+		fprintf(stderr,"Could not create socket!\n");
+		throw -2;
+	}
+	if (::connect( handle, reinterpret_cast<sockaddr const*>(&addr), sizeof(addr) )==0); else {
+		_close(handle);
+		fprintf(stderr,"Could not connect to \"%s\"!\n",path.c_str());
+		throw -2;
+	}
+	_setup( handle, false );
+	return new Socket(handle);
+}
+
+bool Socket::send(void const* data, size_t size) {
+	char const* ptr = static_cast<char const*>(data);
+	while (size>0) {
+		_ssize sent = ::send( _handle, ptr, static_cast<int>(std::min(size,1_zu<<30)), _send_flags );
+		if (sent<=0) return false;
+		ptr  += sent;
+		size -= static_cast<size_t>(sent);
+	}
+	return true;
+}
+
+bool   Socket::recv     (void* data, size_t size) {
+	char* ptr = static_cast<char*>(data);
+	while (size>0) {
+		size_t received = recv_some( ptr, size );
+		if (received==0) return false;
+		ptr  += received;
+		size -= received;
+	}
+	return true;
+}
+size_t Socket::recv_some(void* data, size_t size) {
+	_ssize received = ::recv( _handle, static_cast<char*>(data), static_cast<int>(std::min(size,1_zu<<30)), 0 );
+	return received>0 ? static_cast<size_t>(received) : 0;
+}
+
+bool Socket::send_message(uint32_t  type, void const* payload,size_t size) {
+	if (size<=MAX_PAYLOAD_SIZE); else {
+		fprintf(stderr,"Message payload of %zu bytes is too large to send!\n",size);
+		return false;
+	}
+
+	//	Sent all at once, so that a message is never split into separate writes.
+	uint32_t header[2] = { type, static_cast<uint32_t>(size) };
+	std::vector<uint8_t> data( sizeof(header) );
+	memcpy( data.data(), header, sizeof(header) );
+	uint8_t const* bytes = static_cast<uint8_t const*>(payload);
+	if (size>0) data.insert( data.end(), bytes,bytes+size );
+	return send( data.data(), data.size() );
+}
+bool Socket::recv_message(uint32_t* type, std::vector<uint8_t>* payload  ) {
+	uint32_t header[2];
+	if (recv( header, sizeof(header) )); else return false;
+	//	The size comes from the peer, so it's checked before anything is allocated for it.
+	if (header[1]<=MAX_PAYLOAD_SIZE); else return false;
+	*type = header[0];
+	payload->resize(header[1]);
+	return header[1]==0 || recv( payload->data(), header[1] );
+}
+
+
+
+Listener::Listener(std::string const& host, uint16_t port) {
+	addrinfo* addresses = _resolve( host,port, true );
+	_handle = _invalid;
+	for (addrinfo* addr=addresses; addr!=nullptr; addr=addr->ai_next) {
+		_handle = static_cast<Handle>(socket( addr->ai_family, addr->ai_socktype, addr->ai_protocol ));
+		if (_handle==_invalid) continue;
+		int one = 1;
+		setsockopt( _handle, SOL_SOCKET,SO_REUSEADDR, reinterpret_cast<char const*>(&one),sizeof(one) );
+		if (
+			bind( _handle, addr->ai_addr, static_cast<int>(addr->ai_addrlen) )==0 &&
+			listen( _handle, 64 )==0
+		) break;
+		_close(_handle);
+		_handle = _invalid;
+	}
+	freeaddrinfo(addresses);
+
+	if (_handle!=_invalid); else {
+		fprintf(stderr,"Could not listen on \"%s:%u\"!\n",host.c_str(),static_cast<unsigned>(port));
+		throw -2;
+	}
+}
+Listener::Listener(std::string const& path) :
+	_path(path)
+{
+	sockaddr_un addr = _get_local_address(path);
+
+	//	A socket file left behind (by a server that crashed) would make binding fail.  Note only
+	//		sockets are removed, in case the path is wrong.
+	#ifndef _WIN32
+	struct stat info;
+	if (stat( path.c_str(), &info )==0 && S_ISSOCK(info.st_mode)) remove(path.c_str());
+	#endif
+
+	_handle = static_cast<Handle>(socket( AF_UNIX, SOCK_STREAM, 0 ));
+	if (
+		_handle!=_invalid &&
+		bind( _handle, reinterpret_cast<sockaddr const*>(&addr), sizeof(addr) )==0 &&
+		listen( _handle, 64 )==0
+	); else {
+		if (_handle!=_invalid) _close(_handle);
+		fprintf(stderr,"Could not listen on \"%s\"!\n",path.c_str());
+		throw -2;
+	}
+}
+Listener::~Listener() {
+	_close(_handle);
+	if (!_path.empty()) remove(_path.c_str());
+}
+
+Socket* Listener::accept() {
+	Handle handle = static_cast<Handle>(::accept( _handle, nullptr,nullptr ));
+	if (handle==_invalid) return nullptr;
+	_setup( handle, _path.empty() );
+	return new Socket(handle);
+}
+
+
+
+std::vector<bool> poll(std::vector<Handle> const& handles, int timeout_ms) {
+	#ifdef _WIN32
+		std::vector<WSAPOLLFD> fds(handles.size());
+	#else
+		std::vector<pollfd>    fds(handles.size());
+	#endif
+	for (size_t i=0;i<handles.size();++i) {
+		fds[i].fd     = handles[i];
+		fds[i].events = POLLIN;
+	}
+
+	#ifdef _WIN32
+		int num_ready = WSAPoll( fds.data(), static_cast<ULONG>(fds.size()), timeout_ms );
+	#else
+		int num_ready = ::poll ( fds.data(), static_cast<nfds_t>(fds.size()), timeout_ms );
+	#endif
+
+	std::vector<bool> ready(handles.size(),false);
+	if (num_ready>0) {
+		for (size_t i=0;i<handles.size();++i) {
+			ready[i] = ( fds[i].revents & (POLLIN|POLLHUP|POLLERR) ) != 0;
+		}
+	}
+	return ready;
+}
+
+void parse_address(std::string const& address, std::string* host,uint16_t* port) {
+	size_t colon = address.rfind(':');
+	std::string port_str;
+	if (colon!=std::string::npos) {
+		*host    = address.substr(0,colon);
+		port_str = address.substr(colon+1);
+	} else {
+		host->clear();
+		port_str = address;
+	}
+	try {
+		unsigned value = Str::to_pos(port_str);
+		if (value<=65535u); else throw -1;
+		*port = static_cast<uint16_t>(value);
+	} catch (...) {
+		fprintf(stderr,"Invalid address \"%s\"!  (Expected \"<host>:<port>\".)\n",address.c_str());
+		throw -1;
+	}
+}
+
+
+
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "../stdafx.hpp"
+
+
+
+//Minimal blocking TCP and Unix-domain sockets, over BSD sockets (or Winsock on Windows).
+namespace Net {
+
+
+
+#ifdef _WIN32
+typedef uintptr_t Handle;
+#else
+typedef int       Handle;
+#endif
+
+//Must be called before using sockets, and after (needed on Windows).
+void init  ();
+void deinit();
+
+//Connected socket
+class Socket final {
+	private:
+		Handle _handle;
+
+	public:
+		explicit Socket(Handle handle) : _handle(handle) {}
+		~Socket();
+
+		//Connect to `host`:`port`, or to the Unix-domain socket at `path`.  Prints an error and
+		//	throws if it fails.
+		static Socket* connect      (std::string const& host, uint16_t port);
+		static Socket* connect_local(std::string const& path               );
+
+		Handle get_handle() const { return _handle; }
+
+		//Send all of `data`.  Returns whether successful (i.e., false if the connection was lost).
+		bool send(void const* data, size_t size);
+
+		//Receive exactly `size` bytes, or whatever is available (at least one byte, waiting if
+		//	necessary) up to `size` bytes.  Return whether successful, or the number of bytes
+		//	received (zero if the connection was closed or lost), respectively.
+		bool   recv     (void* data, size_t size);
+		size_t recv_some(void* data, size_t size);
+
+		//Largest payload of a message.  Far more than any message needs, but it keeps a peer from
+		//	making the receiver allocate arbitrary amounts of memory.
+		static constexpr size_t MAX_PAYLOAD_SIZE = 1_zu << 26;
+
+		//Send or receive a whole message: a `uint32_t` type, a `uint32_t` payload size, and the
+		//	payload.  Return whether successful (false also if the payload is larger than
+		//	`MAX_PAYLOAD_SIZE`, which is not sent or received).
+		bool send_message(uint32_t  type, void const* payload,size_t size);
+		bool recv_message(uint32_t* type, std::vector<uint8_t>* payload  );
+};
+
+//Listening socket
+class Listener final {
+	private:
+		Handle _handle;
+		//Path of the Unix-domain socket, if it is one (removed when done)
+		std::string _path;
+
+	public:
+		//Listen on `host` (empty for every interface) and `port`, or on a Unix-domain socket at
+		//	`path` (replacing a stale one).  Prints an error and throws if it fails.
+		         Listener(std::string const& host, uint16_t port);
+		explicit Listener(std::string const& path               );
+		~Listener();
+
+		Handle get_handle() const { return _handle; }
+
+		//Accept a connection (waiting for one if necessary), or return null if that fails.
+		Socket* accept();
+};
+
+//Wait until any of `handles` has data to read (or a connection to accept, or has closed), or until
+//	`timeout_ms` milliseconds pass.  Returns which are ready.
+std::vector<bool> poll(std::vector<Handle> const& handles, int timeout_ms);
+
+//Parse "<host>:<port>" (or just "<port>", leaving `host` empty).  Prints an error and throws if it
+//	is invalid.
+void parse_address(std::string const& address, std::string* host,uint16_t* port);
+
+
+
+}
@@ -0,0 +1,60 @@
+#include "spherical-rect.hpp"
+
+
+
+namespace Math {
+
+
+
+SphericalRectangle::SphericalRectangle(
+	Pos const& from,
+	Pos const& corner, Dir const& axis_x,Dir const& axis_y, float len_x,float len_y
+) :
+	x(axis_x), y(axis_y), z(glm::cross(axis_x,axis_y))
+{
+	//Corner in the local frame
+	Dir d = corner - from;
+	x0 = glm::dot(d,x);
+	y0 = glm::dot(d,y);
+	z0 = glm::dot(d,z);
+	//	Flip the normal so that it points away from the viewpoint.
+	if (z0>0.0f) {
+		z  = -z;
+		z0 = -z0;
+	}
+	x1 = x0 + len_x;
+	y1 = y0 + len_y;
+
+	//Seen edge-on, or from the plane of the rectangle itself.  Nothing to sample.
+	if (z0<0.0f); else {
+		b0=b1=k = 0.0f;
+		surface_area = 0.0f;
+		return;
+	}
+
+	//Normals of the planes through the viewpoint and each edge of the rectangle.  These are the
+	//	normalized cross products of adjacent corners, which simplify to the following.
+	float z0sq = z0*z0;
+	glm::vec3 n0 = glm::vec3(  0.0f,    z0, -y0 ) / std::sqrt( z0sq + y0*y0 );
+	glm::vec3 n1 = glm::vec3(   -z0,  0.0f,  x1 ) / std::sqrt( z0sq + x1*x1 );
+	glm::vec3 n2 = glm::vec3(  0.0f,   -z0,  y1 ) / std::sqrt( z0sq + y1*y1 );
+	glm::vec3 n3 = glm::vec3(    z0,  0.0f, -x0 ) / std::sqrt( z0sq + x0*x0 );
+
+	//Interior angles of the spherical rectangle
+	radians g0 = std::acos(glm::clamp( -glm::dot(n0,n1), -1.0f,1.0f ));
+	radians g1 = std::acos(glm::clamp( -glm::dot(n1,n2), -1.0f,1.0f ));
+	radians g2 = std::acos(glm::clamp( -glm::dot(n2,n3), -1.0f,1.0f ));
+	radians g3 = std::acos(glm::clamp( -glm::dot(n3,n0), -1.0f,1.0f ));
+
+	b0 = n0.z;
+	b1 = n2.z;
+	k = 2.0f*Constants::pi<float> - g2 - g3;
+
+	//Surface area by the spherical excess (Girard's theorem generalized to quadrilaterals).
+	surface_area = g0 + g1 - k;
+	if (surface_area>=0); else surface_area=0; //Numerical issues
+}
+
+
+
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "../stdafx.hpp"
+
+
+
+namespace Math {
+
+
+
+//Projection of a rectangle onto the unit sphere centered at some viewpoint.  The construction
+//	follows "An Area-Preserving Parametrization for Spherical Rectangles" by Ureña et al.:
+//		https://www.arnoldrenderer.com/research/egsr2013_spherical_rectangle.pdf
+class SphericalRectangle final {
+	public:
+		//Local reference frame.  `x` and `y` are along the rectangle's edges and `z` is the
+		//	rectangle's normal, flipped if necessary so that it points away from the viewpoint.
+		Dir x, y, z;
+
+		//Rectangle's extent in the local frame, relative to the viewpoint.  The rectangle spans
+		//	[`x0`,`x1`]⨯[`y0`,`y1`] in the plane "z=`z0`" (with `z0`≤0).
+		float x0,x1, y0,y1, z0;
+
+		//Constants for sampling: the "z" components of the normals of the planes through the
+		//	viewpoint and the edges at "y=y0" and "y=y1", and the sum of the two remaining interior
+		//	angles, offset by "2π".
+		float b0,b1, k;
+
+		//Area (on the surface of the sphere); also equal to the solid angle subtended.
+		union {
+			float surface_area;
+			float solid_angle;
+		};
+
+	public:
+		//Rectangle with corner `corner` and edges `len_x`⨯`axis_x` and `len_y`⨯`axis_y`, seen from
+		//	`from`.  The axes must be orthonormal.
+		SphericalRectangle(
+			Pos const& from,
+			Pos const& corner, Dir const& axis_x,Dir const& axis_y, float len_x,float len_y
+		);
+		~SphericalRectangle() = default;
+};
+
+
+
+}
@@ -23,6 +23,28 @@ inline bool endswith  (std::string const& main, std::string const& test) {
 	}
 }
 
+//`str` escaped for use inside a JSON string (quotes, backslashes, and control characters)
+inline std::string json_escape(std::string const& str) {
+	std::string result;
+	for (char c : str) {
+		switch (c) {
+			case '"':  result+="\\\""; break;
+			case '\\': result+="\\\\"; break;
+			case '\n': result+="\\n";  break;
+			case '\r': result+="\\r";  break;
+			case '\t': result+="\\t";  break;
+			default:
+				if (static_cast<unsigned char>(c)>=0x20u) result.push_back(c);
+				else {
+					char buffer[7];
+					snprintf( buffer,sizeof(buffer), "\\u%04x", static_cast<unsigned>(c) );
+					result += buffer;
+				}
+		}
+	}
+	return result;
+}
+
 inline std::vector<std::string> split(std::string const& main, std::string const& test, size_t max_splits=~size_t(0)) {
 	std::vector<std::string> result;
 	size_t num_splits = 0;
@@ -55,6 +77,17 @@ inline unsigned to_pos (std::string const& str) {
 	if (val>0) return static_cast<unsigned>(val);
 	throw -2; //Not strictly positive
 }
+inline float    to_float(std::string const& str) {
+	size_t i;
+	float value;
+	try {
+		value = std::stof(str,&i);
+	} catch (...) {
+		throw -1; //Not a number
+	}
+	if (i==str.length()) return value;
+	throw -1; //Contained non-number values
+}
 
 
 
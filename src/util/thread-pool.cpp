@@ -0,0 +1,60 @@
+#include "thread-pool.hpp"
+
+
+
+ThreadPool::ThreadPool(size_t num_threads) :
+	_stopping(false)
+{
+	//	Note `std::thread::hardware_concurrency()` returns zero if it can't tell.
+	if (num_threads>0); else num_threads=std::max( std::thread::hardware_concurrency(), 1u );
+
+	_threads.resize(num_threads);
+	for (std::thread*& thread : _threads) {
+		thread = new std::thread( &ThreadPool::_threadwork, this );
+	}
+}
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_stopping = true;
+		_cv.notify_all();
+	}
+	for (std::thread* thread : _threads) {
+		thread->join();
+		delete thread;
+	}
+}
+
+std::future<void> ThreadPool::submit(std::function<void()> const& task) {
+	std::packaged_task<void()> packaged(task);
+	std::future<void> future = packaged.get_future();
+
+	std::lock_guard<std::mutex> lock(_mutex);
+	_tasks.emplace_back(std::move(packaged));
+	_cv.notify_one();
+
+	return future;
+}
+std::future<void> ThreadPool::submit(ThreadPool* pool, std::function<void()> const& task) {
+	if (pool!=nullptr) return pool->submit(task);
+
+	std::packaged_task<void()> packaged(task);
+	std::future<void> future = packaged.get_future();
+	packaged();
+	return future;
+}
+
+void ThreadPool::_threadwork() {
+	std::unique_lock<std::mutex> lock(_mutex);
+	while (true) {
+		_cv.wait( lock, [&]() -> bool { return _stopping || !_tasks.empty(); } );
+		if (!_tasks.empty()); else break;
+
+		std::packaged_task<void()> task = std::move(_tasks.front());
+		_tasks.pop_front();
+
+		lock.unlock();
+		task();
+		lock.lock();
+	}
+}
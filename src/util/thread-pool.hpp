@@ -0,0 +1,33 @@
+#pragma once
+
+#include "../stdafx.hpp"
+
+
+
+//Fixed set of threads that run submitted tasks in order, so that many short jobs (e.g. a batch of
+//	small renders) don't each pay for creating and destroying threads.
+class ThreadPool final {
+	private:
+		std::vector<std::thread*> _threads;
+
+		std::mutex _mutex;
+		std::condition_variable _cv;
+		std::deque<std::packaged_task<void()>> _tasks;
+		bool _stopping;
+
+	public:
+		//Create `num_threads` threads (zero for one per hardware thread).
+		explicit ThreadPool(size_t num_threads);
+		//Finishes the tasks already submitted, and then stops the threads.
+		~ThreadPool();
+
+		size_t get_num_threads() const { return _threads.size(); }
+
+		//Queue `task` to run on the next free thread.  The future becomes ready when it finishes.
+		std::future<void> submit(std::function<void()> const& task);
+		//	Likewise on `pool`, or if it's null, run `task` on the calling thread right away.
+		static std::future<void> submit(ThreadPool* pool, std::function<void()> const& task);
+
+	private:
+		void _threadwork();
+};
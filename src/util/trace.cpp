@@ -0,0 +1,153 @@
+#include "trace.hpp"
+
+
+
+namespace Trace {
+
+
+
+//Events kept per thread
+#define TRACE_BUFFER_SIZE 65536_zu
+
+struct _Event final {
+	char const* name;
+	Arg args[3];
+	size_t num_args;
+	std::chrono::steady_clock::time_point begin;
+	std::chrono::steady_clock::time_point end;
+};
+
+//A thread's events.  Only the thread writes them; `count` is published after each, so the events
+//	before it can be read from other threads.
+struct _Buffer final {
+	size_t index;
+	char const* name;
+	std::vector<_Event> events;
+	std::atomic<size_t> count;
+};
+
+//All threads' buffers (kept after their threads finish, so their events can still be saved).  The
+//	lock is only taken when a thread records its first event, and when saving.
+static class _Registry final { public:
+	std::mutex mutex;
+	std::vector<_Buffer*> buffers;
+	~_Registry() { for (_Buffer* buffer : buffers) delete buffer; }
+} _registry;
+
+static bool _enabled = false;
+static std::chrono::steady_clock::time_point _time_start;
+
+static thread_local _Buffer* _buffer = nullptr;
+
+static _Buffer* _get_buffer() {
+	if (_buffer==nullptr) {
+		_buffer = new _Buffer;
+		_buffer->name = nullptr;
+		_buffer->events.resize(TRACE_BUFFER_SIZE);
+		_buffer->count = 0;
+
+		std::lock_guard<std::mutex> lock(_registry.mutex);
+		_buffer->index = _registry.buffers.size();
+		_registry.buffers.push_back(_buffer);
+	}
+	return _buffer;
+}
+
+void enable() {
+	if (!_enabled) {
+		_time_start = std::chrono::steady_clock::now();
+		_enabled = true;
+	}
+}
+bool is_enabled() {
+	return _enabled;
+}
+
+void name_thread(char const* name) {
+	if (_enabled) _get_buffer()->name=name;
+}
+
+Scope::Scope(char const* name, Arg const& arg0, Arg const& arg1, Arg const& arg2) {
+	if (_enabled); else {
+		_name = nullptr;
+		return;
+	}
+
+	_name = name;
+	_args[0]=arg0; _args[1]=arg1; _args[2]=arg2;
+	_num_args = 0;
+	while (_num_args<3 && _args[_num_args].name!=nullptr) ++_num_args;
+	_begin = std::chrono::steady_clock::now();
+}
+Scope::~Scope() {
+	if (_name!=nullptr); else return;
+
+	_Buffer* buffer = _get_buffer();
+	size_t count = buffer->count.load(std::memory_order_relaxed);
+	_Event& event = buffer->events[ count % TRACE_BUFFER_SIZE ];
+	event.name = _name;
+	std::copy_n( _args, 3, event.args );
+	event.num_args = _num_args;
+	event.begin = _begin;
+	event.end = std::chrono::steady_clock::now();
+	buffer->count.store( count+1, std::memory_order_release );
+}
+
+bool save(std::string const& path) {
+	FILE* file = fopen(path.c_str(),"wb");
+	if (file!=nullptr); else {
+		fprintf(stderr,"Could not open trace file \"%s\" for writing!\n",path.c_str());
+		return false;
+	}
+
+	//	Microseconds since recording started
+	auto get_time = [](std::chrono::steady_clock::time_point const& time) -> double {
+		return static_cast<double>(
+			std::chrono::duration_cast<std::chrono::nanoseconds>(time-_time_start).count()
+		) * 1.0e-3;
+	};
+
+	fprintf(file,"{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	bool first = true;
+	std::lock_guard<std::mutex> lock(_registry.mutex);
+	for (_Buffer const* buffer : _registry.buffers) {
+		if (first) first=false; else fprintf(file,",\n");
+		if (buffer->name!=nullptr) {
+			fprintf(file,
+				"{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%zu,\"args\":{\"name\":\"%s %zu\"}}",
+				buffer->index, buffer->name,buffer->index
+			);
+		} else {
+			fprintf(file,
+				"{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%zu,\"args\":{\"name\":\"thread %zu\"}}",
+				buffer->index, buffer->index
+			);
+		}
+
+		//	If the buffer wrapped around, only the newest events are left.
+		size_t count = buffer->count.load(std::memory_order_acquire);
+		for (size_t k=count>TRACE_BUFFER_SIZE?count-TRACE_BUFFER_SIZE:0; k<count; ++k) {
+			_Event const& event = buffer->events[ k % TRACE_BUFFER_SIZE ];
+			fprintf(file,
+				",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%zu,\"ts\":%.3f,\"dur\":%.3f,\"args\":{",
+				event.name, buffer->index, get_time(event.begin), get_time(event.end)-get_time(event.begin)
+			);
+			for (size_t l=0;l<event.num_args;++l) {
+				fprintf(file,"%s\"%s\":%lld", l>0?",":"", event.args[l].name,static_cast<long long>(event.args[l].value));
+			}
+			fprintf(file,"}}");
+		}
+	}
+	fprintf(file,"\n]}\n");
+
+	bool success = ferror(file)==0;
+	fclose(file);
+	if (success); else {
+		fprintf(stderr,"Could not write trace file \"%s\"!\n",path.c_str());
+	}
+	return success;
+}
+
+
+
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "../stdafx.hpp"
+
+
+
+//Timeline of what each thread was doing, saved in the Chrome/Perfetto trace-event format (open it in
+//	"chrome://tracing" or "ui.perfetto.dev").  Each thread records into its own ring buffer, so
+//	recording takes no lock; when a buffer fills, its oldest events are overwritten.  Recording is
+//	off unless enabled, in which case a scope costs two clock reads.
+namespace Trace {
+
+
+
+//Integer argument of an event, shown with it in the viewer
+struct Arg final {
+	char const* name;
+	int64_t value;
+};
+
+//Start recording events.  Call before starting the threads whose events are wanted.
+void enable();
+bool is_enabled();
+
+//Names the calling thread in the timeline (by default, threads are numbered).
+void name_thread(char const* name);
+
+//Records an event on the calling thread spanning the scope's lifetime.  Names (of the event and its
+//	arguments) must be string literals (or otherwise outlive the recording).
+class Scope final {
+	private:
+		char const* _name;
+		Arg _args[3];
+		size_t _num_args;
+		std::chrono::steady_clock::time_point _begin;
+
+	public:
+		explicit Scope(char const* name) : Scope(name,{nullptr,0},{nullptr,0},{nullptr,0}) {}
+		Scope(char const* name, Arg const& arg0, Arg const& arg1={nullptr,0}, Arg const& arg2={nullptr,0});
+		~Scope();
+};
+
+//Save the events recorded so far to `path`.  Other threads should not be recording meanwhile (e.g.,
+//	save after a render's threads finish).  Returns whether successful.
+bool save(std::string const& path);
+
+
+
+}